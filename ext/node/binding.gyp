@@ -3,7 +3,7 @@
         'target_name': 'shmmap',
         'include_dirs': ['../../src'],
         'link_settings': {
-            'libraries': ['#LIB_DIR#/libshmmap.a']
+            'libraries': ['#LIB_DIR#/libshmmap.a', '-lpthread', '-lrt']
         },
         'sources': ['shmmap.cc']
     }]
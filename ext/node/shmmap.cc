@@ -17,12 +17,13 @@ Handle<Value> init(const Arguments &arg){
 	HandleScope scope;
 
 	int capacity = (int)arg[0]->Int32Value();
-	int mem_size = (int)arg[1]->Int32Value();
+	size_t mem_size = (size_t)arg[1]->IntegerValue();
 	Local<String> data_file = arg[2]->ToString();
 	char *dat = new char[data_file->Length() + 1];
 	data_file->WriteAscii(dat);
 	log_cb = Local<Function>::Cast(arg[3]);
-	bool success = map_init(capacity, mem_size, dat, node_shmmap_log);
+	int flags = arg.Length() > 4 ? (int)arg[4]->Int32Value() : 0;
+	bool success = map_init_opt(capacity, mem_size, dat, node_shmmap_log, flags);
 	delete[] dat;
 
 	return scope.Close(Boolean::New(success));
@@ -52,11 +53,16 @@ Handle<Value> get(const Arguments &arg){
 	Local<String> k = arg[0]->ToString();
 	char *key = new char[k->Length()+1];
 	k->WriteAscii(key);
+	map_reader_enter();
 	const char *val = map_get(key);
 	delete[] key;
-	if(val == NULL)
+	if(val == NULL){
+		map_reader_exit();
 		return scope.Close(Undefined());
-	return scope.Close(String::New(val));
+	}
+	Local<String> v = String::New(val);
+	map_reader_exit();
+	return scope.Close(v);
 }
 
 Handle<Value> map_contains(const Arguments& args) {
@@ -70,6 +76,17 @@ Handle<Value> map_contains(const Arguments& args) {
 	return scope.Close(Boolean::New(exists));
 }
 
+Handle<Value> map_remove(const Arguments& args) {
+	HandleScope scope;
+
+	Local<String> k = args[0]->ToString();
+	char *key = new char[k->Length() + 1];
+	k->WriteAscii(key);
+	bool removed = map_remove(key);
+	delete[] key;
+	return scope.Close(Boolean::New(removed));
+}
+
 Handle<Value> map_size(const Arguments& args) {
 	HandleScope scope;
 	Local<Number> _size = Number::New(map_size());
@@ -80,21 +97,86 @@ Handle<Value> map_iter(const Arguments& args) {
 	HandleScope scope;
 
 	iter_cb = Local<Function>::Cast(args[0]);
+	map_reader_enter();
 	map_iter(node_key_iter);
+	map_reader_exit();
 	return scope.Close(Undefined());
 }
 
+static Local<Array> cursor_to_array(const shm_map_cursor &cur){
+	Local<Array> a = Array::New(4);
+	a->Set(0, Integer::New(cur.bulk));
+	a->Set(1, Integer::New(cur.split));
+	a->Set(2, Integer::New(cur.skip));
+	a->Set(3, Integer::New(cur.end));
+	return a;
+}
+
+/* 第part份(共parts份)的游标 */
+Handle<Value> map_scan_cursor(const Arguments& args) {
+	HandleScope scope;
+
+	shm_map_cursor cur;
+	int part = args.Length() > 0 ? (int)args[0]->Int32Value() : 0;
+	int parts = args.Length() > 1 ? (int)args[1]->Int32Value() : 1;
+	map_scan_init(&cur, part, parts);
+	return scope.Close(cursor_to_array(cur));
+}
+
+/*
+ * 从游标处扫描最多batch个key，返回[游标, [k, v, k, v, ...]]，游标为null时扫描结束
+ * 每次只处理一批，调用者可以在两批之间让出事件循环
+ */
+Handle<Value> map_scan(const Arguments& args) {
+	HandleScope scope;
+
+	shm_map_cursor cur;
+	Local<Array> c = Local<Array>::Cast(args[0]);
+	int batch = args.Length() > 1 ? (int)args[1]->Int32Value() : 100;
+	if(batch <= 0)
+		batch = 100;
+	cur.bulk = c->Get(0)->Int32Value();
+	cur.split = c->Get(1)->Int32Value();
+	cur.skip = c->Get(2)->Int32Value();
+	cur.end = c->Get(3)->Int32Value();
+
+	shm_map_kv *kvs = new shm_map_kv[batch];
+	map_reader_enter();
+	int n = map_scan(&cur, kvs, batch);
+	Local<Array> items = Array::New(n * 2);
+	for(int i=0; i<n; i++){
+		items->Set(i * 2, String::New((const char *)kvs[i].k, kvs[i].k_len));
+		items->Set(i * 2 + 1, String::New((const char *)kvs[i].v, kvs[i].v_len));
+	}
+	map_reader_exit();
+	delete[] kvs;
+
+	Local<Array> ret = Array::New(2);
+	if(n == 0)
+		ret->Set(0, Null());
+	else
+		ret->Set(0, cursor_to_array(cur));
+	ret->Set(1, items);
+	return scope.Close(ret);
+}
+
 Handle<Value> map_info(const Arguments& args) {
 	HandleScope scope;
 
 	M_mem_info info;
-	m_memory_info(&info);
+	M_pool_stats stats;
+	m_memory_info(shm_map_pool(map_default()), &info);
+	m_stats(shm_map_pool(map_default()), &stats);
 	Local<Object> mem_info = Object::New();
 	mem_info->Set(String::NewSymbol("pool_size"), Number::New(info.pool_size));
 	mem_info->Set(String::NewSymbol("free_area_size"), Number::New(info.free_area_size));
 	mem_info->Set(String::NewSymbol("allocated_area_size"), Number::New(info.allocated_area_size));
 	mem_info->Set(String::NewSymbol("used_size"), Number::New(info.real_used_size));
 	mem_info->Set(String::NewSymbol("free_size"), Number::New(info.allocated_area_free_size + info.free_area_size));
+	mem_info->Set(String::NewSymbol("block_used_size"), Number::New(stats.used_bytes));
+	mem_info->Set(String::NewSymbol("alloc_count"), Number::New(stats.alloc_count));
+	mem_info->Set(String::NewSymbol("free_count"), Number::New(stats.free_count));
+	mem_info->Set(String::NewSymbol("alloc_failed"), Number::New(stats.alloc_failed));
 
 	return scope.Close(mem_info);
 }
@@ -110,8 +192,14 @@ void initilizer(Handle<Object> target){
 			FunctionTemplate::New(map_size)->GetFunction());
 	target->Set(String::NewSymbol("contains"),
 			FunctionTemplate::New(map_contains)->GetFunction());
+	target->Set(String::NewSymbol("remove"),
+			FunctionTemplate::New(map_remove)->GetFunction());
 	target->Set(String::NewSymbol("iter"),
 			FunctionTemplate::New(map_iter)->GetFunction());
+	target->Set(String::NewSymbol("scanCursor"),
+			FunctionTemplate::New(map_scan_cursor)->GetFunction());
+	target->Set(String::NewSymbol("scan"),
+			FunctionTemplate::New(map_scan)->GetFunction());
 	target->Set(String::NewSymbol("info"),
 			FunctionTemplate::New(map_info)->GetFunction());
 }
@@ -20,3 +20,11 @@ console.log('contains: abc', shmmap.contains('abc'));
 console.log('contains: 1abc', shmmap.contains('1abc'));
 
 console.log(shmmap.put('abc', '123456'));
+
+(function scan(cur){
+	var r = shmmap.scan(cur, 100);
+	for(var i=0; i<r[1].length; i+=2)
+		console.log('scan', r[1][i], r[1][i+1]);
+	if(r[0] !== null)
+		setImmediate(function(){ scan(r[0]); });
+})(shmmap.scanCursor(0, 1));
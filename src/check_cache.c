@@ -0,0 +1,163 @@
+/**
+ *
+ * 缓存模式下写入的总量远大于内存池，内存池一直处于用满的状态：每次put都要淘汰成功，
+ * key的个数不会一直增长，经常访问的key不被淘汰，刚写入的key可以读到。
+ * 并发的读者读到的value必须完整，不能是被淘汰的entry的块重用之后的内容。过期的key对读者不可见
+ *
+ * @file check_cache.c
+ * @author chosen0ne
+ * @date 2026-10-17
+ */
+
+#include "shm_map.h"
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#define CHECK_FILE "check_cache.dat"
+#define CHECK_CAPACITY (1 << 15)
+#define CHECK_POOL (4 << 20)
+#define CHECK_HOT 500
+#define CHECK_PUTS 300000
+#define CHECK_RECENT 100
+
+static void
+quiet_log(shmmap_log_level level, const char *fmt, ...){
+	(void)level;
+	(void)fmt;
+}
+
+/* key k的value：| k | ':' | len个填充 |，填充的字符由key决定 */
+static int
+make_value(char *buf, const char *k, int len){
+	int k_len = sprintf(buf, "%s:", k);
+
+	memset(buf + k_len, 'a' + (k[k_len - 2] + len) % 26, len);	// k_len包括':'
+	buf[k_len + len] = 0;
+	return k_len + len;
+}
+
+static bool
+value_ok(const char *k, const char *v, size_t v_len){
+	char 	expect[300];
+	size_t 	k_len = strlen(k);
+
+	if(v_len <= k_len || v_len >= sizeof(expect) || memcmp(v, k, k_len) != 0)
+		return false;
+	make_value(expect, k, (int)(v_len - k_len - 1));
+	return memcmp(expect, v, v_len) == 0;
+}
+
+/* 读者进程：反复读热点key和最近写入的冷key，直到stop被置位 */
+static void
+reader(int flags, volatile int *stop, volatile long *progress){
+	shm_map_t 	*r = shm_map_open(CHECK_CAPACITY, CHECK_POOL, CHECK_FILE, quiet_log, flags);
+	char 		k[32], v[300];
+	const void 	*p;
+	size_t 		p_len;
+	long 		reads;
+	int 		n, bad = 0;
+
+	if(r == NULL)
+		_exit(2);
+	for(reads=0; !*stop; reads++){
+		if(reads & 1)
+			sprintf(k, "h%ld", reads / 2 % CHECK_HOT);
+		else
+			sprintf(k, "c%ld", *progress - reads / 2 % 1000);
+		if(reads & 2){
+			n = shm_map_get_copy(r, k, v, sizeof(v));
+			if(n >= 0)
+				bad += !value_ok(k, v, n);
+		}else{
+			shm_map_reader_enter(r);
+			if(shm_map_get2(r, k, strlen(k), &p, &p_len))
+				bad += !value_ok(k, (const char *)p, p_len);
+			shm_map_reader_exit(r);
+		}
+	}
+	shm_map_close(r);
+	_exit(bad == 0 ? 0 : 1);
+}
+
+static int
+check(int flags){
+	shm_map_t 	*m;
+	char 		k[32], v[300];
+	volatile int 	*stop;
+	volatile long 	*progress;
+	long 		i;
+	int 		j, n, failed_puts = 0, hot = 0, recent = 0, size, expired, status, reader_ok;
+	pid_t 		pid;
+
+	unlink(CHECK_FILE);
+	m = shm_map_open(CHECK_CAPACITY, CHECK_POOL, CHECK_FILE, quiet_log, flags);
+	if(m == NULL)
+		return 1;
+	stop = (volatile int *)mmap(NULL, sizeof(long) * 2, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if(stop == MAP_FAILED)
+		return 1;
+	progress = (volatile long *)(stop + 2);
+	*stop = 0;
+	*progress = 0;
+	for(j=0; j<CHECK_HOT; j++){
+		sprintf(k, "h%d", j);
+		n = make_value(v, k, 100);
+		failed_puts += !shm_map_put2(m, k, strlen(k), v, n);
+	}
+	pid = fork();
+	if(pid == 0)
+		reader(flags, stop, progress);
+	// 写入的总量是内存池的十几倍，写者同时访问热点key
+	for(i=0; i<CHECK_PUTS; i++){
+		sprintf(k, "c%ld", i);
+		n = make_value(v, k, 20 + i % 200);
+		failed_puts += !shm_map_put2(m, k, strlen(k), v, n);
+		*progress = i;
+		if(i % 500 == 0){
+			for(j=0; j<CHECK_HOT; j++){
+				sprintf(k, "h%d", j);
+				shm_map_contains(m, k);
+			}
+		}
+	}
+	*stop = 1;
+	waitpid(pid, &status, 0);
+	reader_ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+	munmap((void *)stop, sizeof(long) * 2);
+
+	for(j=0; j<CHECK_HOT; j++){
+		sprintf(k, "h%d", j);
+		hot += shm_map_contains(m, k);
+	}
+	for(i=CHECK_PUTS-CHECK_RECENT; i<CHECK_PUTS; i++){
+		sprintf(k, "c%ld", i);
+		recent += shm_map_contains(m, k);
+	}
+	size = shm_map_size(m);
+
+	// 过期的key对读者不可见，ttl不大于0时不过期
+	shm_map_put_ttl(m, "t1", 2, "x", 1, 1);
+	shm_map_put_ttl(m, "t2", 2, "y", 1, 0);
+	sleep(2);
+	expired = !shm_map_contains(m, "t1") && shm_map_get_copy(m, "t1", v, sizeof(v)) < 0 && shm_map_contains(m, "t2");
+
+	// 热点key在每轮CLOCK扫描之前都被访问过，允许个别在写者访问之前被淘汰
+	printf("flags %d: %s, %d failed puts, size %d, hot %d/%d, recent %d/%d, reader %s, ttl %s\n", flags,
+		failed_puts == 0 && size < CHECK_PUTS / 10 && hot >= CHECK_HOT * 95 / 100 && recent == CHECK_RECENT
+		&& reader_ok && expired ? "ok" : "FAIL", failed_puts, size, hot, CHECK_HOT, recent, CHECK_RECENT,
+		reader_ok ? "ok" : "FAIL", expired ? "ok" : "FAIL");
+	shm_map_close(m);
+	unlink(CHECK_FILE);
+	return failed_puts != 0 || size >= CHECK_PUTS / 10 || hot < CHECK_HOT * 95 / 100 || recent != CHECK_RECENT
+		|| !reader_ok || !expired;
+}
+
+int
+main(){
+	int failed = 0;
+
+	failed += check(SHM_MAP_CACHE);
+	failed += check(SHM_MAP_CACHE | SHM_MAP_SWISS_INDEX);
+	failed += check(SHM_MAP_CACHE | SHM_MAP_ORDERED_INDEX);
+	return failed != 0;
+}
@@ -0,0 +1,96 @@
+/**
+ *
+ * 写者在顺序锁的写区间内被SIGKILL杀死后，已经打开map的读者不能一直等待
+ * 直接包含shm_map.c，用内部函数制造写了一半的桶
+ *
+ * @file check_dead_writer.c
+ * @author chosen0ne
+ * @date 2026-10-17
+ */
+
+#include "shm_map.c"
+#include <sys/wait.h>
+
+#define CHECK_FILE "check_dead_writer.dat"
+#define CHECK_KEYS 1000
+
+/* 在子进程中打开map，进入k所在桶(组)的写区间后杀死自己 */
+static void
+die_in_write(int flags, const char *k){
+	shm_map_t 	*w = shm_map_open(CHECK_KEYS, 1 << 22, CHECK_FILE, NULL, flags);
+	int 		h, slot;
+	unsigned int *seq_p;
+
+	if(w == NULL)
+		_exit(2);
+	h = key_hash(w, k, strlen(k));
+	if(flags & SHM_MAP_MULTI_WRITER)
+		stripe_lock(w, (flags & SHM_MAP_SWISS_INDEX) ? 0 : h);
+	else
+		intent_begin(w, MAP_INTENT_BUCKET, h);
+	if(flags & SHM_MAP_SWISS_INDEX){
+		if(swiss_find(w, h, k, strlen(k), &slot) == NULL)
+			_exit(2);
+		seq_p = &w->swiss_seq[slot / MAP_GROUP_SLOTS];
+	}else{
+		seq_p = &get_bulk(w, index_for(h, w->grow_info->bulk_count))->seq;
+	}
+	shm_seq_write_begin(seq_p);
+	raise(SIGKILL);
+}
+
+static void
+quiet_log(shmmap_log_level level, const char *fmt, ...){
+	(void)level;
+	(void)fmt;
+}
+
+static int
+check(int flags){
+	shm_map_t 	*m;
+	char 		k[32], v[32], buf[32];
+	int 		i, bad = 0, status;
+	pid_t 		pid;
+
+	unlink(CHECK_FILE);
+	m = shm_map_open(CHECK_KEYS, 1 << 22, CHECK_FILE, quiet_log, flags);
+	if(m == NULL)
+		return 1;
+	for(i=0; i<CHECK_KEYS; i++){
+		sprintf(k, "k%d", i);
+		sprintf(v, "v%d", i);
+		shm_map_put2(m, k, strlen(k), v, strlen(v));
+	}
+	pid = fork();
+	if(pid == 0)
+		die_in_write(flags, "k1");
+	waitpid(pid, &status, 0);
+	if(!WIFSIGNALED(status)){
+		printf("flags %d: the writer didn't die in the write section\n", flags);
+		return 1;
+	}
+	// 读者一直等待时由alarm结束测试
+	alarm(30);
+	for(i=0; i<CHECK_KEYS; i++){
+		sprintf(k, "k%d", i);
+		sprintf(v, "v%d", i);
+		if(shm_map_get_copy(m, k, buf, sizeof(buf)) != (int)strlen(v) || strcmp(buf, v) != 0)
+			bad++;
+	}
+	alarm(0);
+	printf("flags %d: %s, %d bad keys\n", flags, bad == 0 ? "ok" : "FAIL", bad);
+	shm_map_close(m);
+	unlink(CHECK_FILE);
+	return bad != 0;
+}
+
+int
+main(){
+	int failed = 0;
+
+	failed += check(0);
+	failed += check(SHM_MAP_SWISS_INDEX);
+	failed += check(SHM_MAP_MULTI_WRITER);
+	failed += check(SHM_MAP_MULTI_WRITER | SHM_MAP_SWISS_INDEX);
+	return failed != 0;
+}
@@ -0,0 +1,152 @@
+/**
+ *
+ * 读者在shm_map_reader_enter、shm_map_reader_exit之间拿到的指针，在写者替换、删除key之后仍然有效；
+ * 读者离开(或者不调用shm_map_reader_exit就退出)之后，写者释放的块能被回收，反复写入不会用完内存池
+ *
+ * @file check_epoch.c
+ * @author chosen0ne
+ * @date 2026-10-17
+ */
+
+#include "shm_map.h"
+#include <sys/wait.h>
+
+#define CHECK_FILE "check_epoch.dat"
+#define CHECK_KEYS 1000
+#define CHECK_VALUE_LEN 1000
+#define CHECK_POOL (8 << 20)
+/* 读者离开后写者替换所有value的轮数，写入的总量远大于内存池 */
+#define CHECK_ROUNDS 100
+
+static void
+quiet_log(shmmap_log_level level, const char *fmt, ...){
+	(void)level;
+	(void)fmt;
+}
+
+static void
+make_value(char *buf, int key, int round){
+	memset(buf, 'a' + (key + round) % 26, CHECK_VALUE_LEN);
+	sprintf(buf, "%d:%d:", key, round);
+	buf[strlen(buf)] = '-';
+	buf[CHECK_VALUE_LEN] = 0;
+}
+
+/* 替换所有key的value，round为负数时删除所有key */
+static bool
+rewrite(shm_map_t *m, int round){
+	char 	k[32], v[CHECK_VALUE_LEN + 1];
+	int 	i;
+
+	for(i=0; i<CHECK_KEYS; i++){
+		sprintf(k, "k%d", i);
+		if(round < 0){
+			shm_map_remove(m, k);
+			continue;
+		}
+		make_value(v, i, round);
+		if(!shm_map_put2(m, k, strlen(k), v, CHECK_VALUE_LEN))
+			return false;
+	}
+	return true;
+}
+
+/* 读者进程：拿到所有value的指针后通知写者，写者改完后检查指针指向的内容没有变 */
+static void
+pinned_reader(int flags, int ready_fd, int done_fd){
+	shm_map_t 	*r = shm_map_open(CHECK_KEYS, CHECK_POOL, CHECK_FILE, quiet_log, flags);
+	const void 	*ptrs[CHECK_KEYS];
+	char 		k[32], *copy;
+	size_t 		len;
+	int 		i, bad = 0;
+	char 		c = 0;
+
+	copy = (char *)malloc((size_t)CHECK_KEYS * CHECK_VALUE_LEN);
+	if(r == NULL || copy == NULL || !shm_map_reader_enter(r))
+		_exit(2);
+	for(i=0; i<CHECK_KEYS; i++){
+		sprintf(k, "k%d", i);
+		if(!shm_map_get2(r, k, strlen(k), &ptrs[i], &len) || len != CHECK_VALUE_LEN)
+			_exit(3);
+		memcpy(copy + (size_t)i * CHECK_VALUE_LEN, ptrs[i], CHECK_VALUE_LEN);
+	}
+	if(write(ready_fd, &c, 1) != 1 || read(done_fd, &c, 1) != 1)
+		_exit(4);
+	for(i=0; i<CHECK_KEYS; i++){
+		if(memcmp(copy + (size_t)i * CHECK_VALUE_LEN, ptrs[i], CHECK_VALUE_LEN) != 0)
+			bad++;
+	}
+	shm_map_reader_exit(r);
+	_exit(bad == 0 ? 0 : 1);
+}
+
+/* 钉住epoch的读者不调用shm_map_reader_exit就退出 */
+static void
+dead_reader(int flags){
+	shm_map_t *r = shm_map_open(CHECK_KEYS, CHECK_POOL, CHECK_FILE, quiet_log, flags);
+
+	if(r == NULL || !shm_map_reader_enter(r))
+		_exit(2);
+	_exit(0);
+}
+
+static int
+check(int flags){
+	shm_map_t 	*m;
+	int 		ready[2], done[2], i, status, pinned_ok, churn_ok, dead_ok;
+	char 		c = 0;
+	pid_t 		pid;
+
+	unlink(CHECK_FILE);
+	m = shm_map_open(CHECK_KEYS, CHECK_POOL, CHECK_FILE, quiet_log, flags);
+	if(m == NULL || pipe(ready) != 0 || pipe(done) != 0)
+		return 1;
+	rewrite(m, 0);
+
+	// 读者钉住时替换三轮、再全部删除，读者手中的指针不能被回收重用
+	pid = fork();
+	if(pid == 0)
+		pinned_reader(flags, ready[1], done[0]);
+	if(read(ready[0], &c, 1) != 1)
+		return 1;
+	for(i=1; i<=3; i++)
+		rewrite(m, i);
+	rewrite(m, -1);
+	if(write(done[1], &c, 1) != 1)
+		return 1;
+	waitpid(pid, &status, 0);
+	pinned_ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+
+	// 读者离开之后，写入的总量远大于内存池也不会失败
+	for(i=0, churn_ok=1; i<CHECK_ROUNDS && churn_ok; i++)
+		churn_ok = rewrite(m, i);
+
+	// 没有离开就退出的读者也不能让回收永远停止
+	pid = fork();
+	if(pid == 0)
+		dead_reader(flags);
+	waitpid(pid, &status, 0);
+	for(i=0, dead_ok=1; i<CHECK_ROUNDS && dead_ok; i++)
+		dead_ok = rewrite(m, i);
+
+	printf("flags %d: %s, pinned pointers %s, churn after exit %s, churn after a dead reader %s\n", flags,
+		pinned_ok && churn_ok && dead_ok ? "ok" : "FAIL", pinned_ok ? "kept" : "REUSED",
+		churn_ok ? "ok" : "FULL", dead_ok ? "ok" : "FULL");
+	close(ready[0]);
+	close(ready[1]);
+	close(done[0]);
+	close(done[1]);
+	shm_map_close(m);
+	unlink(CHECK_FILE);
+	return !(pinned_ok && churn_ok && dead_ok);
+}
+
+int
+main(){
+	int failed = 0;
+
+	failed += check(0);
+	failed += check(SHM_MAP_SWISS_INDEX);
+	failed += check(SHM_MAP_MULTI_WRITER | SHM_MAP_LOCKFREE_POOL);
+	return failed != 0;
+}
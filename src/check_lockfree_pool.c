@@ -0,0 +1,172 @@
+/**
+ *
+ * 无锁内存池的压力测试：多个进程的多个线程同时分配、释放，
+ * 一半的操作集中在同一个尺寸上，让空闲块栈的栈顶被反复弹出、压入(ABA)。
+ * 同一个块被同时分给两个线程时，块首尾的标记会被另一个线程覆盖
+ *
+ * @file check_lockfree_pool.c
+ * @author chosen0ne
+ * @date 2026-10-17
+ */
+
+#include "m_pool.h"
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CHECK_POOL (64 << 20)
+#define CHECK_PROCS 4
+#define CHECK_THREADS 4
+#define CHECK_OPS 1000000
+/* 每个线程同时持有的块数 */
+#define CHECK_HELD 64
+
+typedef struct check_arg {
+	M_pool *pool;
+	int id;
+	int bad;
+	int failed;
+} check_arg;
+
+typedef struct held_block {
+	uint64_t *p;
+	int len;
+	uint64_t tag;
+} held_block;
+
+static void
+quiet_log(shmmap_log_level level, const char *fmt, ...){
+	(void)level;
+	(void)fmt;
+}
+
+static uint64_t
+next_rand(uint64_t *r){
+	*r ^= *r << 13;
+	*r ^= *r >> 7;
+	*r ^= *r << 17;
+	return *r;
+}
+
+/* 一半是16字节，其余大多是magazine缓存的小块，少数是大的小块和大块 */
+static int
+rand_len(uint64_t *r){
+	uint64_t x = next_rand(r);
+
+	switch(x % 100){
+		case 0:
+			return 20000 + (int)((x >> 8) % 80000);
+		case 1: case 2: case 3:
+			return 1024 + (int)((x >> 8) % (M_SMALL_MAX - 1024));
+		default:
+			return (x & 0x100) ? 16 : 16 + (int)((x >> 9) % 1008);
+	}
+}
+
+static bool
+block_ok(held_block *b){
+	return b->p[0] == b->tag && b->p[b->len / 8 - 1] == b->tag;
+}
+
+static void*
+worker(void *a){
+	check_arg 	*arg = (check_arg *)a;
+	held_block 	held[CHECK_HELD];
+	uint64_t 	r = 0x9e3779b97f4a7c15ULL * (arg->id + 1), seq = 0;
+	int 		i, j;
+
+	memset(held, 0, sizeof(held));
+	for(i=0; i<CHECK_OPS; i++){
+		j = (int)(next_rand(&r) % CHECK_HELD);
+		if(held[j].p != NULL){
+			if(!block_ok(&held[j]))
+				arg->bad++;
+			m_free(arg->pool, held[j].p);
+			held[j].p = NULL;
+			continue;
+		}
+		held[j].len = rand_len(&r) & ~7;
+		held[j].p = (uint64_t *)m_alloc(arg->pool, held[j].len);
+		if(held[j].p == NULL){
+			arg->failed++;
+			continue;
+		}
+		held[j].tag = ((uint64_t)arg->id << 40) | seq++;
+		held[j].p[0] = held[j].tag;
+		held[j].p[held[j].len / 8 - 1] = held[j].tag;
+	}
+	for(j=0; j<CHECK_HELD; j++){
+		if(held[j].p == NULL)
+			continue;
+		if(!block_ok(&held[j]))
+			arg->bad++;
+		m_free(arg->pool, held[j].p);
+	}
+	// 线程退出时magazine中的块和本地的统计自动还给内存池
+	return NULL;
+}
+
+/* 子进程：重新打开内存池，启动CHECK_THREADS个线程 */
+static void
+run_proc(char *mem, int proc){
+	M_pool 		*pool = m_init(mem, CHECK_POOL, quiet_log, true, M_POOL_MULTI_WRITER | M_POOL_LOCKFREE);
+	pthread_t 	tids[CHECK_THREADS];
+	check_arg 	args[CHECK_THREADS];
+	int 		i, bad = 0, failed = 0;
+
+	if(pool == NULL)
+		_exit(2);
+	for(i=0; i<CHECK_THREADS; i++){
+		args[i].pool = pool;
+		args[i].id = proc * CHECK_THREADS + i;
+		args[i].bad = 0;
+		args[i].failed = 0;
+		if(pthread_create(&tids[i], NULL, worker, &args[i]) != 0)
+			_exit(2);
+	}
+	for(i=0; i<CHECK_THREADS; i++){
+		pthread_join(tids[i], NULL);
+		bad += args[i].bad;
+		failed += args[i].failed;
+	}
+	if(bad > 0 || failed > 0)
+		printf("process %d: %d blocks overwritten, %d allocations failed\n", proc, bad, failed);
+	m_destroy(pool);
+	_exit(bad > 0 || failed > 0);
+}
+
+int
+main(){
+	M_pool_stats 	stats;
+	M_pool 			*pool;
+	char 			*mem;
+	int 			i, status, failed = 0;
+	bool 			ok;
+
+	mem = (char *)mmap(NULL, CHECK_POOL, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if(mem == MAP_FAILED)
+		return 1;
+	pool = m_init(mem, CHECK_POOL, quiet_log, false, M_POOL_MULTI_WRITER | M_POOL_LOCKFREE);
+	if(pool == NULL)
+		return 1;
+	for(i=0; i<CHECK_PROCS; i++){
+		if(fork() == 0)
+			run_proc(mem, i);
+	}
+	for(i=0; i<CHECK_PROCS; i++){
+		wait(&status);
+		if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			failed++;
+	}
+	// 所有块都已经释放，magazine也都已经归还
+	m_stats(pool, &stats);
+	ok = failed == 0 && stats.used_bytes == 0 && stats.alloc_count == stats.free_count;
+	printf("%d processes x %d threads: %s, %lld allocs, %lld frees, %lld bytes still used\n",
+		CHECK_PROCS, CHECK_THREADS, ok ? "ok" : "FAIL", (long long)stats.alloc_count,
+		(long long)stats.free_count, (long long)stats.used_bytes);
+	m_destroy(pool);
+	munmap(mem, CHECK_POOL);
+	return !ok;
+}
@@ -0,0 +1,161 @@
+/**
+ *
+ * 写者在写入的过程中被SIGKILL杀死，之后打开map的进程修复它：
+ * 写者已经返回的写入都在，还没有开始的都不在，key的个数和实际的key一致，map可以继续写。
+ * 多写者模式下两个写者同时写不同的key，一起被杀死
+ *
+ * @file check_recover.c
+ * @author chosen0ne
+ * @date 2026-10-17
+ */
+
+#include "shm_map.h"
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <signal.h>
+
+#define CHECK_FILE "check_recover.dat"
+#define CHECK_ROUNDS 10
+#define CHECK_POOL (64 << 20)
+
+static void
+quiet_log(shmmap_log_level level, const char *fmt, ...){
+	(void)level;
+	(void)fmt;
+}
+
+/* 可以扩容的map从很少的桶开始，写入时不断分裂 */
+static int
+capacity(int flags){
+	return (flags & SHM_MAP_GROWABLE) ? 1024 : (1 << 18);
+}
+
+/* 写者w的第i个key和value，value的长度在变化，有的在entry块内，有的单独分配 */
+static int
+make_kv(char *k, char *v, int w, int i){
+	int len = sprintf(v, "v%d_%d:", w, i), fill = i % 100;
+
+	sprintf(k, "k%d_%d", w, i);
+	memset(v + len, 'a' + i % 26, fill);
+	v[len + fill] = 0;
+	return len + fill;
+}
+
+/* 写者进程：从done[w]之后继续写，每个写入返回之后才更新done[w] */
+static void
+writer(int flags, int w, volatile int *done){
+	shm_map_t 	*m = shm_map_open(capacity(flags), CHECK_POOL, CHECK_FILE, quiet_log, flags);
+	char 		k[32], v[200];
+	int 		i, v_len;
+
+	if(m == NULL)
+		_exit(2);
+	for(i=done[w]+1; ; i++){
+		v_len = make_kv(k, v, w, i);
+		if(!shm_map_put2(m, k, strlen(k), v, v_len))
+			_exit(3);
+		// 每隔几个key改写一个已经写入的key，覆盖替换value的路径
+		if(i % 7 == 0 && i > 0){
+			v_len = make_kv(k, v, w, i - 1);
+			if(!shm_map_put2(m, k, strlen(k), v, v_len))
+				_exit(3);
+		}
+		__atomic_store_n(&done[w], i, __ATOMIC_RELEASE);
+	}
+}
+
+/* 检查写者w已经返回的key都在，没有开始写的key都不在，返回不符合的个数 */
+static int
+verify_writer(shm_map_t *m, int w, int done){
+	char 	k[32], v[200], buf[200];
+	int 	i, v_len, n, bad = 0;
+
+	for(i=0; i<=done+10; i++){
+		v_len = make_kv(k, v, w, i);
+		n = shm_map_get_copy(m, k, buf, sizeof(buf));
+		if(i <= done)
+			bad += n != v_len || memcmp(buf, v, v_len) != 0;
+		else if(i > done + 1)
+			bad += n >= 0;
+	}
+	return bad;
+}
+
+/* 用扫描数出实际的key数，和shm_map_size比较 */
+static bool
+size_ok(shm_map_t *m){
+	shm_map_cursor 	cur;
+	shm_map_kv 		kvs[256];
+	int 			n, total = 0;
+
+	shm_map_scan_init(m, &cur, 0, 1);
+	shm_map_reader_enter(m);
+	while((n = shm_map_scan(m, &cur, kvs, 256)) > 0)
+		total += n;
+	shm_map_reader_exit(m);
+	return total == shm_map_size(m);
+}
+
+static int
+check(int flags){
+	volatile int 	*done;
+	shm_map_t 		*m;
+	int 			writers = (flags & SHM_MAP_MULTI_WRITER) ? 2 : 1;
+	int 			round, w, status, bad = 0, size_bad = 0;
+	pid_t 			pids[2];
+	bool 			ok;
+
+	done = (volatile int *)mmap(NULL, sizeof(int) * 2, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if(done == MAP_FAILED)
+		return 1;
+	done[0] = done[1] = -1;
+	unlink(CHECK_FILE);
+	srand(flags + 1);
+	for(round=0; round<CHECK_ROUNDS; round++){
+		for(w=0; w<writers; w++){
+			pids[w] = fork();
+			if(pids[w] == 0)
+				writer(flags, w, done);
+		}
+		usleep(2000 + rand() % 30000);
+		for(w=0; w<writers; w++){
+			kill(pids[w], SIGKILL);
+			waitpid(pids[w], &status, 0);
+			if(!WIFSIGNALED(status))
+				bad++;
+		}
+		// 新打开的进程修复单写者的map，多写者的map在下次获取锁时修复
+		m = shm_map_open(capacity(flags), CHECK_POOL, CHECK_FILE, quiet_log, flags);
+		if(m == NULL)
+			return 1;
+		for(w=0; w<writers; w++)
+			bad += verify_writer(m, w, done[w]);
+		size_bad += !size_ok(m);
+		shm_map_close(m);
+	}
+	// 修复之后还能继续写
+	m = shm_map_open(capacity(flags), CHECK_POOL, CHECK_FILE, quiet_log, flags);
+	if(m == NULL)
+		return 1;
+	ok = shm_map_put2(m, "after", 5, "1", 1) && shm_map_contains(m, "after");
+	printf("flags %d: %s, %d writes done, %d bad keys, %d rounds with a wrong size, %s after recovery\n",
+		flags, bad == 0 && size_bad == 0 && ok ? "ok" : "FAIL", done[0] + done[1] + 2, bad, size_bad,
+		ok ? "writable" : "NOT WRITABLE");
+	shm_map_close(m);
+	unlink(CHECK_FILE);
+	munmap((void *)done, sizeof(int) * 2);
+	return bad != 0 || size_bad != 0 || !ok;
+}
+
+int
+main(){
+	int failed = 0;
+
+	failed += check(0);
+	failed += check(SHM_MAP_SWISS_INDEX);
+	failed += check(SHM_MAP_GROWABLE);
+	failed += check(SHM_MAP_MULTI_WRITER);
+	failed += check(SHM_MAP_MULTI_WRITER | SHM_MAP_SWISS_INDEX);
+	failed += check(SHM_MAP_MULTI_WRITER | SHM_MAP_GROWABLE | SHM_MAP_LOCKFREE_POOL);
+	return failed != 0;
+}
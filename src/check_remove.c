@@ -0,0 +1,144 @@
+/**
+ *
+ * 写者反复写入、删除key时，并发的读者读到的要么是不存在，要么是这个key自己的完整value，
+ * 不能是被删除的entry的块重用之后的内容。删除之后内存被回收，反复增删不会用完内存池
+ *
+ * @file check_remove.c
+ * @author chosen0ne
+ * @date 2026-10-17
+ */
+
+#include "shm_map.h"
+#include <sys/wait.h>
+
+#define CHECK_FILE "check_remove.dat"
+#define CHECK_KEYS 1000
+#define CHECK_OPS 300000
+#define CHECK_POOL (4 << 20)
+
+static void
+quiet_log(shmmap_log_level level, const char *fmt, ...){
+	(void)level;
+	(void)fmt;
+}
+
+/* key i第gen次写入的value：| key | ':' | gen | ':' | gen % 200个填充 | */
+static int
+make_value(char *buf, int i, int gen){
+	int len = sprintf(buf, "k%d:%d:", i, gen), fill = gen % 200;
+
+	memset(buf + len, 'a' + gen % 26, fill);
+	buf[len + fill] = 0;
+	return len + fill;
+}
+
+static bool
+value_ok(const char *k, const char *v, size_t v_len){
+	char 		expect[300];
+	const char 	*p;
+	size_t 		k_len = strlen(k);
+	long 		gen;
+	char 		*end;
+
+	if(v_len <= k_len || memcmp(v, k, k_len) != 0 || v[k_len] != ':')
+		return false;
+	p = v + k_len + 1;
+	gen = strtol(p, &end, 10);
+	if(end == p || *end != ':' || gen < 0)
+		return false;
+	return (size_t)make_value(expect, atoi(k + 1), (int)gen) == v_len && memcmp(expect, v, v_len) == 0;
+}
+
+/* 写者进程：写入之后一半的key马上删除，带错误value的条件删除必须失败 */
+static void
+writer(int flags){
+	shm_map_t 	*w = shm_map_open(CHECK_KEYS, CHECK_POOL, CHECK_FILE, quiet_log, flags);
+	char 		k[32], v[300];
+	int 		op, i, v_len, bad = 0;
+
+	if(w == NULL)
+		_exit(2);
+	for(op=0; op<CHECK_OPS; op++){
+		i = op % CHECK_KEYS;
+		sprintf(k, "k%d", i);
+		v_len = make_value(v, i, op);
+		if(!shm_map_put2(w, k, strlen(k), v, v_len))
+			bad++;
+		if(shm_map_remove_if(w, k, strlen(k), v, v_len - 1))
+			bad++;
+		if(op & 1){
+			if(op & 2)
+				bad += !shm_map_remove_if(w, k, strlen(k), v, v_len);
+			else
+				bad += !shm_map_remove(w, k);
+		}
+	}
+	shm_map_close(w);
+	_exit(bad == 0 ? 0 : 1);
+}
+
+static int
+check(int flags){
+	shm_map_t 	*m;
+	char 		k[32], v[300];
+	const void 	*p;
+	size_t 		p_len;
+	long 		reads = 0, hits = 0;
+	int 		i, n, bad = 0, status, round, churn_ok = 1, writer_ok;
+	pid_t 		pid;
+
+	unlink(CHECK_FILE);
+	m = shm_map_open(CHECK_KEYS, CHECK_POOL, CHECK_FILE, quiet_log, flags);
+	if(m == NULL)
+		return 1;
+	pid = fork();
+	if(pid == 0)
+		writer(flags);
+	while(waitpid(pid, &status, WNOHANG) == 0){
+		for(i=0; i<CHECK_KEYS; i++, reads++){
+			sprintf(k, "k%d", i);
+			if(reads & 1){
+				n = shm_map_get_copy(m, k, v, sizeof(v));
+				if(n >= 0){
+					hits++;
+					bad += !value_ok(k, v, n);
+				}
+			}else{
+				shm_map_reader_enter(m);
+				if(shm_map_get2(m, k, strlen(k), &p, &p_len)){
+					hits++;
+					bad += !value_ok(k, (const char *)p, p_len);
+				}
+				shm_map_reader_exit(m);
+			}
+		}
+	}
+	writer_ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+	// 写入的总量是内存池的几十倍，删除的块没有回收时会写满
+	for(round=0; round<200 && churn_ok; round++){
+		for(i=0; i<CHECK_KEYS && churn_ok; i++){
+			sprintf(k, "k%d", i);
+			n = make_value(v, i, round + 199);
+			churn_ok = shm_map_put2(m, k, strlen(k), v, n) && shm_map_remove(m, k);
+		}
+	}
+	churn_ok = churn_ok && shm_map_size(m) == 0;
+	printf("flags %d: %s, %ld reads, %ld hits, %d bad values, writer %s, churn %s\n", flags,
+		bad == 0 && writer_ok && churn_ok ? "ok" : "FAIL", reads, hits, bad,
+		writer_ok ? "ok" : "FAIL", churn_ok ? "ok" : "FULL");
+	shm_map_close(m);
+	unlink(CHECK_FILE);
+	return bad != 0 || !writer_ok || !churn_ok;
+}
+
+int
+main(){
+	int failed = 0;
+
+	failed += check(0);
+	failed += check(SHM_MAP_SWISS_INDEX);
+	failed += check(SHM_MAP_GROWABLE);
+	failed += check(SHM_MAP_MULTI_WRITER);
+	failed += check(SHM_MAP_MULTI_WRITER | SHM_MAP_SWISS_INDEX | SHM_MAP_LOCKFREE_POOL);
+	return failed != 0;
+}
@@ -0,0 +1,127 @@
+/**
+ *
+ * 写者不停地替换value时，无锁的读者不能读到写了一半的value或者已经释放的块
+ * 每个value都能由自己的内容校验：| 序号 | ':' | 长度和字符都由序号决定的填充 |
+ *
+ * @file check_seqlock.c
+ * @author chosen0ne
+ * @date 2026-10-17
+ */
+
+#include "shm_map.h"
+#include <sys/wait.h>
+
+#define CHECK_FILE "check_seqlock.dat"
+#define CHECK_KEYS 256
+#define CHECK_WRITES 400000
+
+static void
+quiet_log(shmmap_log_level level, const char *fmt, ...){
+	(void)level;
+	(void)fmt;
+}
+
+/* 第n个value：长度在1到300之间变化，跨过entry块内和单独分配的value */
+static int
+make_value(char *buf, int n){
+	int len = sprintf(buf, "%d:", n), fill = n % 300;
+
+	memset(buf + len, 'a' + n % 26, fill);
+	buf[len + fill] = 0;
+	return len + fill;
+}
+
+static bool
+value_ok(const char *v, size_t v_len){
+	char 	expect[400];
+	long 	n;
+	char 	*end;
+
+	n = strtol(v, &end, 10);
+	if(end == v || *end != ':' || n < 0)
+		return false;
+	return (size_t)make_value(expect, (int)n) == v_len && memcmp(expect, v, v_len) == 0;
+}
+
+/* 写者进程：轮流替换所有key的value，写完后退出 */
+static void
+writer(int flags, int id, int writers){
+	shm_map_t 	*w = shm_map_open(CHECK_KEYS, 1 << 24, CHECK_FILE, quiet_log, flags);
+	char 		k[32], v[400];
+	int 		i, v_len;
+
+	if(w == NULL)
+		_exit(2);
+	for(i=id; i<CHECK_WRITES; i+=writers){
+		sprintf(k, "k%d", i % CHECK_KEYS);
+		v_len = make_value(v, i);
+		if(!shm_map_put2(w, k, strlen(k), v, v_len))
+			_exit(3);
+	}
+	shm_map_close(w);
+	_exit(0);
+}
+
+static int
+check(int flags, int writers){
+	shm_map_t 	*m;
+	char 		k[32], v[400];
+	const void 	*p;
+	size_t 		p_len;
+	long 		reads = 0;
+	int 		i, n, bad = 0, status, running, failed = 0;
+	pid_t 		pids[4];
+
+	unlink(CHECK_FILE);
+	m = shm_map_open(CHECK_KEYS, 1 << 24, CHECK_FILE, quiet_log, flags);
+	if(m == NULL)
+		return 1;
+	for(i=0; i<CHECK_KEYS; i++){
+		sprintf(k, "k%d", i);
+		n = make_value(v, i);
+		shm_map_put2(m, k, strlen(k), v, n);
+	}
+	for(i=0; i<writers; i++){
+		pids[i] = fork();
+		if(pids[i] == 0)
+			writer(flags, i, writers);
+	}
+	// 写者退出之前一直读：拷贝读和零拷贝读交替进行
+	for(running=writers; running>0; ){
+		for(i=0; i<CHECK_KEYS; i++, reads++){
+			sprintf(k, "k%d", i);
+			if(reads & 1){
+				n = shm_map_get_copy(m, k, v, sizeof(v));
+				if(n < 0 || !value_ok(v, n))
+					bad++;
+			}else{
+				shm_map_reader_enter(m);
+				if(!shm_map_get2(m, k, strlen(k), &p, &p_len) || !value_ok((const char *)p, p_len))
+					bad++;
+				shm_map_reader_exit(m);
+			}
+		}
+		while(running > 0 && waitpid(-1, &status, WNOHANG) > 0){
+			running--;
+			if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+				failed++;
+		}
+	}
+	printf("flags %d, %d writers: %s, %ld reads, %d torn, %d writers failed\n",
+		flags, writers, bad == 0 && failed == 0 ? "ok" : "FAIL", reads, bad, failed);
+	shm_map_close(m);
+	unlink(CHECK_FILE);
+	return bad != 0 || failed != 0;
+}
+
+int
+main(){
+	int failed = 0;
+
+	failed += check(0, 1);
+	failed += check(SHM_MAP_SWISS_INDEX, 1);
+	failed += check(SHM_MAP_MULTI_WRITER, 4);
+	failed += check(SHM_MAP_MULTI_WRITER | SHM_MAP_SWISS_INDEX, 4);
+	failed += check(SHM_MAP_MULTI_WRITER | SHM_MAP_LOCKFREE_POOL, 4);
+	return failed != 0;
+}
@@ -8,237 +8,769 @@
  */
 
 #include <assert.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/mman.h>
 
 #include "m_pool.h"
+#include "shm_atomic.h"
 
-static int M_HEADER_SIZE = sizeof(M_header);
 static int BLOCK_HEADER_SIZE = sizeof(M_block_hdr);	// 空闲块头部大小
-static int INT_SIZE = sizeof(int);
-static int PTR_SIZE = sizeof(void *);
+static int LARGE_HEADER_SIZE = sizeof(M_large_hdr);	// 大块在块头部之前的头部大小
 
-static M_header* free_list = NULL;	// 空闲块链
-static int free_list_len;			// 空闲块链长度
-static void *pool_ptr_s;			// 共享内存的起始地址
-static void *pool_ptr_e;			// 共享内存的结束地址
-static int pool_byte_size;			// 内存池包含的字节数
-static int *current_p_offset;		// 当前空闲区的起始地址距离内存池起始地址的偏移量
-static shmmap_log m_pool_log;		// 日志handler
+/* 无锁模式下线程私有的空闲块缓存，blocks保存块的偏移量 */
+typedef struct m_magazine {
+	int size;
+	m_off_t blocks[M_MAGAZINE_SIZE];
+} M_magazine;
+
+/* 无锁模式下线程在本地累计的统计，ops次操作之后加到共享的计数器上 */
+typedef struct m_stat_delta {
+	int ops;
+	int64_t used_bytes;
+	int64_t alloc_count;
+	int64_t free_count;
+	int64_t size_hist[M_STAT_HIST];
+} M_stat_delta;
+
+/*
+ * 一个线程在一个内存池上的所有magazine，通过内存池的mag_key保存为线程私有数据
+ * fork_gen: 创建时进程fork的次数，fork出的子进程不能继续使用父进程magazine中的块
+ */
+typedef struct m_magazine_set {
+	M_pool *pool;
+	unsigned int fork_gen;
+	M_stat_delta stat;
+	M_magazine mags[M_MAGAZINE_CLASSES];
+} M_magazine_set;
+
+/* 内存池在当前进程中的状态，共享内存中的数据通过这些指针访问 */
+struct m_pool {
+	M_pool_hdr *hdr;				// 共享内存中的头部
+	M_header *free_list;			// 小块的空闲块链
+	int free_list_len;				// 空闲块链长度
+	M_header *large_bins;			// 空闲大块链
+	void *pool_ptr_s;				// 共享内存的起始地址
+	void *pool_ptr_e;				// 共享内存的结束地址
+	int64_t pool_byte_size;			// 内存池包含的字节数
+	m_off_t *current_p_offset;		// 堆的未分配区的起始地址距离内存池起始地址的偏移量
+	shmmap_log log;					// 日志handler
+	M_epoch_info *epoch_info;		// 读者epoch、limbo链表
+	M_pool_stats *stats;			// 统计计数器
+	M_reader_slot *reader_slot;		// 当前进程占用的epoch槽位
+	pthread_mutex_t *pool_mutex;	// 多写者模式下保护空闲块链、limbo链表的锁，单写者时为NULL
+	pthread_mutex_t *heap_mutex;	// 无锁模式下保护大块、run的锁
+	bool lockfree;					// 无锁模式，小块的空闲块链不需要pool_mutex保护
+	bool quiet_full;				// 内存用完时不记录日志
+	pthread_key_t mag_key;			// 无锁模式下线程私有的M_magazine_set
+};
+
+static unsigned int fork_gen;		// 进程fork的次数，在子进程中加1
+static bool magazine_atfork;
 
 static const char *log_level_labels[SHMMAP_LOG_LEVEL_NUM] = {"DEBUG", "INFO", "WARN", "ERROR"};
 
+/* u个单位(小块8字节，大块一页)所在的级，以及第c级的单位数 */
+static int size_class(int64_t u);
+static int64_t class_units(int c);
+/* 小块第idx级的字节数 */
+static int class_bytes(int idx);
 /* 根据申请的内存大小返回对应的空闲块链 */
 static int free_list_idx(int size);
 /* 根据空闲块的起始地址获取该空闲块对应的数据字段的起始地址*/
-static int get_mnode_data(int p);
+static m_off_t get_mnode_data(M_pool *pool, m_off_t p);
 /* 根据空闲块中data字段的起始地址获取对应的空闲块的地址 */
-static int get_mnode_by_data(int p);
-static int get_mnode_by_data_ptr(void *p);
-static int m_free_blck_size();
-static void* get_cur_ptr();
-static void set_cur_ptr_offset(int offset);
+static m_off_t get_mnode_by_data(M_pool *pool, m_off_t p);
+static m_off_t get_mnode_by_data_ptr(M_pool *pool, void *p);
+static void _m_free(M_pool *pool, m_off_t data_offset);
+static int64_t m_free_blck_size(M_pool *pool);
+static void list_append(M_pool *pool, M_header *hdr, m_off_t block_offset);
+static void list_unlink(M_pool *pool, M_header *hdr, m_off_t block_offset);
+static m_off_t list_pop(M_pool *pool, int idx);
+static void small_release(M_pool *pool, m_off_t block_offset, int idx);
+static int run_carve(M_pool *pool, int idx, int n, m_off_t *blocks, m_off_t limit);
+static void run_retire(M_pool *pool);
+static bool run_release(M_pool *pool, m_off_t run);
+static m_off_t large_alloc(M_pool *pool, int64_t bytes, m_off_t limit);
+static m_off_t _m_alloc_below(M_pool *pool, int size, m_off_t limit);
+static int64_t trim_range(M_pool *pool, m_off_t start, m_off_t end);
+static void large_free(M_pool *pool, m_off_t block_offset);
+static void heap_lock(M_pool *pool);
+static void heap_unlock(M_pool *pool);
+static void heap_rebuild(M_pool *pool);
+static void heap_recover(void *arg);
+static int alloc_reclaim(M_pool *pool);
+static bool epoch_before(unsigned int e1, unsigned int e2);
+static bool reader_is_dead(M_reader_slot *slot);
+static int _m_reclaim(M_pool *pool);
+static void _m_retire(M_pool *pool, m_off_t data_offset);
+static void pool_lock(M_pool *pool);
+static void pool_unlock(M_pool *pool);
+static void pool_recover(void *arg);
+static M_magazine_set* magazine_set(M_pool *pool);
+static M_magazine* magazine_get(M_pool *pool, int idx);
+static void magazine_set_free(void *arg);
+static void magazine_flush(M_pool *pool, int idx, M_magazine *mag, int n);
+static void alloc_lock(M_pool *pool);
+static void alloc_unlock(M_pool *pool);
+static m_off_t lf_alloc(M_pool *pool, int idx);
+static m_off_t lf_alloc_block(M_pool *pool, int idx);
+static void lf_free(M_pool *pool, m_off_t block_offset, int idx);
+static void magazine_fork();
+static void stack_push(M_pool *pool, int idx, m_off_t first, m_off_t last, int n);
+static m_off_t stack_pop(M_pool *pool, int idx);
+static M_header* large_bin(M_pool *pool, int64_t size);
+static void large_insert(M_pool *pool, m_off_t block_offset, int64_t size);
+static void large_remove(M_pool *pool, m_off_t block_offset, int64_t size);
+static int64_t block_bytes(M_pool *pool, m_off_t block_offset);
+static void stat_add(M_pool *pool, int64_t *counter, int64_t n);
+static void stat_alloc(M_pool *pool, int size, m_off_t data_offset);
+static void stat_free(M_pool *pool, int64_t bytes);
+static void stat_flush(M_pool *pool, M_stat_delta *delta);
+
+/*
+ * 几何级数的分级：不超过16个单位时每个单位一级，之后每翻一倍分4级
+ * u在(2^lg, 2^(lg+1)]之间时，步长是2^(lg-2)
+ */
+static int
+size_class(int64_t u){
+	int lg;
+
+	if(u <= 16)
+		return (int)u - 1;
+	lg = 63 - __builtin_clzll((unsigned long long)(u - 1));
+	return 16 + (lg - 4) * 4 + (int)((u - (1LL << lg) - 1) >> (lg - 2));
+}
+
+static int64_t
+class_units(int c){
+	int lg;
+
+	if(c < 16)
+		return c + 1;
+	lg = (c - 16) / 4 + 4;
+	return (1LL << lg) + (int64_t)((c - 16) % 4 + 1) * (1LL << (lg - 2));
+}
+
+static int
+class_bytes(int idx){
+	return (int)class_units(idx) << 3;
+}
 
 /* 根据块大小找到对应的链表在free_list中的下标 */
 static int
 free_list_idx(int size){
-	if(size % 8 == 0)
-		return (size >> 3) - 1;
-	return size >> 3;
+	if(size <= 0)
+		return 0;
+	return size_class((size + 7) >> 3);
 }
 
 /* 根据空闲块的偏移量返回数据字段偏移量 */
-static int
-get_mnode_data(int block_ptr){
-	int data_offset = block_ptr + BLOCK_HEADER_SIZE;
-	if(data_offset > pool_byte_size){
-		m_pool_log(SHMMAP_LOG_ERROR, "[get_mnode_data]The offset(%d) of data ptr is bigger than pool_byte_size(%d)", data_offset, pool_byte_size);
+static m_off_t
+get_mnode_data(M_pool *pool, m_off_t block_ptr){
+	m_off_t data_offset = block_ptr + BLOCK_HEADER_SIZE;
+	if(data_offset > pool->pool_byte_size){
+		pool->log(SHMMAP_LOG_ERROR, "[get_mnode_data]The offset(%lld) of data ptr is bigger than pool_byte_size(%lld)",
+			(long long)data_offset, (long long)pool->pool_byte_size);
 		return -1;
 	}
 	return data_offset;
 }
 
 /* 根据数据字段的偏移量获取整个块的偏移量 */
-static int
-get_mnode_by_data(int data_offset){
-	int block_offset = data_offset - BLOCK_HEADER_SIZE;
+static m_off_t
+get_mnode_by_data(M_pool *pool, m_off_t data_offset){
+	m_off_t block_offset = data_offset - BLOCK_HEADER_SIZE;
 	if(block_offset < 0){
-		m_pool_log(SHMMAP_LOG_ERROR, "[get_mnode_by_data]The offset(%d) of block ptr is lesser than 0");
+		pool->log(SHMMAP_LOG_ERROR, "[get_mnode_by_data]The offset(%lld) of block ptr is lesser than 0", (long long)block_offset);
 		return -1;
 	}
 	return block_offset;
 }
 
 /* 根据数据字段的指针获取块的偏移量 */
-static int
-get_mnode_by_data_ptr(void *p){
-	int offset = ptr_offset(p);
-	return get_mnode_by_data(offset);
+static m_off_t
+get_mnode_by_data_ptr(M_pool *pool, void *p){
+	m_off_t offset = ptr_offset(pool, p);
+	return get_mnode_by_data(pool, offset);
 }
 
-static void*
-get_cur_ptr(){
-	return (char *)pool_ptr_s + *current_p_offset;
+/* 大块的偏移量是它的M_block_hdr的偏移量，M_large_hdr在它之前 */
+static inline M_large_hdr*
+large_hdr(M_pool *pool, m_off_t block_offset){
+	return (M_large_hdr *)get_ptr(pool, block_offset - LARGE_HEADER_SIZE);
 }
 
-static void
-set_cur_ptr_offset(int offset){
-	*current_p_offset = *current_p_offset + offset;
+static inline M_block_hdr*
+block_at(M_pool *pool, m_off_t block_offset){
+	return (M_block_hdr *)get_ptr(pool, block_offset);
 }
 
 /**
  * 分配大小为size字节的内存
  * return: 返回距离内存池起始地址的偏移量
  */
-static int
-_m_alloc(int size){
-	M_header 		*hdr;
-	M_block_hdr 	*p, *q;
-	int 			idx, p_offset, q_offset;
-
-	idx = free_list_idx(size);
-	if(idx >= free_list_len){
-		m_pool_log(SHMMAP_LOG_ERROR, "[_m_alloc]The max block size is %d, the request is too large %d", free_list_len<<3, size);
-		return -1;
-	}
-	hdr = &free_list[idx];
+static m_off_t
+_m_alloc(M_pool *pool, int size){
+	m_off_t 		p_offset;
+	int 			idx, c;
 
-	if(hdr->size > 0){
-		// 有空闲块链，直接分配内存，从header删除m_node
-		p_offset = hdr->header_offset;
-		p = (M_block_hdr *)get_ptr(p_offset);
-		q_offset = p->next_offset;
-		if(q_offset != NIL){
-			q = (M_block_hdr *)get_ptr(q_offset);
-			q->prev_offset = NIL;
+	if(size > M_SMALL_MAX){
+		heap_lock(pool);
+		p_offset = large_alloc(pool, size, pool->pool_byte_size);
+		heap_unlock(pool);
+		if(p_offset == NIL){
+			// 先尝试回收limbo链表中的块
+			if(alloc_reclaim(pool) > 0)
+				return _m_alloc(pool, size);
+			if(!pool->quiet_full)
+				pool->log(SHMMAP_LOG_ERROR, "[_m_alloc]No free pages for %d bytes, the size of free space is %lld",
+					size, (long long)m_free_size(pool));
+			return -1;
 		}
-		hdr->header_offset = q_offset;
-		hdr->size--;
-		return get_mnode_data(p_offset);
-	}else{
-		// 没有空闲块时，直接从空闲内存分配
-		int chunck_size = (idx+1) << 3;
-		int block_size = BLOCK_HEADER_SIZE + chunck_size;
-		if(*current_p_offset + block_size > pool_byte_size){
-			m_pool_log(SHMMAP_LOG_ERROR, "[_m_alloc]The unallocated area is used up, the size of free space is %d",
-				m_free_size());
+		return get_mnode_data(pool, p_offset);
+	}
+	idx = free_list_idx(size);
+	if(pool->lockfree)
+		return lf_alloc(pool, idx);
+	p_offset = list_pop(pool, idx);
+	if(p_offset == NIL && run_carve(pool, idx, 1, &p_offset, pool->pool_byte_size) == 0){
+		// 先尝试回收limbo链表中的块
+		if(_m_reclaim(pool) > 0)
+			return _m_alloc(pool, size);
+		// 内存用满之后空闲的小块分散在各级中，分配更大一级的块，块头部记录了它实际的级别
+		for(c=idx+1, p_offset=NIL; c<pool->free_list_len && p_offset==NIL; c++)
+			p_offset = list_pop(pool, c);
+		if(p_offset == NIL){
+			if(!pool->quiet_full)
+				pool->log(SHMMAP_LOG_ERROR, "[_m_alloc]The unallocated area is used up, the size of free space is %lld",
+					(long long)m_free_size(pool));
 			return -1;
 		}
-		p = (M_block_hdr *)get_cur_ptr();
-		// 标记这个内存块对应的空闲块列表的下标
-		p->idx = idx;
-
-		set_cur_ptr_offset(block_size);
-		padding(get_cur_ptr());
-		set_cur_ptr_offset(INT_SIZE);
-		return get_mnode_data(ptr_offset(p));
 	}
+	return get_mnode_data(pool, p_offset);
+}
+
+/* 从第idx级空闲块链的header取出一个块，链表为空时返回NIL */
+static m_off_t
+list_pop(M_pool *pool, int idx){
+	M_header 		*hdr = &pool->free_list[idx];
+	M_block_hdr 	*p;
+	m_off_t 		p_offset, q_offset;
+
+	if(hdr->size == 0)
+		return NIL;
+	p_offset = hdr->header_offset;
+	p = block_at(pool, p_offset);
+	q_offset = p->next_offset;
+	if(q_offset != NIL)
+		block_at(pool, q_offset)->prev_offset = NIL;
+	hdr->header_offset = q_offset;
+	hdr->size--;
+	stat_add(pool, &pool->stats->small_free_bytes, -class_bytes(idx));
+	p->data_len = 0;
+	return p_offset;
 }
 
 /*
  * 释放内存
  * data_offset: 数据字段距离内存池起始地址的偏移量
  */
-void
-_m_free(int data_offset){
-	M_block_hdr		*block_ptr, *tail_block_ptr;
-	int 			idx, block_offset, tail_block_offset;
-	M_header		*hdr;
+static void
+_m_free(M_pool *pool, m_off_t data_offset){
+	M_block_hdr		*block_ptr;
+	m_off_t 		block_offset;
+	int 			idx;
 
-	block_offset = get_mnode_by_data(data_offset);
+	block_offset = get_mnode_by_data(pool, data_offset);
 	if(block_offset == -1){
-		m_pool_log(SHMMAP_LOG_ERROR, "[_m_free]Get block offset error");
+		pool->log(SHMMAP_LOG_ERROR, "[_m_free]Get block offset error");
 		return;
 	}
-	block_ptr = (M_block_hdr *)get_ptr(block_offset);
+	block_ptr = block_at(pool, block_offset);
 	idx = block_ptr->idx;
-	if(idx<0 || idx>=free_list_len){
-		m_pool_log(SHMMAP_LOG_ERROR, "[_m_free]The free block linked list dosen't exist. The length of free list is %d, and the index of the block to free is %d",
-			free_list_len, idx);
+	if(idx == M_LARGE_IDX){
+		stat_free(pool, large_hdr(pool, block_offset)->size);
+		heap_lock(pool);
+		large_free(pool, block_offset);
+		heap_unlock(pool);
+		return;
+	}
+	if(idx<0 || idx>=pool->free_list_len){
+		pool->log(SHMMAP_LOG_ERROR, "[_m_free]The free block linked list dosen't exist. The length of free list is %d, and the index of the block to free is %d",
+			pool->free_list_len, idx);
+		return;
+	}
+	stat_free(pool, class_bytes(idx));
+	if(pool->lockfree){
+		lf_free(pool, block_offset, idx);
 		return;
 	}
-	hdr = &free_list[idx];
+	list_append(pool, &pool->free_list[idx], block_offset);
+	stat_add(pool, &pool->stats->small_free_bytes, class_bytes(idx));
+}
+
+/*
+ * 在空闲块链hdr的tail添加块
+ * 块的next_offset可能还指向limbo链表中的下一个块，先清空再链入，
+ * 中途退出时pool_recover沿链表重新计数不会走到limbo链表中
+ */
+static void
+list_append(M_pool *pool, M_header *hdr, m_off_t block_offset){
+	M_block_hdr *block_ptr = block_at(pool, block_offset);
+
+	block_ptr->next_offset = NIL;
+	block_ptr->data_len = M_FREE_LEN;
 	if(hdr->size == 0){
 		block_ptr->prev_offset = NIL;
 		hdr->header_offset = hdr->tail_offset = block_offset;
 	}else{
-		// 加入空闲块链表，在tail添加
-		tail_block_offset = hdr->tail_offset;
-		tail_block_ptr = (M_block_hdr *)get_ptr(tail_block_offset);
-		block_ptr->prev_offset = tail_block_offset;
-		tail_block_ptr->next_offset = block_offset;
+		block_ptr->prev_offset = hdr->tail_offset;
+		shm_smp_wmb();
+		block_at(pool, hdr->tail_offset)->next_offset = block_offset;
 		hdr->tail_offset = block_offset;
 	}
-	block_ptr->next_offset = NIL;
 	hdr->size ++;
 }
 
-bool
-m_init(char *p, int pool_byte_len, shmmap_log log, bool is_inited){
-	int 	i;
-	int 	*size_p;
+/* 从空闲块链hdr中删除块 */
+static void
+list_unlink(M_pool *pool, M_header *hdr, m_off_t block_offset){
+	M_block_hdr *block_ptr = block_at(pool, block_offset);
+
+	if(block_ptr->prev_offset != NIL)
+		block_at(pool, block_ptr->prev_offset)->next_offset = block_ptr->next_offset;
+	else
+		hdr->header_offset = block_ptr->next_offset;
+	if(block_ptr->next_offset != NIL)
+		block_at(pool, block_ptr->next_offset)->prev_offset = block_ptr->prev_offset;
+	else
+		hdr->tail_offset = block_ptr->prev_offset;
+	hdr->size --;
+}
+
+/* 把一个新切出的小块放入第idx级的空闲块链 */
+static void
+small_release(M_pool *pool, m_off_t block_offset, int idx){
+	block_at(pool, block_offset)->idx = idx;
+	if(pool->lockfree){
+		stack_push(pool, idx, block_offset, block_offset, 1);
+		return;
+	}
+	list_append(pool, &pool->free_list[idx], block_offset);
+	stat_add(pool, &pool->stats->small_free_bytes, class_bytes(idx));
+}
+
+/*
+ * 从当前的run中切出最多n个第idx级的块，块的偏移量保存在blocks中。
+ * run剩下的空间不够时，把剩余部分切成更小的块放入空闲块链，再分配新的run。
+ * limit: 切出的块和新的run都必须位于limit之前
+ * 调用者持有heap_lock(非无锁模式下是alloc_lock)
+ * return: 切出的块数
+ */
+static int
+run_carve(M_pool *pool, int idx, int n, m_off_t *blocks, m_off_t limit){
+	M_pool_hdr 	*hdr = pool->hdr;
+	int 		block_size = BLOCK_HEADER_SIZE + class_bytes(idx);
+	int64_t 	run_size;
+	m_off_t 	run;
+	int 		i;
+
+	for(i=0; i<n; i++){
+		if(hdr->run_cur + block_size > hdr->run_end || hdr->run_cur + block_size > limit){
+			run_retire(pool);
+			// 一个run至少能切出8个块
+			run_size = (int64_t)M_RUN_PAGES * M_PAGE_SIZE;
+			if(run_size < (int64_t)block_size * 8)
+				run_size = (int64_t)block_size * 8;
+			run = large_alloc(pool, run_size - LARGE_HEADER_SIZE - BLOCK_HEADER_SIZE, limit);
+			if(run == NIL)
+				break;
+			// 小块从大块的M_block_hdr处开始切分，run只有在所有小块都空闲时才由run_release释放
+			hdr->run_cur = run;
+			hdr->run_end = run - LARGE_HEADER_SIZE + large_hdr(pool, run)->size;
+		}
+		block_at(pool, hdr->run_cur)->idx = idx;
+		block_at(pool, hdr->run_cur)->data_len = 0;
+		blocks[i] = hdr->run_cur;
+		hdr->run_cur += block_size;
+	}
+	return i;
+}
+
+/*
+ * 放弃当前的run，未切分的部分切成尽量大的块放入空闲块链，
+ * 这样run中每个位置都是完整的块，run_release可以逐块遍历
+ */
+static void
+run_retire(M_pool *pool){
+	M_pool_hdr 	*hdr = pool->hdr;
+	int64_t 	left;
+	int 		c;
+
+	while((left = hdr->run_end - hdr->run_cur) >= BLOCK_HEADER_SIZE + 8){
+		for(c=M_SMALL_CLASSES-1; c>0 && BLOCK_HEADER_SIZE + class_bytes(c) > left; c--);
+		small_release(pool, hdr->run_cur, c);
+		hdr->run_cur += BLOCK_HEADER_SIZE + class_bytes(c);
+	}
+	hdr->run_cur = hdr->run_end = 0;
+}
+
+/*
+ * run中的小块都空闲时，把它们从空闲块链中摘除，run作为大块释放。
+ * 当前run中未切分的部分也算空闲。只用于非无锁模式，调用者持有alloc_lock
+ * return: run被释放时返回true
+ */
+static bool
+run_release(M_pool *pool, m_off_t run){
+	M_pool_hdr 	*hdr = pool->hdr;
+	M_block_hdr *b;
+	m_off_t 	p, end, run_end;
+	int 		pass;
+
+	end = run_end = run - LARGE_HEADER_SIZE + large_hdr(pool, run)->size;
+	if(hdr->run_end == run_end)
+		end = hdr->run_cur;
+	// 第一遍检查所有小块，第二遍才修改空闲块链，中途发现使用中的块时不需要回滚
+	for(pass=0; pass<2; pass++){
+		for(p=run; end - p >= BLOCK_HEADER_SIZE + 8; p+=BLOCK_HEADER_SIZE + class_bytes(b->idx)){
+			b = block_at(pool, p);
+			if(pass == 0 && (b->idx < 0 || b->idx >= pool->free_list_len || b->data_len != M_FREE_LEN
+				|| p + BLOCK_HEADER_SIZE + class_bytes(b->idx) > end))
+				return false;
+			if(pass == 1){
+				list_unlink(pool, &pool->free_list[b->idx], p);
+				stat_add(pool, &pool->stats->small_free_bytes, -class_bytes(b->idx));
+			}
+		}
+	}
+	if(hdr->run_end == run_end)
+		hdr->run_cur = hdr->run_end = 0;
+	large_free(pool, run);
+	return true;
+}
+
+/* 第c级空闲大块链 */
+static M_header*
+large_bin(M_pool *pool, int64_t size){
+	int c = size_class(size / M_PAGE_SIZE);
+	return &pool->large_bins[c < M_LARGE_BINS ? c : M_LARGE_BINS - 1];
+}
+
+/* 把空闲大块放入对应的链表 */
+static void
+large_insert(M_pool *pool, m_off_t block_offset, int64_t size){
+	block_at(pool, block_offset)->idx = M_LARGE_FREE_IDX;
+	list_append(pool, large_bin(pool, size), block_offset);
+	pool->hdr->large_free += size;
+}
+
+static void
+large_remove(M_pool *pool, m_off_t block_offset, int64_t size){
+	list_unlink(pool, large_bin(pool, size), block_offset);
+	pool->hdr->large_free -= size;
+}
+
+/*
+ * 分配可以容纳bytes字节数据的大块，大小向上取整到页。
+ * 先在空闲大块链中找，找到的块多出的页拆分出来；没有时从未分配区分配。
+ * limit: 分配的块必须位于limit之前，不限制时为pool_byte_size
+ * 调用者持有heap_lock(非无锁模式下是alloc_lock)
+ * return: 块的偏移量，空间不足时返回NIL
+ */
+static m_off_t
+large_alloc(M_pool *pool, int64_t bytes, m_off_t limit){
+	M_pool_hdr 	*hdr = pool->hdr;
+	int64_t 	need, size;
+	m_off_t 	offset, rest;
+	M_header 	*bin;
+	int 		c;
+
+	need = (bytes + LARGE_HEADER_SIZE + BLOCK_HEADER_SIZE + M_PAGE_SIZE - 1) & ~(int64_t)(M_PAGE_SIZE - 1);
+	offset = NIL;
+	c = size_class(need / M_PAGE_SIZE);
+	if(c >= M_LARGE_BINS)
+		c = M_LARGE_BINS - 1;
+	for(; c<M_LARGE_BINS && offset==NIL; c++){
+		bin = &pool->large_bins[c];
+		// 同一级中的块大小不同，需要找足够大的；更高级的块都足够大
+		for(offset=bin->size>0 ? bin->header_offset : NIL; offset!=NIL; offset=block_at(pool, offset)->next_offset){
+			if(large_hdr(pool, offset)->size >= need && offset - LARGE_HEADER_SIZE + need <= limit)
+				break;
+		}
+	}
+	if(offset != NIL){
+		size = large_hdr(pool, offset)->size;
+		large_remove(pool, offset, size);
+		if(size - need >= M_PAGE_SIZE){
+			// 拆分：先写好后半部分的头部，再缩小前半部分，中途退出时heap_rebuild按size遍历仍然是一致的
+			rest = offset + need;
+			large_hdr(pool, rest)->size = size - need;
+			large_hdr(pool, rest)->prev_size = need;
+			large_hdr(pool, offset + size)->prev_size = size - need;
+			large_hdr(pool, offset)->size = need;
+			large_insert(pool, rest, size - need);
+		}
+	}else{
+		if(hdr->frontier + need > pool->pool_byte_size || hdr->frontier + need > limit)
+			return NIL;
+		offset = hdr->frontier + LARGE_HEADER_SIZE;
+		large_hdr(pool, offset)->size = need;
+		large_hdr(pool, offset)->prev_size = hdr->last_size;
+		hdr->last_size = need;
+		hdr->frontier += need;
+	}
+	block_at(pool, offset)->idx = M_LARGE_IDX;
+	return offset;
+}
+
+/*
+ * 释放大块，与前后相邻的空闲大块合并，紧挨着未分配区时还给未分配区
+ * 调用者持有heap_lock(非无锁模式下是alloc_lock)
+ */
+static void
+large_free(M_pool *pool, m_off_t offset){
+	M_pool_hdr 	*hdr = pool->hdr;
+	M_large_hdr *lh = large_hdr(pool, offset);
+	int64_t 	size = lh->size;
+	m_off_t 	next = offset + size, prev;
+
+	if(next - LARGE_HEADER_SIZE < hdr->frontier && block_at(pool, next)->idx == M_LARGE_FREE_IDX){
+		large_remove(pool, next, large_hdr(pool, next)->size);
+		size += large_hdr(pool, next)->size;
+	}
+	if(lh->prev_size > 0){
+		prev = offset - lh->prev_size;
+		if(block_at(pool, prev)->idx == M_LARGE_FREE_IDX){
+			large_remove(pool, prev, lh->prev_size);
+			size += lh->prev_size;
+			offset = prev;
+			lh = large_hdr(pool, offset);
+		}
+	}
+	if(offset - LARGE_HEADER_SIZE + size == hdr->frontier){
+		hdr->frontier = offset - LARGE_HEADER_SIZE;
+		hdr->last_size = lh->prev_size;
+		return;
+	}
+	lh->size = size;
+	large_hdr(pool, offset + size)->prev_size = size;
+	large_insert(pool, offset, size);
+}
+
+/*
+ * 从第一个大块开始按size遍历整个堆，重建空闲大块链、prev_size和last_size。
+ * 持有锁的进程在拆分、合并大块的过程中退出时调用。
+ */
+static void
+heap_rebuild(M_pool *pool){
+	M_pool_hdr 	*hdr = pool->hdr;
+	m_off_t 	p = hdr->heap_start, prev_size = 0;
+	int64_t 	size;
+	int 		i;
+
+	for(i=0; i<M_LARGE_BINS; i++){
+		pool->large_bins[i].header_offset = pool->large_bins[i].tail_offset = NIL;
+		pool->large_bins[i].size = 0;
+	}
+	hdr->large_free = 0;
+	while(p < hdr->frontier){
+		size = ((M_large_hdr *)get_ptr(pool, p))->size;
+		if(size <= 0 || size % M_PAGE_SIZE != 0 || p + size > hdr->frontier){
+			pool->log(SHMMAP_LOG_ERROR, "[heap_rebuild]Invalid large block at %lld, size %lld, the rest of heap is leaked",
+				(long long)p, (long long)size);
+			break;
+		}
+		((M_large_hdr *)get_ptr(pool, p))->prev_size = prev_size;
+		if(block_at(pool, p + LARGE_HEADER_SIZE)->idx == M_LARGE_FREE_IDX)
+			large_insert(pool, p + LARGE_HEADER_SIZE, size);
+		prev_size = size;
+		p += size;
+	}
+	hdr->last_size = prev_size;
+}
+
+/* 无锁模式下大块、run由heap_mutex保护，其他模式下由alloc_lock保护 */
+static void
+heap_lock(M_pool *pool){
+	if(pool->lockfree)
+		m_mutex_lock(pool, pool->heap_mutex, heap_recover, pool);
+}
+
+static void
+heap_unlock(M_pool *pool){
+	if(pool->lockfree)
+		m_mutex_unlock(pool->heap_mutex);
+}
+
+static void
+heap_recover(void *arg){
+	heap_rebuild((M_pool *)arg);
+}
+
+/* 分配失败时回收limbo链表中的块，非无锁模式下调用者已经持有pool_lock */
+static int
+alloc_reclaim(M_pool *pool){
+	return pool->lockfree ? m_reclaim(pool) : _m_reclaim(pool);
+}
+
+M_pool*
+m_init(char *p, int64_t pool_byte_len, shmmap_log log, bool is_inited, int flags){
+	M_pool 		*pool;
+	M_pool_hdr 	*hdr;
+	int 		i;
+	int64_t 	min_len;
 
 	// 初始化日志handler
-	m_pool_log = log;
 	if(log == NULL){
-		m_pool_log = default_shmmap_log;
+		log = default_shmmap_log;
 	}
 
-	free_list_len = FREE_LIST_SIZE;
-	if(pool_byte_len < INT_SIZE*3 + M_HEADER_SIZE*free_list_len + PTR_SIZE){
-		m_pool_log(SHMMAP_LOG_ERROR, "[m_init]The pool size is too small %d bytes，it can't allocatie memory for index %d bytes",
-			pool_byte_len, INT_SIZE*2+M_HEADER_SIZE*free_list_len);
-		return false;
+	min_len = sizeof(M_pool_hdr) + CACHE_LINE_SIZE + sizeof(M_epoch_info) + sizeof(M_pool_stats) + 2 * sizeof(pthread_mutex_t)
+		+ (int64_t)(M_RUN_PAGES + 1) * M_PAGE_SIZE;
+	if(pool_byte_len < min_len){
+		log(SHMMAP_LOG_ERROR, "[m_init]The pool size is too small %lld bytes，it should be at least %lld bytes",
+			(long long)pool_byte_len, (long long)min_len);
+		return NULL;
 	}
+	if((flags & M_POOL_LOCKFREE) && (pool_byte_len >> 3) >= (1LL << M_STACK_OFF_BITS) - 1){
+		log(SHMMAP_LOG_ERROR, "[m_init]The pool size %lld is too large for lock-free mode", (long long)pool_byte_len);
+		return NULL;
+	}
+	pool = (M_pool *)calloc(1, sizeof(M_pool));
+	if(pool == NULL){
+		log(SHMMAP_LOG_ERROR, "[m_init]Can't allocate memory for pool");
+		return NULL;
+	}
+	pool->log = log;
 
-	pool_ptr_s = p;
-	pool_byte_size = pool_byte_len;
-	pool_ptr_e = p + pool_byte_size;
+	pool->pool_ptr_s = p;
+	pool->pool_byte_size = pool_byte_len;
+	pool->pool_ptr_e = p + pool->pool_byte_size;
 
 	/**
 	 * 内存池头部：
-	 * Free List Len 	(4bytes)
-	 * padding			(4bytes)
-	 * current ptr		(PTR_SIZE)
-	 * padding			(4bytes)
-	 * Free List		(M_HEADER_SIZE * free_list_len)
+	 * Pool header		(sizeof(M_pool_hdr))，小块的空闲块链、空闲大块链
+	 * padding			(对齐到CACHE_LINE_SIZE)
+	 * Epoch Info		(sizeof(M_epoch_info))
+	 * Stats			(sizeof(M_pool_stats))，统计计数器，独占cache line
+	 * Pool Lock		(sizeof(pthread_mutex_t))
+	 * Heap Lock		(sizeof(pthread_mutex_t))
+	 * padding			(对齐到页)
+	 * Heap				大块、run，从前向后分配
 	 */
+	hdr = pool->hdr = (M_pool_hdr *)p;
+	pool->free_list = hdr->small;
+	pool->free_list_len = M_SMALL_CLASSES;
+	pool->large_bins = hdr->large;
+	pool->current_p_offset = &hdr->frontier;
+	p = (char *)(hdr + 1);
+	pool->epoch_info = (M_epoch_info *)(((uintptr_t)p + CACHE_LINE_SIZE - 1) & ~(uintptr_t)(CACHE_LINE_SIZE - 1));
+	pool->stats = (M_pool_stats *)(pool->epoch_info + 1);
+	pool->pool_mutex = (flags & M_POOL_MULTI_WRITER) ? (pthread_mutex_t *)(pool->stats + 1) : NULL;
+	pool->heap_mutex = (pthread_mutex_t *)(pool->stats + 1) + 1;
 	if(is_inited){
-		p += 2 * INT_SIZE;
-		current_p_offset = (int *)p;
-		p += PTR_SIZE + INT_SIZE;
-		free_list = (M_header *)p;
+		if(hdr->small_classes != M_SMALL_CLASSES || hdr->large_bins != M_LARGE_BINS){
+			log(SHMMAP_LOG_ERROR, "[m_init]The size classes(%d, %d) of the pool are different from (%d, %d)",
+				hdr->small_classes, hdr->large_bins, M_SMALL_CLASSES, M_LARGE_BINS);
+			free(pool);
+			return NULL;
+		}
 	}else{
-		size_p = (int *)p;
-		*size_p++ = free_list_len;
-		*size_p = 0;	// padding
-		p += INT_SIZE * 2;
-		current_p_offset = (int *)p;
-		p += PTR_SIZE;
-		padding(p);
-		p += INT_SIZE;
-		free_list = (M_header *)p;
-		for(i=0; i<free_list_len; i++){
-			(free_list+i)->idx = i;
-			(free_list+i)->size = 0;
+		hdr->small_classes = M_SMALL_CLASSES;
+		hdr->large_bins = M_LARGE_BINS;
+		for(i=0; i<M_SMALL_CLASSES; i++){
+			hdr->small[i].header_offset = NIL;
+			hdr->small[i].tail_offset = 0;
+			hdr->small[i].idx = i;
+			hdr->small[i].size = 0;
+		}
+		for(i=0; i<M_LARGE_BINS; i++){
+			hdr->large[i].header_offset = hdr->large[i].tail_offset = NIL;
+			hdr->large[i].idx = i;
+			hdr->large[i].size = 0;
+		}
+		memset(pool->epoch_info, 0, sizeof(M_epoch_info));
+		// epoch为0表示读者不在临界区，全局epoch从1开始
+		pool->epoch_info->epoch = 1;
+		pool->epoch_info->limbo_header_offset = pool->epoch_info->limbo_tail_offset = NIL;
+		memset(pool->stats, 0, sizeof(M_pool_stats));
+		if(pool->pool_mutex != NULL && !m_mutex_init(pool, pool->pool_mutex)){
+			free(pool);
+			return NULL;
+		}
+		if(!m_mutex_init(pool, pool->heap_mutex)){
+			free(pool);
+			return NULL;
+		}
+		// 大块按页对齐，共享内存的映射地址按页对齐，所以所有进程中的对齐方式相同
+		p = (char *)(pool->heap_mutex + 1);
+		p = (char *)(((uintptr_t)p + M_PAGE_SIZE - 1) & ~(uintptr_t)(M_PAGE_SIZE - 1));
+		hdr->heap_start = hdr->frontier = p - (char *)pool->pool_ptr_s;
+		hdr->last_size = 0;
+		hdr->run_cur = hdr->run_end = 0;
+		hdr->large_free = 0;
+	}
+	pool->reader_slot = NULL;
+	pool->lockfree = (flags & M_POOL_LOCKFREE) != 0;
+	pool->quiet_full = (flags & M_POOL_QUIET_FULL) != 0;
+	if(pool->lockfree){
+		// 线程退出时把magazine中的块放回内存池
+		if(pthread_key_create(&pool->mag_key, magazine_set_free) != 0){
+			log(SHMMAP_LOG_ERROR, "[m_init]Create thread key for magazines error");
+			free(pool);
+			return NULL;
+		}
+		if(!magazine_atfork){
+			// fork出的子进程不能继续使用父进程magazine中的块
+			pthread_atfork(NULL, NULL, magazine_fork);
+			magazine_atfork = true;
 		}
-		p += M_HEADER_SIZE * free_list_len;
-		padding(p);
-		*current_p_offset = p + INT_SIZE - (char *)pool_ptr_s;
 	}
 
-	m_pool_log(SHMMAP_LOG_INFO, "[m_init]Init memory pool, address start at %p, end at %p, cur offset at %d, size is %d",
-		pool_ptr_s, pool_ptr_e, *current_p_offset, pool_byte_len);
+	pool->log(SHMMAP_LOG_INFO, "[m_init]Init memory pool, address start at %p, end at %p, cur offset at %lld, size is %lld",
+		pool->pool_ptr_s, pool->pool_ptr_e, (long long)*pool->current_p_offset, (long long)pool_byte_len);
 
-	return true;
+	return pool;
+}
+
+/*
+ * 释放内存池在当前进程中的状态，共享内存不受影响
+ * 当前线程magazine中的块放回内存池，其他线程的magazine在destroy之后不能再使用
+ */
+void
+m_destroy(M_pool *pool){
+	M_magazine_set *set;
+
+	if(pool == NULL)
+		return;
+	m_reader_unregister(pool);
+	if(pool->lockfree){
+		set = (M_magazine_set *)pthread_getspecific(pool->mag_key);
+		if(set != NULL){
+			magazine_set_free(set);
+			pthread_setspecific(pool->mag_key, NULL);
+		}
+		pthread_key_delete(pool->mag_key);
+	}
+	free(pool);
 }
 
 /**
  * 返回空闲块的起始地址
  */
 void*
-m_alloc(int size){
-	int ptr_offset = _m_alloc(size);
+m_alloc(M_pool *pool, int size){
+	m_off_t ptr_offset;
+
+	alloc_lock(pool);
+	ptr_offset = _m_alloc(pool, size);
+	stat_alloc(pool, size, ptr_offset);
+	alloc_unlock(pool);
 	if(ptr_offset != -1){
-		return get_ptr(ptr_offset);
+		return get_ptr(pool, ptr_offset);
 	}
 	return NULL;
 }
@@ -247,8 +779,729 @@ m_alloc(int size){
  * 传入要释放的空闲块的data字段起始地址
  */
 void
-m_free(void *data_ptr){
-	_m_free(ptr_offset(data_ptr));
+m_free(M_pool *pool, void *data_ptr){
+	alloc_lock(pool);
+	_m_free(pool, ptr_offset(pool, data_ptr));
+	alloc_unlock(pool);
+}
+
+void*
+m_alloc_below(M_pool *pool, int size, m_off_t limit){
+	m_off_t block_offset;
+
+	alloc_lock(pool);
+	block_offset = _m_alloc_below(pool, size, limit);
+	// 整理时找不到limit之前的块是正常的，不算分配失败
+	if(block_offset != NIL)
+		stat_alloc(pool, size, get_mnode_data(pool, block_offset));
+	alloc_unlock(pool);
+	if(block_offset == NIL)
+		return NULL;
+	return get_ptr(pool, get_mnode_data(pool, block_offset));
+}
+
+/*
+ * 在limit之前分配块，返回块的偏移量
+ * 整理中释放的块在空闲块链的尾部，前面的块通常在limit之前，所以只检查头部的M_BELOW_SCAN个块
+ */
+static m_off_t
+_m_alloc_below(M_pool *pool, int size, m_off_t limit){
+	M_header 	*hdr;
+	m_off_t 	offset;
+	int 		idx, block_size, i;
+
+	if(size > M_SMALL_MAX){
+		heap_lock(pool);
+		offset = large_alloc(pool, size, limit);
+		heap_unlock(pool);
+		return offset;
+	}
+	// 无锁模式下空闲小块在栈中，只能从栈顶取
+	if(pool->lockfree)
+		return NIL;
+	idx = free_list_idx(size);
+	block_size = BLOCK_HEADER_SIZE + class_bytes(idx);
+	hdr = &pool->free_list[idx];
+	offset = hdr->size > 0 ? hdr->header_offset : NIL;
+	for(i=0; i<M_BELOW_SCAN && offset!=NIL; i++, offset=block_at(pool, offset)->next_offset){
+		if(offset + block_size <= limit){
+			list_unlink(pool, hdr, offset);
+			stat_add(pool, &pool->stats->small_free_bytes, -class_bytes(idx));
+			block_at(pool, offset)->data_len = 0;
+			return offset;
+		}
+	}
+	if(run_carve(pool, idx, 1, &offset, limit) == 0)
+		return NIL;
+	return offset;
+}
+
+int64_t
+m_shrink(M_pool *pool){
+	M_pool_hdr 	*hdr = pool->hdr;
+	m_off_t 	top, old_frontier;
+	int 		idx;
+
+	if(pool->lockfree)
+		return 0;
+	alloc_lock(pool);
+	old_frontier = hdr->frontier;
+	while(hdr->frontier > hdr->heap_start){
+		top = hdr->frontier - hdr->last_size + LARGE_HEADER_SIZE;
+		idx = block_at(pool, top)->idx;
+		if(idx == M_LARGE_FREE_IDX){
+			// heap_rebuild之后尾部可能留下没有合并的空闲大块
+			large_remove(pool, top, hdr->last_size);
+			hdr->frontier = top - LARGE_HEADER_SIZE;
+			hdr->last_size = large_hdr(pool, top)->prev_size;
+		}else if(idx < 0 || !run_release(pool, top)){
+			break;
+		}
+	}
+	alloc_unlock(pool);
+	return old_frontier - hdr->frontier;
+}
+
+int64_t
+m_trim(M_pool *pool){
+	M_header 	*bin;
+	m_off_t 	offset;
+	int64_t 	n, total;
+	int 		i;
+
+	alloc_lock(pool);
+	heap_lock(pool);
+	total = trim_range(pool, pool->hdr->frontier, pool->pool_byte_size);
+	for(i=0; i<M_LARGE_BINS && total>=0; i++){
+		bin = &pool->large_bins[i];
+		for(offset=bin->size>0 ? bin->header_offset : NIL; offset!=NIL; offset=block_at(pool, offset)->next_offset){
+			// 保留块所在的第一页，其中有大块的头部和空闲块链的指针
+			n = trim_range(pool, offset + BLOCK_HEADER_SIZE, offset - LARGE_HEADER_SIZE + large_hdr(pool, offset)->size);
+			if(n < 0){
+				total = -1;
+				break;
+			}
+			total += n;
+		}
+	}
+	heap_unlock(pool);
+	alloc_unlock(pool);
+	return total;
+}
+
+/* 释放[start, end)中完整的页，地址按页对齐计算，与映射地址无关 */
+static int64_t
+trim_range(M_pool *pool, m_off_t start, m_off_t end){
+	uintptr_t s = ((uintptr_t)pool->pool_ptr_s + start + M_PAGE_SIZE - 1) & ~(uintptr_t)(M_PAGE_SIZE - 1);
+	uintptr_t e = ((uintptr_t)pool->pool_ptr_s + end) & ~(uintptr_t)(M_PAGE_SIZE - 1);
+
+	if(s >= e)
+		return 0;
+	if(madvise((void *)s, e - s, MADV_REMOVE) != 0){
+		pool->log(SHMMAP_LOG_WARN, "[trim_range]Release pages error. msg: %s", strerror(errno));
+		return -1;
+	}
+	return e - s;
+}
+
+/* e1在e2之前，epoch会回绕，不能直接比较大小 */
+static bool
+epoch_before(unsigned int e1, unsigned int e2){
+	return (int)(e1 - e2) < 0;
+}
+
+/* 占用槽位的读者进程已经退出 */
+static bool
+reader_is_dead(M_reader_slot *slot){
+	int pid = shm_load_relaxed(&slot->pid);
+	return pid != 0 && kill(pid, 0) == -1 && errno == ESRCH;
+}
+
+/**
+ * 传入要释放的空闲块的data字段起始地址，块被放到limbo链表尾部，
+ * 记录当前的epoch，然后推进全局epoch。
+ */
+void
+m_retire(M_pool *pool, void *data_ptr){
+	pool_lock(pool);
+	_m_retire(pool, ptr_offset(pool, data_ptr));
+	pool_unlock(pool);
+}
+
+static void
+_m_retire(M_pool *pool, m_off_t data_offset){
+	M_block_hdr		*block_ptr, *tail_block_ptr;
+	m_off_t 		block_offset;
+	unsigned int 	e;
+
+	block_offset = get_mnode_by_data(pool, data_offset);
+	if(block_offset == -1){
+		pool->log(SHMMAP_LOG_ERROR, "[_m_retire]Get block offset error");
+		return;
+	}
+	block_ptr = (M_block_hdr *)get_ptr(pool, block_offset);
+	e = pool->epoch_info->epoch;
+	block_ptr->prev_offset = (m_off_t)e;
+	block_ptr->next_offset = NIL;
+	if(pool->epoch_info->limbo_size == 0){
+		pool->epoch_info->limbo_header_offset = block_offset;
+	}else{
+		tail_block_ptr = (M_block_hdr *)get_ptr(pool, pool->epoch_info->limbo_tail_offset);
+		tail_block_ptr->next_offset = block_offset;
+	}
+	pool->epoch_info->limbo_tail_offset = block_offset;
+	pool->epoch_info->limbo_size++;
+
+	// 之后进入临界区的读者一定看不到这个块
+	if(++e == 0)
+		e = 1;
+	shm_store_release(&pool->epoch_info->epoch, e);
+
+	if(pool->epoch_info->limbo_size >= M_LIMBO_BATCH)
+		_m_reclaim(pool);
+}
+
+int
+m_reclaim(M_pool *pool){
+	int n;
+
+	pool_lock(pool);
+	n = _m_reclaim(pool);
+	pool_unlock(pool);
+	return n;
+}
+
+static int
+_m_reclaim(M_pool *pool){
+	M_block_hdr		*block_ptr;
+	M_reader_slot	*slot;
+	unsigned int 	min_epoch, e;
+	m_off_t 		block_offset;
+	int 			i, n = 0;
+
+	if(pool->epoch_info->limbo_size == 0)
+		return 0;
+
+	// 与读者m_reader_enter中的屏障配对：要么读者看不到被释放的块，要么这里能看到读者的epoch
+	shm_smp_mb();
+	min_epoch = pool->epoch_info->epoch;
+	for(i=0; i<M_MAX_READERS; i++){
+		slot = &pool->epoch_info->readers[i];
+		e = shm_load_acquire(&slot->epoch);
+		if(e == 0 || !epoch_before(e, min_epoch))
+			continue;
+		// 读者进程在临界区中退出，释放它的槽位
+		if(reader_is_dead(slot)){
+			pool->log(SHMMAP_LOG_WARN, "[_m_reclaim]Reader process %d is dead, release its epoch slot", slot->pid);
+			shm_store_relaxed(&slot->epoch, 0);
+			shm_store_release(&slot->pid, 0);
+			continue;
+		}
+		min_epoch = e;
+	}
+
+	while(pool->epoch_info->limbo_size > 0){
+		block_offset = pool->epoch_info->limbo_header_offset;
+		block_ptr = (M_block_hdr *)get_ptr(pool, block_offset);
+		if(!epoch_before((unsigned int)block_ptr->prev_offset, min_epoch))
+			break;
+		pool->epoch_info->limbo_header_offset = block_ptr->next_offset;
+		pool->epoch_info->limbo_size--;
+		_m_free(pool, get_mnode_data(pool, block_offset));
+		n++;
+	}
+	if(pool->epoch_info->limbo_size == 0)
+		pool->epoch_info->limbo_header_offset = pool->epoch_info->limbo_tail_offset = NIL;
+	return n;
+}
+
+bool
+m_reader_enter(M_pool *pool){
+	M_reader_slot	*slot;
+	int 			i, dead_pid, pid = getpid();
+
+	// fork出的子进程继承了父进程的reader_slot，需要重新申请
+	if(pool->reader_slot == NULL || shm_load_relaxed(&pool->reader_slot->pid) != pid){
+		pool->reader_slot = NULL;
+		for(i=0; i<M_MAX_READERS && pool->reader_slot==NULL; i++){
+			slot = &pool->epoch_info->readers[i];
+			if(__sync_bool_compare_and_swap(&slot->pid, 0, pid))
+				pool->reader_slot = slot;
+		}
+		// 槽位用完时，抢占已经退出的读者进程的槽位
+		for(i=0; i<M_MAX_READERS && pool->reader_slot==NULL; i++){
+			slot = &pool->epoch_info->readers[i];
+			dead_pid = shm_load_relaxed(&slot->pid);
+			if(reader_is_dead(slot) && __sync_bool_compare_and_swap(&slot->pid, dead_pid, pid)){
+				shm_store_relaxed(&slot->epoch, 0);
+				pool->reader_slot = slot;
+			}
+		}
+		if(pool->reader_slot == NULL){
+			pool->log(SHMMAP_LOG_ERROR, "[m_reader_enter]All %d epoch slots of readers are used", M_MAX_READERS);
+			return false;
+		}
+	}
+	shm_store_relaxed(&pool->reader_slot->epoch, shm_load_acquire(&pool->epoch_info->epoch));
+	shm_smp_mb();
+	return true;
+}
+
+void
+m_reader_exit(M_pool *pool){
+	if(pool->reader_slot != NULL)
+		shm_store_release(&pool->reader_slot->epoch, 0);
+}
+
+void
+m_reader_unregister(M_pool *pool){
+	if(pool->reader_slot != NULL && shm_load_relaxed(&pool->reader_slot->pid) == getpid()){
+		shm_store_relaxed(&pool->reader_slot->epoch, 0);
+		shm_store_release(&pool->reader_slot->pid, 0);
+	}
+	pool->reader_slot = NULL;
+}
+
+//**********************统计计数器**********************//
+
+/* 已分配的块按所在的级或页数计算的字节数 */
+static int64_t
+block_bytes(M_pool *pool, m_off_t block_offset){
+	int idx = block_at(pool, block_offset)->idx;
+
+	return idx >= 0 ? class_bytes(idx) : large_hdr(pool, block_offset)->size;
+}
+
+/* 无锁模式下多个线程同时修改计数器，其他模式下调用者持有锁或者只有一个写者 */
+static void
+stat_add(M_pool *pool, int64_t *counter, int64_t n){
+	if(pool->lockfree)
+		__atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+	else
+		shm_store_relaxed(counter, *counter + n);
+}
+
+/*
+ * 记录一次分配，data_offset为-1表示失败
+ * 无锁模式下先累计在线程的magazine中，避免所有线程争用计数器所在的cache line
+ */
+static void
+stat_alloc(M_pool *pool, int size, m_off_t data_offset){
+	M_pool_stats 	*st = pool->stats;
+	M_magazine_set 	*set;
+	int64_t 		bytes;
+	int 			h;
+
+	if(data_offset == -1){
+		stat_add(pool, &st->alloc_failed, 1);
+		return;
+	}
+	bytes = block_bytes(pool, get_mnode_by_data(pool, data_offset));
+	h = size <= 1 ? 0 : 64 - __builtin_clzll((unsigned long long)size - 1);
+	if(h >= M_STAT_HIST)
+		h = M_STAT_HIST - 1;
+	set = pool->lockfree ? magazine_set(pool) : NULL;
+	if(set != NULL){
+		set->stat.used_bytes += bytes;
+		set->stat.alloc_count++;
+		set->stat.size_hist[h]++;
+		if(++set->stat.ops >= M_STAT_BATCH)
+			stat_flush(pool, &set->stat);
+		return;
+	}
+	stat_add(pool, &st->used_bytes, bytes);
+	stat_add(pool, &st->alloc_count, 1);
+	stat_add(pool, &st->size_hist[h], 1);
+}
+
+/* 记录一次释放，bytes是块的字节数 */
+static void
+stat_free(M_pool *pool, int64_t bytes){
+	M_magazine_set *set = pool->lockfree ? magazine_set(pool) : NULL;
+
+	if(set != NULL){
+		set->stat.used_bytes -= bytes;
+		set->stat.free_count++;
+		if(++set->stat.ops >= M_STAT_BATCH)
+			stat_flush(pool, &set->stat);
+		return;
+	}
+	stat_add(pool, &pool->stats->used_bytes, -bytes);
+	stat_add(pool, &pool->stats->free_count, 1);
+}
+
+/* 把线程本地累计的统计加到共享的计数器上 */
+static void
+stat_flush(M_pool *pool, M_stat_delta *delta){
+	M_pool_stats 	*st = pool->stats;
+	int 			i;
+
+	if(delta->ops == 0)
+		return;
+	__atomic_fetch_add(&st->used_bytes, delta->used_bytes, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&st->alloc_count, delta->alloc_count, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&st->free_count, delta->free_count, __ATOMIC_RELAXED);
+	for(i=0; i<M_STAT_HIST; i++){
+		if(delta->size_hist[i] != 0)
+			__atomic_fetch_add(&st->size_hist[i], delta->size_hist[i], __ATOMIC_RELAXED);
+	}
+	memset(delta, 0, sizeof(M_stat_delta));
+}
+
+//**********************无锁模式**********************//
+
+static void
+magazine_fork(){
+	fork_gen++;
+}
+
+/* 当前线程在内存池上的magazine，第一次使用时创建；内存不足时返回NULL，不使用magazine */
+static M_magazine_set*
+magazine_set(M_pool *pool){
+	M_magazine_set *set = (M_magazine_set *)pthread_getspecific(pool->mag_key);
+
+	if(set == NULL){
+		set = (M_magazine_set *)calloc(1, sizeof(M_magazine_set));
+		if(set == NULL || pthread_setspecific(pool->mag_key, set) != 0){
+			free(set);
+			return NULL;
+		}
+		set->pool = pool;
+		set->fork_gen = fork_gen;
+	}else if(set->fork_gen != fork_gen){
+		// 从父进程继承的magazine，其中的块和统计属于父进程
+		memset(set->mags, 0, sizeof(set->mags));
+		memset(&set->stat, 0, sizeof(set->stat));
+		set->fork_gen = fork_gen;
+	}
+	return set;
+}
+
+/* 当前线程在内存池上idx尺寸的magazine */
+static M_magazine*
+magazine_get(M_pool *pool, int idx){
+	M_magazine_set *set = magazine_set(pool);
+
+	return set == NULL ? NULL : &set->mags[idx];
+}
+
+/* 线程退出或者内存池destroy时，把magazine中的块放回共享的空闲块栈 */
+static void
+magazine_set_free(void *arg){
+	M_magazine_set 	*set = (M_magazine_set *)arg;
+	int 			i;
+
+	if(set->fork_gen == fork_gen){
+		for(i=0; i<M_MAGAZINE_CLASSES; i++)
+			magazine_flush(set->pool, i, &set->mags[i], set->mags[i].size);
+		stat_flush(set->pool, &set->stat);
+	}
+	free(set);
+}
+
+#define M_STACK_OFF_MASK ((1ULL << M_STACK_OFF_BITS) - 1)
+
+/* 栈顶的版本号加1，栈顶块改为offset */
+static inline uint64_t
+stack_top(uint64_t old_top, m_off_t offset){
+	uint64_t off = offset == NIL ? M_STACK_OFF_MASK : (uint64_t)offset >> 3;
+	return (((old_top >> M_STACK_OFF_BITS) + 1) << M_STACK_OFF_BITS) | off;
+}
+
+/* 栈顶块的偏移量 */
+static inline m_off_t
+stack_offset(uint64_t top){
+	uint64_t off = top & M_STACK_OFF_MASK;
+	return off == M_STACK_OFF_MASK ? NIL : (m_off_t)(off << 3);
+}
+
+/* 把first到last的一串块(已经通过next_offset串联好)压入空闲块栈idx */
+static void
+stack_push(M_pool *pool, int idx, m_off_t first, m_off_t last, int n){
+	uint64_t 	*top = (uint64_t *)&pool->free_list[idx].header_offset;
+	uint64_t 	old_top, new_top;
+	M_block_hdr *last_ptr = (M_block_hdr *)get_ptr(pool, last);
+
+	old_top = __atomic_load_n(top, __ATOMIC_RELAXED);
+	do{
+		shm_store_relaxed(&last_ptr->next_offset, stack_offset(old_top));
+		new_top = stack_top(old_top, first);
+	}while(!__atomic_compare_exchange_n(top, &old_top, new_top, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	__atomic_fetch_add(&pool->free_list[idx].size, n, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&pool->stats->small_free_bytes, (int64_t)n * class_bytes(idx), __ATOMIC_RELAXED);
+}
+
+/* 从空闲块栈idx弹出一个块，栈为空时返回NIL */
+static m_off_t
+stack_pop(M_pool *pool, int idx){
+	uint64_t 	*top = (uint64_t *)&pool->free_list[idx].header_offset;
+	uint64_t 	old_top, new_top;
+	m_off_t 	offset, next_offset;
+
+	old_top = __atomic_load_n(top, __ATOMIC_ACQUIRE);
+	do{
+		offset = stack_offset(old_top);
+		if(offset == NIL)
+			return NIL;
+		// 块可能已经被其他进程弹出并重用，读到的next_offset是错的，但版本号变化了，CAS一定失败
+		next_offset = shm_load_relaxed(&((M_block_hdr *)get_ptr(pool, offset))->next_offset);
+		new_top = stack_top(old_top, next_offset);
+	}while(!__atomic_compare_exchange_n(top, &old_top, new_top, true, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+	__atomic_fetch_sub(&pool->free_list[idx].size, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_sub(&pool->stats->small_free_bytes, class_bytes(idx), __ATOMIC_RELAXED);
+	return offset;
+}
+
+/* 无锁模式下分配块，返回数据字段的偏移量 */
+static m_off_t
+lf_alloc(M_pool *pool, int idx){
+	m_off_t block_offset = lf_alloc_block(pool, idx);
+	int 	c;
+
+	if(block_offset == NIL){
+		// 先尝试回收limbo链表中的块
+		if(m_reclaim(pool) > 0)
+			return lf_alloc(pool, idx);
+		// 再从更大一级的空闲块栈中取
+		for(c=idx+1; c<pool->free_list_len && block_offset==NIL; c++)
+			block_offset = stack_pop(pool, c);
+		if(block_offset != NIL)
+			return get_mnode_data(pool, block_offset);
+		if(!pool->quiet_full)
+			pool->log(SHMMAP_LOG_ERROR, "[lf_alloc]The unallocated area is used up, the size of free space is %lld",
+				(long long)m_free_size(pool));
+		return -1;
+	}
+	return get_mnode_data(pool, block_offset);
+}
+
+/*
+ * 依次从magazine、共享的空闲块栈、run中取一个块，返回块的偏移量，没有空间时返回NIL。
+ * 只有从run中切分时需要加heap_lock，magazine一次补充一批，分摊加锁的开销。
+ */
+static m_off_t
+lf_alloc_block(M_pool *pool, int idx){
+	M_magazine 	*mag;
+	m_off_t 	block_offset;
+
+	mag = idx < M_MAGAZINE_CLASSES ? magazine_get(pool, idx) : NULL;
+	if(mag == NULL){
+		block_offset = stack_pop(pool, idx);
+		if(block_offset == NIL){
+			heap_lock(pool);
+			if(run_carve(pool, idx, 1, &block_offset, pool->pool_byte_size) == 0)
+				block_offset = NIL;
+			heap_unlock(pool);
+		}
+		return block_offset;
+	}
+	if(mag->size == 0){
+		// 先从共享的空闲块栈补充一半，没有空闲块时再从run中一次切出一批
+		while(mag->size < M_MAGAZINE_SIZE / 2 && (block_offset = stack_pop(pool, idx)) != NIL)
+			mag->blocks[mag->size++] = block_offset;
+		if(mag->size == 0){
+			heap_lock(pool);
+			mag->size = run_carve(pool, idx, M_MAGAZINE_SIZE / 2, mag->blocks, pool->pool_byte_size);
+			heap_unlock(pool);
+		}
+	}
+	return mag->size > 0 ? mag->blocks[--mag->size] : NIL;
+}
+
+/* magazine中的n个块串成链表，一次压入共享的空闲块栈 */
+static void
+magazine_flush(M_pool *pool, int idx, M_magazine *mag, int n){
+	int i;
+
+	if(n <= 0)
+		return;
+	for(i=mag->size-n; i<mag->size-1; i++)
+		((M_block_hdr *)get_ptr(pool, mag->blocks[i]))->next_offset = mag->blocks[i+1];
+	stack_push(pool, idx, mag->blocks[mag->size-n], mag->blocks[mag->size-1], n);
+	mag->size -= n;
+}
+
+/* 无锁模式下释放块 */
+static void
+lf_free(M_pool *pool, m_off_t block_offset, int idx){
+	M_magazine *mag = idx < M_MAGAZINE_CLASSES ? magazine_get(pool, idx) : NULL;
+
+	if(mag == NULL){
+		stack_push(pool, idx, block_offset, block_offset, 1);
+		return;
+	}
+	if(mag->size == M_MAGAZINE_SIZE)
+		magazine_flush(pool, idx, mag, M_MAGAZINE_SIZE / 2);
+	mag->blocks[mag->size++] = block_offset;
+}
+
+void
+m_magazine_flush(M_pool *pool){
+	M_magazine_set 	*set;
+	int 			i;
+
+	if(!pool->lockfree)
+		return;
+	set = (M_magazine_set *)pthread_getspecific(pool->mag_key);
+	if(set == NULL || set->fork_gen != fork_gen)
+		return;
+	for(i=0; i<M_MAGAZINE_CLASSES; i++)
+		magazine_flush(pool, i, &set->mags[i], set->mags[i].size);
+	stat_flush(pool, &set->stat);
+}
+
+static void
+pool_lock(M_pool *pool){
+	if(pool->pool_mutex != NULL)
+		m_mutex_lock(pool, pool->pool_mutex, pool_recover, pool);
+}
+
+static void
+pool_unlock(M_pool *pool){
+	if(pool->pool_mutex != NULL)
+		m_mutex_unlock(pool->pool_mutex);
+}
+
+/* 无锁模式下分配、释放内存不需要加锁 */
+static void
+alloc_lock(M_pool *pool){
+	if(!pool->lockfree)
+		pool_lock(pool);
+}
+
+static void
+alloc_unlock(M_pool *pool){
+	if(!pool->lockfree)
+		pool_unlock(pool);
+}
+
+/*
+ * 沿next_offset遍历链表，返回节点数，*tail_offset设置为最后一个节点。
+ * 遇到非法偏移量时截断链表。
+ */
+static int
+recount_list(M_pool *pool, m_off_t header_offset, m_off_t *tail_offset){
+	M_block_hdr *block_ptr, *prev_ptr = NULL;
+	m_off_t 	offset = header_offset;
+	int64_t 	n = 0, max_blocks = pool->pool_byte_size / (BLOCK_HEADER_SIZE + 8);
+
+	*tail_offset = NIL;
+	while(offset != NIL && n < max_blocks){
+		block_ptr = (M_block_hdr *)try_get_ptr(pool, offset, BLOCK_HEADER_SIZE);
+		if(block_ptr == NULL){
+			if(prev_ptr != NULL)
+				prev_ptr->next_offset = NIL;
+			break;
+		}
+		*tail_offset = offset;
+		prev_ptr = block_ptr;
+		offset = block_ptr->next_offset;
+		n++;
+	}
+	return n;
+}
+
+/*
+ * 写者在分配、释放内存的过程中退出，空闲块链、limbo链表的长度和tail可能不一致，
+ * 按照链表中的实际节点重新计算。中途退出时正在分配、释放的块会被泄漏。
+ */
+static void
+pool_recover(void *arg){
+	M_pool 		*pool = (M_pool *)arg;
+	M_header 	*hdr;
+	m_off_t 	tail_offset;
+	int64_t 	free_bytes;
+	int 		i;
+
+	// 无锁模式下空闲块链不受锁保护，不需要修复
+	for(i=0; i<pool->free_list_len && !pool->lockfree; i++){
+		hdr = &pool->free_list[i];
+		if(hdr->size == 0)
+			continue;
+		hdr->size = recount_list(pool, hdr->header_offset, &tail_offset);
+		hdr->tail_offset = tail_offset;
+		if(hdr->size == 0)
+			hdr->header_offset = NIL;
+	}
+	if(!pool->lockfree){
+		for(i=0, free_bytes=0; i<pool->free_list_len; i++)
+			free_bytes += (int64_t)class_bytes(i) * pool->free_list[i].size;
+		pool->stats->small_free_bytes = free_bytes;
+	}
+	// 非无锁模式下大块也由pool_mutex保护
+	if(!pool->lockfree)
+		heap_rebuild(pool);
+	if(pool->epoch_info->limbo_size != 0){
+		pool->epoch_info->limbo_size = recount_list(pool, pool->epoch_info->limbo_header_offset, &tail_offset);
+		pool->epoch_info->limbo_tail_offset = tail_offset;
+		if(pool->epoch_info->limbo_size == 0)
+			pool->epoch_info->limbo_header_offset = NIL;
+	}
+}
+
+void
+m_recover(M_pool *pool){
+	pool_recover(pool);
+	// 无锁模式下pool_recover不重建堆
+	if(pool->lockfree)
+		heap_rebuild(pool);
+}
+
+bool
+m_mutex_init(M_pool *pool, pthread_mutex_t *mutex){
+	pthread_mutexattr_t attr;
+	int 				ret;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+#ifdef __linux__
+	pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+#endif
+	ret = pthread_mutex_init(mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+	if(ret != 0){
+		pool->log(SHMMAP_LOG_ERROR, "[m_mutex_init]Init process shared mutex error. msg: %s", strerror(ret));
+		return false;
+	}
+	return true;
+}
+
+void
+m_mutex_lock(M_pool *pool, pthread_mutex_t *mutex, shmmap_recover recover, void *arg){
+	int ret = pthread_mutex_lock(mutex);
+#ifdef __linux__
+	if(ret == EOWNERDEAD){
+		pool->log(SHMMAP_LOG_WARN, "[m_mutex_lock]The owner of lock %p is dead, recover the data it protects", mutex);
+		if(recover != NULL)
+			recover(arg);
+		pthread_mutex_consistent(mutex);
+		return;
+	}
+#endif
+	if(ret != 0)
+		pool->log(SHMMAP_LOG_ERROR, "[m_mutex_lock]Lock error. msg: %s", strerror(ret));
+}
+
+bool
+m_mutex_trylock(M_pool *pool, pthread_mutex_t *mutex, shmmap_recover recover, void *arg){
+	int ret = pthread_mutex_trylock(mutex);
+#ifdef __linux__
+	if(ret == EOWNERDEAD){
+		pool->log(SHMMAP_LOG_WARN, "[m_mutex_trylock]The owner of lock %p is dead, recover the data it protects", mutex);
+		if(recover != NULL)
+			recover(arg);
+		pthread_mutex_consistent(mutex);
+		return true;
+	}
+#endif
+	if(ret != 0 && ret != EBUSY)
+		pool->log(SHMMAP_LOG_ERROR, "[m_mutex_trylock]Lock error. msg: %s", strerror(ret));
+	return ret == 0;
+}
+
+void
+m_mutex_unlock(pthread_mutex_t *mutex){
+	pthread_mutex_unlock(mutex);
 }
 
 /**
@@ -258,88 +1511,135 @@ m_free(void *data_ptr){
  * len: 数据内容的长度，字节数
  */
 void
-set_mnode_data_by_data(void *data_ptr, void *data_content_ptr, int len){
-	M_block_hdr *block_ptr = (M_block_hdr *)get_ptr(get_mnode_by_data_ptr(data_ptr));
+set_mnode_data_by_data(M_pool *pool, void *data_ptr, void *data_content_ptr, int len){
+	M_block_hdr *block_ptr = (M_block_hdr *)get_ptr(pool, get_mnode_by_data_ptr(pool, data_ptr));
 	block_ptr->data_len = len;
 	memcpy(data_ptr, data_content_ptr, len);
 }
 
-
-int
-m_free_size(){
-	return pool_byte_size - *current_p_offset;
+int64_t
+m_free_size(M_pool *pool){
+	return pool->pool_byte_size - *pool->current_p_offset;
 }
 
-int
-m_pool_size(){
-	return pool_byte_size;
+int64_t
+m_pool_size(M_pool *pool){
+	return pool->pool_byte_size;
 }
 
-void m_free_list_info(){
+void m_free_list_info(M_pool *pool){
 	int i;
-	for(i=0; i<free_list_len; i++){
-		if(free_list[i].size != 0){
-			m_pool_log(SHMMAP_LOG_INFO, "[%d, %d]", (i+1)<<3, free_list[i].size);
+	for(i=0; i<pool->free_list_len; i++){
+		if(pool->free_list[i].size != 0){
+			pool->log(SHMMAP_LOG_INFO, "[%d, %d]", class_bytes(i), pool->free_list[i].size);
+		}
+	}
+	for(i=0; i<M_LARGE_BINS; i++){
+		if(pool->large_bins[i].size != 0){
+			pool->log(SHMMAP_LOG_INFO, "[<=%lld pages, %d]", (long long)class_units(i), pool->large_bins[i].size);
 		}
 	}
 }
 
 /* 所有空闲块内存的大小 */
-static int
-m_free_blck_size(){
-	int i, total = 0;
-	for(i=0; i<free_list_len; i++){
-		total += ((i+1)<<3)*(free_list + i)->size;
-	}
-	return total;
+static int64_t
+m_free_blck_size(M_pool *pool){
+	return shm_load_relaxed(&pool->stats->small_free_bytes) + shm_load_relaxed(&pool->hdr->large_free);
 }
 
 
 void
-m_memory_info(M_mem_info *info){
-	info->pool_size = pool_byte_size;
-	info->free_area_size = m_free_size();
-	info->allocated_area_size = pool_byte_size - info->free_area_size;
-	info->allocated_area_free_size = m_free_blck_size();
+m_memory_info(M_pool *pool, M_mem_info *info){
+	info->pool_size = pool->pool_byte_size;
+	info->free_area_size = m_free_size(pool);
+	info->allocated_area_size = pool->pool_byte_size - info->free_area_size;
+	info->allocated_area_free_size = m_free_blck_size(pool);
 	info->real_used_size = info->allocated_area_size - info->allocated_area_free_size;
 }
 
+void
+m_stats(M_pool *pool, M_pool_stats *stats){
+	M_pool_stats 	*st = pool->stats;
+	int 			i;
+
+	memset(stats, 0, sizeof(M_pool_stats));
+	stats->used_bytes = shm_load_relaxed(&st->used_bytes);
+	stats->small_free_bytes = shm_load_relaxed(&st->small_free_bytes);
+	stats->alloc_count = shm_load_relaxed(&st->alloc_count);
+	stats->free_count = shm_load_relaxed(&st->free_count);
+	stats->alloc_failed = shm_load_relaxed(&st->alloc_failed);
+	for(i=0; i<M_STAT_HIST; i++)
+		stats->size_hist[i] = shm_load_relaxed(&st->size_hist[i]);
+}
+
+bool
+m_class_info(M_pool *pool, int idx, int *block_bytes, int *free_blocks){
+	if(idx < 0 || idx >= pool->free_list_len)
+		return false;
+	*block_bytes = class_bytes(idx);
+	*free_blocks = shm_load_relaxed(&pool->free_list[idx].size);
+	return true;
+}
+
+int64_t
+m_usable_size(M_pool *pool, void *p){
+	m_off_t block_offset = get_mnode_by_data_ptr(pool, p);
+	int 	idx = block_at(pool, block_offset)->idx;
+
+	return idx >= 0 ? class_bytes(idx) : large_hdr(pool, block_offset)->size - LARGE_HEADER_SIZE - BLOCK_HEADER_SIZE;
+}
+
 /* 打印空闲块列表信息 */
 void
-m_free_info(){
+m_free_info(M_pool *pool){
 	int i;
 	printf("Free List INFO:\n");
-	for(i=0; i<free_list_len; i++){
-		if(free_list[i].size != 0)
-			printf("\tindex: %d, \tsize: %d\n", free_list[i].idx, free_list[i].size);
+	for(i=0; i<pool->free_list_len; i++){
+		if(pool->free_list[i].size != 0)
+			printf("\tindex: %d, \tsize: %d\n", pool->free_list[i].idx, pool->free_list[i].size);
+	}
+	for(i=0; i<M_LARGE_BINS; i++){
+		if(pool->large_bins[i].size != 0)
+			printf("\tlarge bin: %d, \tsize: %d\n", pool->large_bins[i].idx, pool->large_bins[i].size);
 	}
 }
 
 /* 获取指针相对于内存池起始地址的偏移量 */
-int
-ptr_offset(void *p){
-	assert(p > pool_ptr_s);
-	if(p < pool_ptr_s){
-		m_pool_log(SHMMAP_LOG_ERROR, "[ptr_offset]Pointer(%p) is less than pool_ptr_s(%p).", p, pool_ptr_s);
+m_off_t
+ptr_offset(M_pool *pool, void *p){
+	assert(p > pool->pool_ptr_s);
+	if(p < pool->pool_ptr_s){
+		pool->log(SHMMAP_LOG_ERROR, "[ptr_offset]Pointer(%p) is less than pool_ptr_s(%p).", p, pool->pool_ptr_s);
 		return -1;
 	}
-	return (char*)p - (char*)pool_ptr_s;
+	return (char*)p - (char*)pool->pool_ptr_s;
 }
 
 /* 根据偏移量获取指针 */
 void*
-get_ptr(int offset){
-	void *p = (char*)pool_ptr_s + offset;
-    assert(p > pool_ptr_s);
-    assert(p < pool_ptr_e);
-	if(p<pool_ptr_s || p>pool_ptr_e){
-		m_pool_log(SHMMAP_LOG_ERROR, "[get_ptr]Offset(%d) must be larger than 0 and less than pool_byte_size(%d)",
-			offset, pool_byte_size);
+get_ptr(M_pool *pool, m_off_t offset){
+	void *p = (char*)pool->pool_ptr_s + offset;
+    assert(p > pool->pool_ptr_s);
+    assert(p < pool->pool_ptr_e);
+	if(p<pool->pool_ptr_s || p>pool->pool_ptr_e){
+		pool->log(SHMMAP_LOG_ERROR, "[get_ptr]Offset(%lld) must be larger than 0 and less than pool_byte_size(%lld)",
+			(long long)offset, (long long)pool->pool_byte_size);
 		return NULL;
 	}
 	return p;
 }
 
+/*
+ * 根据偏移量获取指针，并检查[offset, offset+len)在内存池中。
+ * 无锁读者读到的偏移量可能已经被写者修改，不能直接使用get_ptr的断言。
+ */
+void*
+try_get_ptr(M_pool *pool, m_off_t offset, int len){
+	if(offset <= 0 || len < 0 || offset > pool->pool_byte_size - len)
+		return NULL;
+	return (char*)pool->pool_ptr_s + offset;
+}
+
 void
 default_shmmap_log(shmmap_log_level level, const char *msg_fmt, ...){
 	va_list ap;
@@ -15,11 +15,49 @@
 #include <stdbool.h>
 #include <string.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <pthread.h>
 
 #define padding(p) *((int *)p) = 0
 #define NIL -1
-/* 允许内存块的最大值为 8*128*1024 = 1MB */
-#define FREE_LIST_SIZE 128*1024
+/*
+ * 小块的尺寸分级：8到128字节每8字节一级，之后每翻一倍分4级(160、192、224、256、320...)，
+ * 最大M_SMALL_MAX字节，共M_SMALL_CLASSES级。超过M_SMALL_MAX的是大块，按页分配。
+ */
+#define M_SMALL_CLASSES 44
+#define M_SMALL_MAX (16 * 1024)
+/* 大块的粒度 */
+#define M_PAGE_SIZE 4096
+/* 空闲大块按页数分级，分级方式与小块相同 */
+#define M_LARGE_BINS 128
+/* 小块从run中切出，一个run至少包含的页数 */
+#define M_RUN_PAGES 16
+/* 块头部idx的特殊值：已分配的大块、空闲的大块 */
+#define M_LARGE_IDX			-2
+#define M_LARGE_FREE_IDX	-3
+/* 非无锁模式下空闲小块头部data_len的值，整理时据此判断run中的小块是否都空闲 */
+#define M_FREE_LEN -1
+/* m_alloc_below在小块的空闲块链头部最多检查的块数 */
+#define M_BELOW_SCAN 64
+/* 同时注册epoch的读者进程数上限 */
+#define M_MAX_READERS 128
+/* limbo链表中的块数达到该值时尝试回收 */
+#define M_LIMBO_BATCH 64
+#define CACHE_LINE_SIZE 64
+/* 无锁模式下进程私有的空闲块缓存(magazine)：缓存的尺寸种类数(不超过1KB的小块)、每种尺寸缓存的块数 */
+#define M_MAGAZINE_CLASSES 28
+#define M_MAGAZINE_SIZE 32
+/* 分配请求大小的直方图的桶数，第i个桶统计(2^(i-1), 2^i]字节的请求，最后一个桶还包括更大的请求 */
+#define M_STAT_HIST 32
+/* 无锁模式下线程在本地累计的统计次数，达到该值时才加到共享的计数器上 */
+#define M_STAT_BATCH 64
+/* 无锁栈顶中块偏移量(除以8)占的位数，内存池最大 8 * 2^40 = 8TB */
+#define M_STACK_OFF_BITS 40
+
+/* m_init的flags */
+#define M_POOL_MULTI_WRITER		0x1		// 多个进程同时写，分配、释放内存需要同步
+#define M_POOL_LOCKFREE			0x2		// 分配、释放内存不加锁，使用无锁栈和magazine
+#define M_POOL_QUIET_FULL		0x4		// 内存用完时不记录日志，由调用者处理，比如缓存模式下淘汰旧的key后重试
 
 #ifdef __cplusplus
 extern "C" {
@@ -35,18 +73,15 @@ typedef enum {
 
 /* 记录日志 */
 typedef void (*shmmap_log)(shmmap_log_level level, const char *fmt, ...);
+/* 持有锁的进程退出后，修复锁保护的数据 */
+typedef void (*shmmap_recover)(void *arg);
+/* 距离内存池起始地址的偏移量，64位，内存池可以超过2GB */
+typedef int64_t m_off_t;
+/* 内存池在当前进程中的状态，一个进程可以同时打开多个内存池 */
+typedef struct m_pool M_pool;
 
 /*
-	空闲块大小是8bytes的倍数，便于字节对齐
-	8:
-	16:
-	...
-	8n:
-	对于每个空闲块大小都有一个链表，组织所有的空闲块。
-	对于一个内存申请请求，需要提供所请求内存的大小len，
-	在空闲块列表free_list中查找恰好可以容纳len的空闲块链n8_list。
-	然后在n8_list中返回空闲块。
-	空闲块列表，就是数组：
+	小块的大小按几何级数分级，每一级有一个空闲块链：
 	-----------
 	| 8bytes  | --> block --> block --> block
 	|----------
@@ -54,40 +89,135 @@ typedef void (*shmmap_log)(shmmap_log_level level, const char *fmt, ...);
 	|----------
 	|	...	  |
 	|---------|
-	| 8nbytes |
+	| 128bytes|
+	|---------|
+	| 160bytes|
+	|---------|
+	|	...	  |
+	|---------|
+	| 16KB    |
 	-----------
-	空闲块的结构：
+	分配时把请求的大小向上取整到所在的级，从该级的链表中取块；链表为空时从当前的run中切出新块。
+	run是一个按页分配的大块，专门用来切分小块，不会被释放。
+
+	大块(以及run)从堆的未分配区按页分配，物理上连续排列，每个大块的头部记录自己和前一个大块的大小，
+	释放时与相邻的空闲大块合并，位于未分配区边上的空闲大块直接还给未分配区；
+	空闲大块按页数分级放入链表，分配时取足够大的块，多余的页拆分出来放回链表。
+
+	块的结构：
 	{--------------头部-----------------}
 	-------------------------------------------------
-	| index | prev | next | data length | 	data	|
+	| index | data length | prev | next | 	data	|
 	-------------------------------------------------
+	大块在头部之前还有M_large_hdr。块和数据字段的偏移量都按8bytes对齐，大块的起始地址按页对齐。
 
  */
 
 /*
- * 空闲块的头部
+ * 块的头部，idx为小块的级，或者M_LARGE_IDX、M_LARGE_FREE_IDX
  */
 typedef struct m_block_hdr {
 	int idx;
-	int prev_offset;
-	int next_offset;
 	int data_len;
+	m_off_t prev_offset;
+	m_off_t next_offset;
 } M_block_hdr;
 
-// 分配内存时从header删除m_node，回收内存时在tail添加m_node
+/*
+ * 大块在M_block_hdr之前的头部
+ * size: 		整个大块的字节数，是M_PAGE_SIZE的倍数
+ * prev_size: 	物理上前一个大块的字节数，第一个大块为0
+ */
+typedef struct m_large_hdr {
+	m_off_t size;
+	m_off_t prev_size;
+} M_large_hdr;
+
+/*
+ * 分配内存时从header删除m_node，回收内存时在tail添加m_node
+ * 无锁模式下小块的空闲块链是一个栈：header_offset作为一个64位的字用CAS修改，
+ * 低M_STACK_OFF_BITS位是栈顶块的偏移量除以8，高位是版本号，每次修改加1，防止ABA问题。
+ */
 typedef struct m_header {
-	int header_offset;
-	int tail_offset;
+	m_off_t header_offset;
+	m_off_t tail_offset;
 	int size;		// 链表的长度
 	int idx;
 } M_header;
 
+/*
+ * 内存池的头部，在共享内存中
+ * frontier: 	堆的未分配区的起始偏移量，大块从这里向后分配
+ * heap_start: 	第一个大块的偏移量
+ * last_size: 	紧挨着未分配区的大块的字节数
+ * run_cur、run_end: 当前run中未切分的部分
+ * large_free: 	空闲大块的字节数
+ */
+typedef struct m_pool_hdr {
+	int small_classes;
+	int large_bins;
+	m_off_t frontier;
+	m_off_t heap_start;
+	m_off_t last_size;
+	m_off_t run_cur;
+	m_off_t run_end;
+	int64_t large_free;
+	M_header small[M_SMALL_CLASSES];
+	M_header large[M_LARGE_BINS];
+} M_pool_hdr;
+
+/*
+ * 读者的epoch槽位，每个槽位独占一个cache line，避免读者之间的伪共享
+ * pid: 	占用槽位的读者进程，0表示空闲
+ * epoch: 	读者进入临界区时的全局epoch，0表示不在临界区中
+ */
+typedef struct m_reader_slot {
+	int pid;
+	unsigned int epoch;
+	char padding[CACHE_LINE_SIZE - 2 * sizeof(int)];
+} M_reader_slot;
+
+/*
+ * 延迟回收(epoch based reclamation)
+ * 写者释放读者可能仍在使用的块时，先把块放入limbo链表，并记录当时的全局epoch，
+ * 所有处于临界区的读者都进入了更新的epoch之后，块才真正回到空闲块链。
+ * limbo链表复用块头部：next_offset串联链表，prev_offset记录被释放时的epoch。
+ */
+typedef struct m_epoch_info {
+	unsigned int epoch;
+	int limbo_size;
+	m_off_t limbo_header_offset;
+	m_off_t limbo_tail_offset;
+	char padding[CACHE_LINE_SIZE - 2 * sizeof(int) - 2 * sizeof(m_off_t)];
+	M_reader_slot readers[M_MAX_READERS];
+} M_epoch_info;
+
+/*
+ * 内存池的统计计数器，写者在分配、释放时增量更新，任何进程都可以O(1)地读取。
+ * 独占cache line，轮询的监控进程不会和写者争用空闲块链所在的cache line。
+ * 无锁模式下线程先在本地累计，每个线程最多落后M_STAT_BATCH次操作。
+ * used_bytes: 		已分配、还没有释放的块的字节数，按块所在的级(大块按页)计算，limbo链表中的块回收前也算在内
+ * small_free_bytes: 空闲块链中小块的字节数，不包括无锁模式下magazine中缓存的块
+ * alloc_count: 	成功的分配次数
+ * free_count: 		释放次数
+ * alloc_failed: 	失败的分配次数
+ * size_hist: 		分配请求大小的直方图
+ */
+typedef struct m_pool_stats {
+	int64_t used_bytes;
+	int64_t small_free_bytes;
+	int64_t alloc_count;
+	int64_t free_count;
+	int64_t alloc_failed;
+	int64_t size_hist[M_STAT_HIST];
+} __attribute__((aligned(CACHE_LINE_SIZE))) M_pool_stats;
+
 typedef struct m_mem_info {
-	int pool_size;
-	int free_area_size;
-	int allocated_area_size;
-	int real_used_size;
-	int allocated_area_free_size;
+	int64_t pool_size;
+	int64_t free_area_size;
+	int64_t allocated_area_size;
+	int64_t real_used_size;
+	int64_t allocated_area_free_size;
 } M_mem_info;
 /**
  * 内存池初始化
@@ -95,32 +225,102 @@ typedef struct m_mem_info {
  * pool_size: 		内存块的大小
  * log				日志handler
  * is_inited: 		是否已经初始化。已经初始化则直接读取索引，否则建立索引。
+ * flags:			M_POOL_MULTI_WRITER、M_POOL_LOCKFREE、M_POOL_QUIET_FULL的组合
+ * return:			内存池的句柄，出错时返回NULL
  */
-bool m_init(char *pool_ptr, int pool_size, shmmap_log log, bool is_inited);
+M_pool* m_init(char *pool_ptr, int64_t pool_size, shmmap_log log, bool is_inited, int flags);
+/* 释放m_init返回的句柄，不修改共享内存 */
+void m_destroy(M_pool *pool);
 /* 申请可以容纳len bytes的内存块 */
-void* m_alloc(int len);
+void* m_alloc(M_pool *pool, int len);
 /* 释放p指向的内存块 */
-void m_free(void *p);
+void m_free(M_pool *pool, void *p);
+/* 延迟释放p指向的内存块，等所有读者离开当前epoch后再回收 */
+void m_retire(M_pool *pool, void *p);
+/* 回收limbo链表中已经没有读者引用的内存块，返回回收的块数 */
+int m_reclaim(M_pool *pool);
+/*
+ * 与m_alloc相同，但只使用完全位于limit之前的块，不从未分配区分配，找不到时返回NULL。
+ * 整理时用它把堆尾部的数据搬到前面。无锁模式下只能分配大块。
+ */
+void* m_alloc_below(M_pool *pool, int len, m_off_t limit);
+/*
+ * 从堆的尾部开始，把所有小块都空闲的run还给未分配区，遇到使用中的块时停止。
+ * 无锁模式下空闲小块在栈中，不能从中间摘除，run不会被归还。
+ * return: 未分配区增加的字节数
+ */
+int64_t m_shrink(M_pool *pool);
+/*
+ * 用madvise(MADV_REMOVE)释放未分配区和空闲大块占用的物理内存(以及文件空间)，
+ * 这些页之后读到的是0。文件系统不支持时返回-1。
+ * return: 释放的字节数
+ */
+int64_t m_trim(M_pool *pool);
+/*
+ * 无锁模式下把当前线程magazine中缓存的块还给共享的空闲块链。
+ * 通过pthread_exit退出的线程会自动归还，进程退出前需要调用。
+ */
+void m_magazine_flush(M_pool *pool);
+
+
+//**********************读者epoch**********************//
+/*
+ * 读者进入临界区，在m_reader_exit之前读到的指针都不会被回收、重用。
+ * 第一次调用时为当前进程分配epoch槽位，槽位用完时返回false。
+ * 不支持嵌套调用。
+ */
+bool m_reader_enter(M_pool *pool);
+/* 读者离开临界区 */
+void m_reader_exit(M_pool *pool);
+/* 释放当前进程占用的epoch槽位 */
+void m_reader_unregister(M_pool *pool);
 
 
 //**********************内存使用状况**********************//
 /* 返回空闲内存大小，bytes */
-int m_free_size();
+int64_t m_free_size(M_pool *pool);
 /* 整个内存池大小 */
-int m_pool_size();
+int64_t m_pool_size(M_pool *pool);
 /* 返回空闲列表信息 */
-void m_free_list_info();
-void m_memory_info(M_mem_info *info);
+void m_free_list_info(M_pool *pool);
+/* 内存使用状况，根据统计计数器计算，不遍历空闲块链 */
+void m_memory_info(M_pool *pool, M_mem_info *info);
+/* 读取统计计数器的快照，各个计数器分别读取，彼此之间可能有微小的不一致 */
+void m_stats(M_pool *pool, M_pool_stats *stats);
+/* 第idx级小块的字节数和空闲块数，idx超出范围时返回false */
+bool m_class_info(M_pool *pool, int idx, int *block_bytes, int *free_blocks);
+/* m_alloc返回的块p实际可用的字节数，不小于分配时请求的大小 */
+int64_t m_usable_size(M_pool *pool, void *p);
 
 
 //**********************向内存块填充内容******************//
 /* 根据空闲块中data字段起始地址设置对应的data数据 */
-void set_mnode_data_by_data(void *data_ptr, void *data_content_ptr, int len);
+void set_mnode_data_by_data(M_pool *pool, void *data_ptr, void *data_content_ptr, int len);
 
 
 //**********************指针、偏移量**********************//
-void* get_ptr(int offset);
-int ptr_offset(void *p);
+void* get_ptr(M_pool *pool, m_off_t offset);
+m_off_t ptr_offset(M_pool *pool, void *p);
+/* 与get_ptr相同，但[offset, offset+len)超出内存池时返回NULL，不断言、不记日志。供无锁读者使用 */
+void* try_get_ptr(M_pool *pool, m_off_t offset, int len);
+
+
+//**********************崩溃恢复**********************//
+/*
+ * 写者在修改过程中退出后修复内存池：重新计算空闲块链、limbo链表的长度，重建空闲大块链。
+ * 单写者模式下没有锁能发现写者退出，由调用者根据自己的记录判断是否需要修复
+ */
+void m_recover(M_pool *pool);
+
+
+//**********************进程间共享的锁********************//
+/* 初始化共享内存中的互斥锁，持有锁的进程退出后，其他进程可以恢复该锁 */
+bool m_mutex_init(M_pool *pool, pthread_mutex_t *mutex);
+/* 加锁，上一个持有者在持有锁时退出的话，先调用recover修复数据 */
+void m_mutex_lock(M_pool *pool, pthread_mutex_t *mutex, shmmap_recover recover, void *arg);
+/* 尝试加锁，锁被其他进程持有时返回false */
+bool m_mutex_trylock(M_pool *pool, pthread_mutex_t *mutex, shmmap_recover recover, void *arg);
+void m_mutex_unlock(pthread_mutex_t *mutex);
 
 
 //**********************默认日志输出handler***************//
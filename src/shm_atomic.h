@@ -0,0 +1,62 @@
+/**
+ *
+ * 共享内存中多进程读写用到的原子操作、内存屏障
+ *
+ * @file shm_atomic.h
+ * @author chosen0ne
+ * @date 2026-10-17
+ */
+
+#ifndef SHMMAP_SHM_ATOMIC_H
+#define SHMMAP_SHM_ATOMIC_H
+
+/* 读取共享变量，之后的读写不会被重排到它之前 */
+#define shm_load_acquire(p)			__atomic_load_n((p), __ATOMIC_ACQUIRE)
+/* 写入共享变量，之前的读写不会被重排到它之后 */
+#define shm_store_release(p, v)		__atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define shm_load_relaxed(p)			__atomic_load_n((p), __ATOMIC_RELAXED)
+#define shm_store_relaxed(p, v)		__atomic_store_n((p), (v), __ATOMIC_RELAXED)
+
+/* 读屏障、写屏障 */
+#define shm_smp_rmb()				__atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define shm_smp_wmb()				__atomic_thread_fence(__ATOMIC_RELEASE)
+#define shm_smp_mb()				__atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+#if defined(__x86_64__) || defined(__i386__)
+#define shm_cpu_relax()				__asm__ __volatile__("pause" ::: "memory")
+#else
+#define shm_cpu_relax()				__asm__ __volatile__("" ::: "memory")
+#endif
+
+/*
+ * 顺序锁(seqlock)
+ * 写者修改前后各把seq加1，修改过程中seq为奇数；
+ * 读者读取前后比较seq，不一致(或为奇数)时说明读到的数据可能不完整，需要重读。
+ */
+#define shm_seq_write_begin(seq_p)	do{								\
+		shm_store_relaxed((seq_p), *(seq_p) + 1);					\
+		shm_smp_wmb();												\
+	}while(0)
+
+#define shm_seq_write_end(seq_p)	do{								\
+		shm_smp_wmb();												\
+		shm_store_relaxed((seq_p), *(seq_p) + 1);					\
+	}while(0)
+
+/* 等待写者完成，返回偶数的seq */
+static inline unsigned int
+shm_seq_read_begin(const unsigned int *seq_p){
+	unsigned int seq;
+	while((seq = shm_load_acquire(seq_p)) & 1)
+		shm_cpu_relax();
+	return seq;
+}
+
+/* 读取期间seq发生变化返回true，需要重读 */
+static inline int
+shm_seq_read_retry(const unsigned int *seq_p, unsigned int seq){
+	shm_smp_rmb();
+	return shm_load_relaxed(seq_p) != seq;
+}
+
+#endif
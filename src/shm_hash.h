@@ -0,0 +1,100 @@
+/**
+ *
+ * 64位的带种子的hash函数，算法参考wyhash(final v4)
+ * 每次处理8/16/48字节，长key比逐字节的hash快得多；种子随数据文件随机生成，
+ * 不知道种子时无法构造大量冲突的key。
+ *
+ * @file shm_hash.h
+ * @author chosen0ne
+ * @date 2026-10-17
+ */
+
+#ifndef SHMMAP_SHM_HASH_H
+#define SHMMAP_SHM_HASH_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define SHM_HASH_P0 0xa0761d6478bd642full
+#define SHM_HASH_P1 0xe7037ed1a0b428dbull
+#define SHM_HASH_P2 0x8ebc6af09c88c6e3ull
+#define SHM_HASH_P3 0x589965cc75374cc3ull
+
+/* 64位乘法得到128位结果，a、b分别保存低64位和高64位 */
+static inline void
+shm_hash_mum(uint64_t *a, uint64_t *b){
+	__uint128_t r = (__uint128_t)*a * *b;
+	*a = (uint64_t)r;
+	*b = (uint64_t)(r >> 64);
+}
+
+static inline uint64_t
+shm_hash_mix(uint64_t a, uint64_t b){
+	shm_hash_mum(&a, &b);
+	return a ^ b;
+}
+
+static inline uint64_t
+shm_hash_r8(const uint8_t *p){
+	uint64_t v;
+	memcpy(&v, p, 8);
+	return v;
+}
+
+static inline uint64_t
+shm_hash_r4(const uint8_t *p){
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+/* 1~3个字节 */
+static inline uint64_t
+shm_hash_r3(const uint8_t *p, size_t k){
+	return ((uint64_t)p[0] << 16) | ((uint64_t)p[k >> 1] << 8) | p[k - 1];
+}
+
+static inline uint64_t
+shm_hash64(const void *key, size_t len, uint64_t seed){
+	const uint8_t 	*p = (const uint8_t *)key;
+	uint64_t 		a, b, s1, s2;
+	size_t 			i = len;
+
+	seed ^= shm_hash_mix(seed ^ SHM_HASH_P0, SHM_HASH_P1);
+	if(len <= 16){
+		if(len >= 4){
+			a = (shm_hash_r4(p) << 32) | shm_hash_r4(p + ((len >> 3) << 2));
+			b = (shm_hash_r4(p + len - 4) << 32) | shm_hash_r4(p + len - 4 - ((len >> 3) << 2));
+		}else if(len > 0){
+			a = shm_hash_r3(p, len);
+			b = 0;
+		}else{
+			a = b = 0;
+		}
+	}else{
+		if(i > 48){
+			s1 = s2 = seed;
+			do{
+				seed = shm_hash_mix(shm_hash_r8(p) ^ SHM_HASH_P1, shm_hash_r8(p + 8) ^ seed);
+				s1 = shm_hash_mix(shm_hash_r8(p + 16) ^ SHM_HASH_P2, shm_hash_r8(p + 24) ^ s1);
+				s2 = shm_hash_mix(shm_hash_r8(p + 32) ^ SHM_HASH_P3, shm_hash_r8(p + 40) ^ s2);
+				p += 48;
+				i -= 48;
+			}while(i > 48);
+			seed ^= s1 ^ s2;
+		}
+		while(i > 16){
+			seed = shm_hash_mix(shm_hash_r8(p) ^ SHM_HASH_P1, shm_hash_r8(p + 8) ^ seed);
+			p += 16;
+			i -= 16;
+		}
+		a = shm_hash_r8(p + i - 16);
+		b = shm_hash_r8(p + i - 8);
+	}
+	a ^= SHM_HASH_P1;
+	b ^= seed;
+	shm_hash_mum(&a, &b);
+	return shm_hash_mix(a ^ SHM_HASH_P0 ^ len, b ^ SHM_HASH_P1);
+}
+
+#endif
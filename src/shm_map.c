@@ -8,268 +8,3875 @@
  */
 
 #include "shm_map.h"
+#include "shm_hash.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 static int MAX_CAPACITY = 1 << 30;	// 桶的最大个数
 static int ENTRY_HEADER_SIZE = sizeof(H_entry);
 static int INT_SIZE = sizeof(int);
+static int BLOCK_HEADER_SIZE = sizeof(M_block_hdr);
 
-static H_bulk *map_bulk_list;
-static int map_bulk_list_len;
-static int *_map_size;
-static shmmap_log shm_map_log;
+/* map在当前进程中的状态 */
+struct shm_map {
+	M_pool *pool;					// map的内存池
+	void *shm;						// mmap的起始地址
+	int fd;							// 数据文件、共享内存对象或memfd，可以通过shm_map_send_fd发送给其他进程
+	size_t shm_size;				// mmap的大小
+	H_bulk *bulk_list;
+	int bulk_list_len;
+	int *size;						// 单写者模式下key的个数
+	int flags;
+	H_lock_stripe *lock_stripes;	// 多写者模式下的锁分段
+	int lock_stripe_len;
+	int lock_stripe_shift;			// 桶的下标右移lock_stripe_shift位得到锁分段的下标
+	H_grow_info *grow_info;			// 扩容的状态
+	m_off_t *segments;				// 扩容时新增桶的segment目录，不能扩容时为NULL
+	H_change_info *change;			// 修改的版本号，读者在上面等待修改
+	H_order_info *order;			// 有序索引的头部
+	uint64_t order_rand;			// 写者生成有序索引节点层数的随机数状态
+	size_t pool_offset;				// 内存池在映射中的偏移量
+	char *path;						// 数据文件的路径，以及打开时的参数，shm_map_reload用它们重新打开
+	int capacity;
+	size_t mem_size;
+	int open_flags;
+	int pid;						// 打开map的进程，写者把它记录在意图中
+	uint64_t pid_start;				// 打开map的进程的启动时间，和pid一起记录在意图中
+	unsigned char *swiss_ctrl;		// swiss table的控制字节
+	unsigned int *swiss_seq;		// swiss table每组slot的顺序锁
+	H_slot *swiss_slots;			// swiss table的slot
+	int swiss_group_len;			// swiss table的组数
+	int swiss_deleted;				// 写者上次清理删除标记之后新增的删除标记数
+	int version;					// 数据文件的格式版本
+	uint64_t seed;					// hash种子
+	m_off_t compact_limit;			// 本轮整理把位于它之后的块搬到前面，0表示没有在整理
+	int compact_cursor;				// 本轮整理的下一个桶(swiss table为slot)
+	int clock_hand;					// 缓存模式下CLOCK的指针，下一个检查的桶(swiss table为slot)
+	unsigned int put_expire;		// 缓存模式下写者正在写入的key的过期时间
+	H_order_node *put_node;			// 写者正在写入的key在有序索引中的节点，写入hash索引后记录entry
+	shmmap_log log;
+};
 
-/* 获取hash值 */
-static int hash(int h);
-/* 根据hash值查找在map_bulk_list中的下标 */
-static int index_for(int h);
-/* 字符串的hash_code */
-static int hash_code(const char *str);
-static void* get_shm(const char *file, int size);
+/* 锁分段的recover回调的参数 */
+typedef struct stripe_arg {
+	shm_map_t *map;
+	H_lock_stripe *stripe;
+} H_stripe_arg;
 
+/* 文件头部各部分相对于文件起始位置的偏移量 */
+typedef struct map_layout {
+	size_t index;		// 桶数组或swiss table
+	size_t stripes;		// 锁分段，对齐到cache line
+	size_t change;		// 修改通知
+	size_t grow;		// 扩容的状态
+	size_t order;		// 有序索引的头部
+	size_t pool;		// 内存池，对齐到8字节
+} H_map_layout;
 
-static int
-hash(int h){
-	h ^= (h >> 20) ^ (h >> 12);
-	return h ^ (h >> 7) ^ (h >> 4);
+/*
+ * 批量构建的状态
+ * hashes: 		每个输入的hash值
+ * order: 		按分区排好序的输入下标，part_start[p]是第p个分区的起始位置
+ * counts: 		每个线程的输入在各个分区中的个数，排序时变成每个线程在各个分区中的写入位置
+ * entries: 	与order对应的entry；链入之后保存被替换的entry，没有时为NULL
+ * part_size: 	每个分区中不同key的个数
+ */
+typedef struct build_ctx {
+	shm_map_t *map;
+	const shm_map_kv *kvs;
+	int n;
+	int threads;
+	int *hashes;
+	int *order;
+	int *part_start;
+	int *counts;
+	H_entry **entries;
+	int *part_size;
+} H_build_ctx;
+
+/* 批量构建线程的参数，id是线程负责的输入段或者分区 */
+typedef struct build_arg {
+	H_build_ctx *ctx;
+	int id;
+} H_build_arg;
+
+/* 预读线程的参数，线程读入[p, p+len)中的页 */
+typedef struct prefault_arg {
+	char *p;
+	size_t len;
+	size_t step;
+} H_prefault_arg;
+
+static shm_map_t *default_map;		// map_init打开的map，供旧的接口使用
+
+/* 根据hash值查找桶的下标 */
+static int index_for(int h, int bulk_count);
+/* 根据桶的下标获取桶 */
+static H_bulk* get_bulk(shm_map_t *map, int idx);
+/* key的hash值，作为指纹保存在entry中 */
+static int key_hash(shm_map_t *map, const char *k, int k_len);
+static int open_backend(shm_map_t *map, const char *path, size_t size, int flags, bool *is_inited_p);
+static bool map_wait_init(shm_map_t *map);
+static void* get_shm(shm_map_t *map, const char *path, size_t *size_p, int flags);
+static shm_map_t* map_open(int capacity, size_t mem_size, const char *dat_file_path, int fd, shmmap_log log, int flags);
+static void shm_prefault(shm_map_t *map, void *p, size_t size, size_t step);
+static void* prefault_worker(void *arg);
+static H_lock_stripe* stripe_lock(shm_map_t *map, int h);
+static unsigned int seq_read_begin(shm_map_t *map, const unsigned int *seq_p, int h);
+static void stripe_recover(void *arg);
+static void map_grow(shm_map_t *map, int size, int stripe_size);
+static void split_recover(void *arg);
+static void split_redo(shm_map_t *map);
+static bool bulk_has_entry(shm_map_t *map, H_bulk *hdr, m_off_t offset);
+static int stripe_index(shm_map_t *map, int h);
+static void intent_begin(shm_map_t *map, int intent, int h);
+static uint64_t proc_start_time(int pid);
+static bool writer_alive(int pid, uint64_t start);
+static void intent_end(shm_map_t *map);
+static bool map_recover(shm_map_t *map);
+static bool segments_init(shm_map_t *map, size_t mem_size);
+static long futex(unsigned int *addr, int op, unsigned int val, const struct timespec *timeout);
+static int build_part(H_build_ctx *ctx, int h);
+static bool build_run(H_build_ctx *ctx, void *(*fn)(void *));
+static void* build_hash(void *arg);
+static void* build_scatter(void *arg);
+static void* build_link(void *arg);
+static bool build_swiss(H_build_ctx *ctx);
+static void build_free(H_build_ctx *ctx);
+static bool build_publish(shm_map_t *map, const char *build_path, const char *path);
+static bool swiss_put(shm_map_t *map, int h, const char *k, int k_len, const char *v, int v_len, int *size_p, char **old_p);
+static H_entry* swiss_get_entry(shm_map_t *map, int h, const char *k, int k_len);
+static int swiss_entry_slot(shm_map_t *map, int h, m_off_t offset);
+static int swiss_copy_value(shm_map_t *map, int h, const char *k, int k_len, char *buf, int buf_len);
+static void swiss_init(shm_map_t *map, void *p, bool is_inited);
+static bool entry_value_inline(shm_map_t *map, H_entry *t, m_off_t value_offset);
+static bool entry_scan(shm_map_t *map, H_entry *t, shm_map_kv *kv);
+static int key_cmp(const char *a, int a_len, const char *b, int b_len);
+static H_order_node* order_node_new(shm_map_t *map, int level, const char *k, int k_len);
+static H_order_node* order_seek(shm_map_t *map, const char *k, int k_len, bool after, H_order_node **update);
+static int order_random_level(shm_map_t *map);
+static int order_insert(shm_map_t *map, const char *k, int k_len, H_order_node **node_p);
+static void order_remove(shm_map_t *map, const char *k, int k_len);
+static void order_set_entry(shm_map_t *map, H_entry *t);
+static void order_move(shm_map_t *map, H_entry *entry);
+static bool order_rebuild(shm_map_t *map);
+static int order_collect(shm_map_t *map, H_order_node *node, const char *hi, int hi_len, bool prefix, shm_map_kv *kvs, int n);
+/* 有序索引节点中的key */
+static inline char*
+order_key(H_order_node *node){
+	return (char *)(node->next + node->level);
+}
+static int bulk_scan(shm_map_t *map, int idx, int skip, shm_map_kv *kvs, int room, bool *more_p);
+static bool swiss_scan(shm_map_t *map, int slot_idx, shm_map_kv *kv);
+/* m_alloc分配的块的头部 */
+static inline M_block_hdr*
+block_hdr(void *p){
+	return (M_block_hdr *)((char *)p - BLOCK_HEADER_SIZE);
+}
+static bool entry_key_equal(shm_map_t *map, H_entry *t, const char *k, int k_len);
+/* 缓存模式下entry之后的过期时间 */
+static inline unsigned int*
+entry_expire(H_entry *t){
+	return (unsigned int *)((char *)t + ENTRY_HEADER_SIZE);
+}
+/* entry之后、key之前的字节数 */
+static inline int
+entry_meta_size(shm_map_t *map){
+	return (map->flags & SHM_MAP_CACHE) ? (int)sizeof(unsigned int) : 0;
+}
+/* 缓存模式下t是否已经过期，过期的key对读者不可见 */
+static inline bool
+entry_expired(shm_map_t *map, H_entry *t){
+	unsigned int expire;
+
+	if(!(map->flags & SHM_MAP_CACHE))
+		return false;
+	expire = shm_load_relaxed(entry_expire(t));
+	return expire != 0 && expire <= (unsigned int)time(NULL);
+}
+/* 读者命中t：过期时返回false，否则设置t所在的桶或slot的访问位，已经置位时不写，避免cache line在进程间来回传递 */
+static inline bool
+cache_hit(shm_map_t *map, H_entry *t, unsigned int *access_p){
+	if(!(map->flags & SHM_MAP_CACHE))
+		return true;
+	if(entry_expired(map, t))
+		return false;
+	if(shm_load_relaxed(access_p) == 0)
+		shm_store_relaxed(access_p, 1);
+	return true;
 }
+static void entry_lens(shm_map_t *map, int k_len, int v_len, int *entry_len_p, int *value_len_p);
+static H_entry* entry_alloc(shm_map_t *map, int k_len, int v_len);
+static void entry_fill(shm_map_t *map, H_entry *entry, int h, const char *k, int k_len, const char *v, int v_len);
+static int swiss_free_slot(shm_map_t *map, int h);
+static void swiss_set_slot(shm_map_t *map, int slot_idx, int h, H_entry *t);
+static char* entry_value(shm_map_t *map, H_entry *t, int *v_len_p);
+static bool swiss_remove(shm_map_t *map, int h, const char *k, int k_len, const char *v, int v_len, int *size_p);
+static void swiss_purge(shm_map_t *map);
+static H_entry* map_get_entry(shm_map_t *map, int h, const char *k, int k_len);
+static bool map_put_entry(shm_map_t *map, int h, const char *k, int k_len, const char *v, int v_len, char **old_p);
+static bool map_put_index(shm_map_t *map, int h, const char *k, int k_len, const char *v, int v_len, char **old_p);
+static bool map_remove_entry(shm_map_t *map, const char *k, int k_len, const char *v, int v_len);
+static int cache_sweep(shm_map_t *map, int budget, bool evict, int entry_len, int value_len);
+static bool cache_victim_fits(shm_map_t *map, H_entry *t, int entry_len, int value_len);
+static bool cache_evict(shm_map_t *map, H_entry *t);
+static void cache_make_room(shm_map_t *map, int n, int entry_len, int value_len);
+static void value_compact(shm_map_t *map, H_entry *t, m_off_t limit, unsigned int *seq_p);
+static H_entry* entry_compact(shm_map_t *map, H_entry *t, m_off_t limit);
+static void bulk_compact(shm_map_t *map, int idx, m_off_t limit);
+static void swiss_compact(shm_map_t *map, int slot_idx, m_off_t limit);
+static void batch_prefetch(shm_map_t *map, int h, int level);
+static void map_notify(shm_map_t *map);
+static void log_append(shm_map_t *map, int op, const void *k, size_t k_len);
+static void log_copy_in(H_change_info *change, char *ring, uint64_t pos, const void *src, size_t len);
+static void log_copy_out(H_change_info *change, const char *ring, uint64_t pos, void *dst, size_t len);
+
 
 static int
-hash_code(const char *str){
-	int h = 0;
-	const char *p = str;
-	while(*p != 0){
-		h = 31*h + (int)*p ++;
+key_hash(shm_map_t *map, const char *k, int k_len){
+	uint64_t h;
+
+	h = shm_hash64(k, k_len, map->seed);
+	return (int)(h ^ (h >> 32));
+}
+
+/* 创建数据文件时生成hash种子 */
+static uint64_t
+gen_seed(){
+	uint64_t 	seed = 0;
+	int 		fd;
+
+	fd = open("/dev/urandom", O_RDONLY);
+	if(fd != -1){
+		if(read(fd, &seed, sizeof(seed)) != sizeof(seed))
+			seed = 0;
+		close(fd);
 	}
-	return h;
+	if(seed == 0)
+		seed = shm_hash_mix((uint64_t)time(NULL) ^ SHM_HASH_P2, (uint64_t)getpid() ^ SHM_HASH_P3);
+	return seed;
+}
+
+/*
+ * 线性哈希：桶的个数为bulk_count时，h对应的桶
+ * round为不大于bulk_count的最大的2的幂，下标小于bulk_count-round的桶已经分裂，需要多用一位hash值
+ */
+static int
+index_for(int h, int bulk_count){
+	int round = 1 << (31 - __builtin_clz(bulk_count));
+	int idx = h & (round - 1);
+	if(idx < bulk_count - round)
+		idx = h & ((round << 1) - 1);
+	return idx;
+}
+
+static H_bulk*
+get_bulk(shm_map_t *map, int idx){
+	m_off_t seg_offset;
+
+	if(idx < map->bulk_list_len)
+		return &map->bulk_list[idx];
+	idx -= map->bulk_list_len;
+	seg_offset = shm_load_acquire(&map->segments[idx / MAP_SEGMENT_LEN]);
+	return (H_bulk *)get_ptr(map->pool, seg_offset) + idx % MAP_SEGMENT_LEN;
+}
+
+/* 索引占用的字节数，swiss table的slot需要对齐到8字节 */
+static size_t
+index_size(int bulk_list_len, int flags){
+	if(flags & SHM_MAP_SWISS_INDEX)
+		return bulk_list_len + sizeof(int) * (bulk_list_len / MAP_GROUP_SLOTS)
+			+ sizeof(m_off_t) + sizeof(H_slot) * (size_t)bulk_list_len;
+	return sizeof(H_bulk) * (size_t)bulk_list_len;
+}
+
+/*
+ * 计算文件头部各部分的偏移量，打开map和替换旧文件的shm_map_build都用它定位，
+ * 头部的结构见map_open中的注释
+ */
+static void
+map_layout(int bulk_list_len, int flags, H_map_layout *layout){
+	layout->index = sizeof(H_file_header) + INT_SIZE * 4;
+	layout->stripes = (layout->index + index_size(bulk_list_len, flags) + CACHE_LINE_SIZE - 1) & ~(size_t)(CACHE_LINE_SIZE - 1);
+	layout->change = layout->stripes + sizeof(H_lock_stripe) * MAP_LOCK_STRIPES;
+	layout->grow = layout->change + sizeof(H_change_info);
+	layout->order = layout->grow + sizeof(H_grow_info);
+	layout->pool = (layout->order + sizeof(H_order_info) + INT_SIZE + 7) & ~(size_t)7;
+}
+
+static void
+init_bulk(H_bulk *hdr){
+	hdr->header_offset = NIL;
+	hdr->tail_offset = NIL;
+	hdr->size = 0;
+	hdr->seq = 0;
+	hdr->access = 0;
 }
 
+/*
+ * 打开共享内存的后端，返回文件描述符
+ * SHM_MAP_MEMFD: 创建新的memfd，path只作为名字，总是需要初始化
+ * SHM_MAP_POSIX_SHM: path是shm_open的名字，对象在tmpfs上，不会回写磁盘
+ * 否则path是普通文件
+ * size: 共享内存的大小
+ * is_inited_p: 返回是否打开了已经存在的数据
+ */
 static int
-index_for(int h){
-	return h & (map_bulk_list_len - 1);
+open_backend(shm_map_t *map, const char *path, size_t size, int flags, bool *is_inited_p){
+	int fd = -1;
+	struct statfs fs;
+
+	*is_inited_p = false;
+	if(flags & SHM_MAP_MEMFD){
+		// 请求大页时先尝试hugetlb的memfd，预留的大页不够时退回普通的memfd
+		if(flags & SHM_MAP_HUGE_PAGES){
+			fd = memfd_create(path, MFD_CLOEXEC | MFD_HUGETLB);
+			if(fd != -1 && (fstatfs(fd, &fs) == -1
+					|| fallocate(fd, 0, 0, (size + fs.f_bsize - 1) & ~((size_t)fs.f_bsize - 1)) == -1)){
+				map->log(SHMMAP_LOG_WARN, "[open_backend]Not enough huge pages for memfd, use normal pages. msg: %s", strerror(errno));
+				close(fd);
+				fd = -1;
+			}
+		}
+		if(fd == -1)
+			fd = memfd_create(path, MFD_CLOEXEC);
+	}else if(flags & SHM_MAP_POSIX_SHM){
+		// O_EXCL区分创建和打开，不会有两个进程都认为自己创建了对象
+		fd = shm_open(path, O_RDWR | O_CREAT | O_EXCL, FILE_MODE);
+		if(fd == -1 && errno == EEXIST){
+			fd = shm_open(path, O_RDWR, FILE_MODE);
+			*is_inited_p = true;
+		}
+	}else{
+		fd = open(path, O_RDWR | O_CREAT | O_EXCL, FILE_MODE);
+		if(fd == -1 && errno == EEXIST){
+			fd = open(path, O_RDWR, FILE_MODE);
+			*is_inited_p = true;
+		}
+	}
+	// 创建者在初始化完成之前持有flock，同时打开的进程由map_wait_init等待
+	if(fd != -1 && !*is_inited_p)
+		flock(fd, LOCK_EX);
+	if(fd == -1){
+		map->log(SHMMAP_LOG_ERROR, "[open_backend]Open data file error. msg: %s, path: %s",
+			strerror(errno), path);
+	}
+	return fd;
 }
 
 /*
- * 获取共享内存
- * file: 用于mmap的文件
- * size: 申请共享内存的大小
+ * 等待创建数据文件的进程完成初始化，返回文件是否已经初始化
+ * 创建者从创建文件到写入魔数一直持有flock，加锁之后才扩展文件。拿到锁时没有魔数、文件为空，
+ * 可能是创建者还没来得及加锁，稍后重试；文件不为空，或者一直为空，是创建者在初始化时退出了，
+ * 这时持有锁返回false，由当前进程重新初始化。版本0的文件开头是桶数，不为0
+ */
+static bool
+map_wait_init(shm_map_t *map){
+	struct stat 	st;
+	int 			i, magic;
+
+	for(i=0; i<MAP_INIT_WAITS; i++){
+		if(flock(map->fd, LOCK_EX) != 0)
+			return true;
+		if(pread(map->fd, &magic, sizeof(magic), 0) == sizeof(magic) && magic != 0){
+			flock(map->fd, LOCK_UN);
+			return true;
+		}
+		if(fstat(map->fd, &st) == 0 && st.st_size > 0)
+			break;
+		flock(map->fd, LOCK_UN);
+		usleep(1000);
+	}
+	if(i == MAP_INIT_WAITS && flock(map->fd, LOCK_EX) != 0)
+		return true;
+	map->log(SHMMAP_LOG_WARN, "[map_init]The process creating the data file exited before initializing it, initialize it again");
+	return false;
+}
+
+/*
+ * 映射map->fd
+ * path: 数据文件的路径或名字，用于日志
+ * size_p: 申请共享内存的大小，在hugetlbfs上时向上对齐到大页
+ * flags: SHM_MAP_HUGE_PAGES、SHM_MAP_POPULATE、SHM_MAP_PREFAULT的组合
  */
 static void*
-get_shm(const char *file, int size){
-	int fd;
+get_shm(shm_map_t *map, const char *path, size_t *size_p, int flags){
+	int mmap_flags;
 	void *idx_ptr;
-	struct stat buf;
+	struct statfs fs;
+	bool is_hugetlbfs;
+	size_t size = *size_p, step = (size_t)sysconf(_SC_PAGESIZE);
 
-	fd = open(file, O_RDWR | O_CREAT, FILE_MODE);
-	if(fd == -1){
-		shm_map_log(SHMMAP_LOG_ERROR, "[get_shm]Open data file error. msg: %s, path: %s",
-			strerror(errno), file);
+	// hugetlbfs上的文件只能按大页映射，f_bsize是大页的大小
+	is_hugetlbfs = fstatfs(map->fd, &fs) == 0 && fs.f_type == MAP_HUGETLBFS_MAGIC;
+	if(is_hugetlbfs){
+		step = (size_t)fs.f_bsize;
+		size = (size + step - 1) & ~(step - 1);
+		*size_p = size;
+	}
+
+	// 预先分配文件的所有块(tmpfs、hugetlbfs上是所有页)，空间不足时在这里报错，而不是之后写入时收到SIGBUS
+	if(fallocate(map->fd, 0, 0, size) == -1){
+		if(errno != EOPNOTSUPP){
+			map->log(SHMMAP_LOG_ERROR, "[get_shm]Allocate space for data file error. msg: %s, path: %s",
+				strerror(errno), path);
+			return NULL;
+		}
+		map->log(SHMMAP_LOG_WARN, "[get_shm]The file system doesn't support fallocate, the space is not reserved. path: %s", path);
+		if(ftruncate(map->fd, size) == -1){
+			map->log(SHMMAP_LOG_ERROR, "[get_shm]Extend data file error. msg: %s, path: %s",
+				strerror(errno), path);
+			return NULL;
+		}
+	}
+	mmap_flags = MAP_SHARED;
+	if(flags & SHM_MAP_POPULATE)
+		mmap_flags |= MAP_POPULATE;
+	idx_ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, mmap_flags, map->fd, 0);
+	if(idx_ptr == MAP_FAILED){
+		map->log(SHMMAP_LOG_ERROR, "[get_shm]Map data file error. msg: %s, path: %s", strerror(errno), path);
 		return NULL;
 	}
 
-	// 修正文件的长度
-	fstat(fd, &buf);
-	if((int)buf.st_size < size){
-		lseek(fd, size, SEEK_SET);
-		write(fd, " ", 1);
+	if((flags & SHM_MAP_HUGE_PAGES) && !is_hugetlbfs && madvise(idx_ptr, size, MADV_HUGEPAGE) == -1){
+		map->log(SHMMAP_LOG_WARN, "[get_shm]Transparent huge pages are not available for the data file. msg: %s, path: %s",
+			strerror(errno), path);
 	}
-	idx_ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-	close(fd);
+	if(flags & SHM_MAP_PREFAULT)
+		shm_prefault(map, idx_ptr, size, step);
 	return idx_ptr;
 }
 
+static void*
+prefault_worker(void *arg){
+	H_prefault_arg 	*a = (H_prefault_arg *)arg;
+	size_t 			i;
+
+#ifdef MADV_POPULATE_READ
+	// 一次系统调用建立所有页表项，内核不支持时逐页读
+	if(madvise(a->p, a->len, MADV_POPULATE_READ) == 0)
+		return NULL;
+#endif
+	for(i=0; i<a->len; i+=a->step)
+		(void)*(volatile char *)(a->p + i);
+	return NULL;
+}
+
+/*
+ * 用多个线程并行地读入[p, p+size)中的页，每个线程负责连续的一段。
+ * 只读不写，不会和其他进程的写冲突，也不会把页标记为脏页。
+ */
+static void
+shm_prefault(shm_map_t *map, void *p, size_t size, size_t step){
+	H_prefault_arg 	args[MAP_PREFAULT_THREADS];
+	pthread_t 		tids[MAP_PREFAULT_THREADS];
+	bool 			started[MAP_PREFAULT_THREADS];
+	long 			cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t 			chunk, off = 0;
+	int 			i, n;
+
+	n = (int)(size / MAP_PREFAULT_MIN_CHUNK);
+	if(n > cpus)
+		n = (int)cpus;
+	if(n > MAP_PREFAULT_THREADS)
+		n = MAP_PREFAULT_THREADS;
+	if(n < 1)
+		n = 1;
+	// 每段按step对齐，段的边界不会落在一个大页中间
+	chunk = ((size / n) + step - 1) & ~(step - 1);
+	for(i=0; i<n; i++){
+		args[i].p = (char *)p + off;
+		args[i].len = off + chunk < size ? chunk : size - off;
+		args[i].step = step;
+		off += args[i].len;
+		// 最后一段由当前线程负责，创建线程失败时也由当前线程完成
+		started[i] = i < n - 1 && pthread_create(&tids[i], NULL, prefault_worker, &args[i]) == 0;
+		if(!started[i])
+			prefault_worker(&args[i]);
+	}
+	for(i=0; i<n; i++){
+		if(started[i])
+			pthread_join(tids[i], NULL);
+	}
+	map->log(SHMMAP_LOG_DEBUG, "[shm_prefault]Prefaulted %lld bytes with %d threads", (long long)size, n);
+}
+
 static H_entry*
-next_entry(H_entry *entry){
-	if(entry != NULL && entry->next_offset != NIL)
-		return (H_entry *)get_ptr(entry->next_offset);
+next_entry(shm_map_t *map, H_entry *entry){
+	m_off_t next_offset;
+	if(entry != NULL && (next_offset = shm_load_acquire(&entry->next_offset)) != NIL)
+		return (H_entry *)get_ptr(map->pool, next_offset);
 	return NULL;
 }
 
-bool
-map_init(int capacity, int mem_size, const char *dat_file_path, shmmap_log log){
-	int 	i;
-	void 	*p, *mem;
-	bool 	is_inited;
-	int		*int_ptr;
+shm_map_t*
+shm_map_open(int capacity, size_t mem_size, const char *dat_file_path, shmmap_log log, int flags){
+	return map_open(capacity, mem_size, dat_file_path, -1, log, flags);
+}
+
+shm_map_t*
+shm_map_open_fd(int fd, int capacity, size_t mem_size, shmmap_log log, int flags){
+	return map_open(capacity, mem_size, "(fd)", fd, log, flags & ~(SHM_MAP_MEMFD | SHM_MAP_POSIX_SHM));
+}
+
+/*
+ * 打开map
+ * fd: 为-1时按flags打开dat_file_path，否则直接映射fd，文件不为空时认为已经初始化
+ */
+static shm_map_t*
+map_open(int capacity, size_t mem_size, const char *dat_file_path, int fd, shmmap_log log, int flags){
+	shm_map_t 	*map;
+	int 		i, pool_flags;
+	void 		*p, *mem;
+	bool 		is_inited;
+	H_file_header *file_header;
+	H_map_layout layout;
+	int			*int_ptr;
+	struct stat st;
 
-	shm_map_log = log;
-	if(shm_map_log == NULL){
-		shm_map_log = default_shmmap_log;
+	if(log == NULL){
+		log = default_shmmap_log;
 	}
 
 	if(capacity <= 0){
-		shm_map_log(SHMMAP_LOG_ERROR, "[map_init]The capacity of map must be greater than 0");
-		return false;
+		log(SHMMAP_LOG_ERROR, "[map_init]The capacity of map must be greater than 0");
+		if(fd != -1)
+			close(fd);
+		return NULL;
 	}
 	if(capacity > MAX_CAPACITY)
 		capacity = MAX_CAPACITY;
-	map_bulk_list_len = 1;
-	while(map_bulk_list_len < capacity)
-		map_bulk_list_len = map_bulk_list_len << 1;
+	if((flags & SHM_MAP_SWISS_INDEX) && (flags & SHM_MAP_GROWABLE)){
+		log(SHMMAP_LOG_ERROR, "[map_init]The swiss index can't grow, SHM_MAP_SWISS_INDEX and SHM_MAP_GROWABLE are exclusive");
+		if(fd != -1)
+			close(fd);
+		return NULL;
+	}
+	if((flags & SHM_MAP_CHANGE_LOG) && (flags & SHM_MAP_MULTI_WRITER)){
+		log(SHMMAP_LOG_ERROR, "[map_init]The change log has a single producer, SHM_MAP_CHANGE_LOG and SHM_MAP_MULTI_WRITER are exclusive");
+		if(fd != -1)
+			close(fd);
+		return NULL;
+	}
+	if((flags & SHM_MAP_CACHE) && (flags & SHM_MAP_MULTI_WRITER)){
+		log(SHMMAP_LOG_ERROR, "[map_init]Keys are evicted by one writer, SHM_MAP_CACHE and SHM_MAP_MULTI_WRITER are exclusive");
+		if(fd != -1)
+			close(fd);
+		return NULL;
+	}
+	if((flags & SHM_MAP_ORDERED_INDEX) && (flags & SHM_MAP_MULTI_WRITER)){
+		log(SHMMAP_LOG_ERROR, "[map_init]The ordered index is updated by one writer, SHM_MAP_ORDERED_INDEX and SHM_MAP_MULTI_WRITER are exclusive");
+		if(fd != -1)
+			close(fd);
+		return NULL;
+	}
+	map = (shm_map_t *)calloc(1, sizeof(shm_map_t));
+	if(map == NULL){
+		log(SHMMAP_LOG_ERROR, "[map_init]Can't allocate memory for map");
+		if(fd != -1)
+			close(fd);
+		return NULL;
+	}
+	map->log = log;
+	map->fd = fd;
+	map->bulk_list_len = 1;
+	while(map->bulk_list_len < capacity)
+		map->bulk_list_len = map->bulk_list_len << 1;
+	// swiss table的slot最多占满7/8，每组MAP_GROUP_SLOTS个slot
+	if(flags & SHM_MAP_SWISS_INDEX){
+		if(MAP_SWISS_MAX_LOAD(map->bulk_list_len) < capacity)
+			map->bulk_list_len <<= 1;
+		if(map->bulk_list_len < MAP_GROUP_SLOTS)
+			map->bulk_list_len = MAP_GROUP_SLOTS;
+	}
 
 	if(dat_file_path == NULL){
 		dat_file_path = DATA_FILE;
 	}
-	is_inited = false;
-	if(access(dat_file_path, F_OK) == 0){
-		is_inited = true;
+	map_layout(map->bulk_list_len, flags, &layout);
+	map->shm_size = layout.pool + mem_size;
+	if(fd == -1){
+		map->fd = open_backend(map, dat_file_path, map->shm_size, flags, &is_inited);
+		if(map->fd == -1){
+			free(map);
+			return NULL;
+		}
+		if(is_inited)
+			is_inited = map_wait_init(map);
+	}else{
+		is_inited = fstat(fd, &st) == 0 && st.st_size > 0;
 	}
 
-	p = get_shm(dat_file_path, INT_SIZE * 5 + sizeof(H_bulk) * map_bulk_list_len + mem_size);
-	int_ptr = (int *)p;
+	p = get_shm(map, dat_file_path, &map->shm_size, flags);
+	if(p == NULL){
+		shm_map_close(map);
+		return NULL;
+	}
+	map->shm = p;
 	/**
 	 * 索引文件头部：
+	 * File header		(sizeof(H_file_header))
 	 * Bulk list len 	(4bytes)
-	 * padding			(4bytes)
+	 * Flags			(4bytes)
 	 * Map size			(4bytes)
 	 * padding			(4bytes)
 	 * Bulk list		(BULK_SIZE * bulk_list_len bytes)
-	 * padding			(4bytes)
+	 *   或者swiss table: 控制字节(bulk_list_len bytes)、每组的seq、slot(sizeof(H_slot) * bulk_list_len)
+	 * padding			(对齐到CACHE_LINE_SIZE)
+	 * Lock stripes		(sizeof(H_lock_stripe) * MAP_LOCK_STRIPES)
+	 * Change info		(sizeof(H_change_info))，独占cache line
+	 * Grow info		(sizeof(H_grow_info))
+	 * Order info		(sizeof(H_order_info))
+	 * padding			(4bytes，内存池的起始地址对齐到8字节)
 	 */
+	file_header = (H_file_header *)p;
+	// 魔数在初始化完成之后才写入
+	if(!is_inited){
+		file_header->magic = 0;
+		file_header->version = MAP_FORMAT_VERSION;
+		file_header->seed = gen_seed();
+	}
+	// 版本3把偏移量改成了64位，版本4改变了内存池的结构，之前的文件需要重建
+	map->version = !is_inited || file_header->magic == MAP_MAGIC ? file_header->version : 0;
+	if(map->version != MAP_FORMAT_VERSION){
+		map->log(SHMMAP_LOG_ERROR, "[map_init]The version(%d) of data file is not %d, can't open it, path: %s",
+			map->version, MAP_FORMAT_VERSION, dat_file_path);
+		shm_map_close(map);
+		return NULL;
+	}
+	map->seed = file_header->seed;
+	int_ptr = (int *)(file_header + 1);
 	if(is_inited){
 		// 已经有数据文件时，直接load
-		map_bulk_list_len = *int_ptr++;
-		padding(int_ptr++);
-		_map_size = int_ptr++;
+		map->bulk_list_len = *int_ptr++;
+		if(*int_ptr != (flags & SHM_MAP_FILE_FLAGS)){
+			map->log(SHMMAP_LOG_WARN, "[map_init]The flags(%d) of the existing data file is different from %d, use the former",
+				*int_ptr, flags & SHM_MAP_FILE_FLAGS);
+		}
+		map->flags = *int_ptr++;
+		map->size = int_ptr++;
 		padding(int_ptr++);
-		map_bulk_list = (H_bulk *)int_ptr;
+		map->bulk_list = (H_bulk *)int_ptr;
+		if(map->flags & SHM_MAP_SWISS_INDEX)
+			swiss_init(map, int_ptr, is_inited);
 	}else{
-		*int_ptr++ = map_bulk_list_len;
-		padding(int_ptr++);
-		_map_size = int_ptr++;
-		*_map_size = 0;
+		*int_ptr++ = map->bulk_list_len;
+		map->flags = *int_ptr++ = flags & SHM_MAP_FILE_FLAGS;
+		map->size = int_ptr++;
+		*map->size = 0;
 		padding(int_ptr++);
-		map_bulk_list = (H_bulk *)int_ptr;
-		// 初始化所有桶
-		for(i=0; i<map_bulk_list_len; i++){
-			(map_bulk_list+i)->header_offset = NIL;
-			(map_bulk_list+i)->tail_offset = NIL;
-			(map_bulk_list+i)->size = 0;
+		map->bulk_list = (H_bulk *)int_ptr;
+		if(map->flags & SHM_MAP_SWISS_INDEX){
+			swiss_init(map, int_ptr, is_inited);
+		}else{
+			// 初始化所有桶
+			for(i=0; i<map->bulk_list_len; i++){
+				init_bulk(map->bulk_list+i);
+			}
 		}
 	}
-	p = (char *)int_ptr + sizeof(H_bulk) * map_bulk_list_len;
+	// 已经有数据文件时按文件中的桶数和flags计算
+	map_layout(map->bulk_list_len, map->flags, &layout);
+	map->lock_stripes = (H_lock_stripe *)((char *)map->shm + layout.stripes);
+	map->lock_stripe_len = map->bulk_list_len < MAP_LOCK_STRIPES ? map->bulk_list_len : MAP_LOCK_STRIPES;
+	// swiss table中key的位置不固定，所有写者共用第一个分段的锁
+	if(map->flags & SHM_MAP_SWISS_INDEX)
+		map->lock_stripe_len = 1;
+	for(map->lock_stripe_shift=0; (map->bulk_list_len >> map->lock_stripe_shift) > map->lock_stripe_len; map->lock_stripe_shift++);
+	map->change = (H_change_info *)((char *)map->shm + layout.change);
+	map->grow_info = (H_grow_info *)((char *)map->shm + layout.grow);
+	map->order = (H_order_info *)((char *)map->shm + layout.order);
+	if(!is_inited){
+		map->change->version = 0;
+		map->change->waiters = 0;
+		map->change->intent = MAP_INTENT_NONE;
+		map->change->intent_pid = 0;
+		map->change->intent_start = 0;
+		map->change->generation = 0;
+		map->change->superseded = 0;
+		map->grow_info->bulk_count = map->bulk_list_len;
+		map->grow_info->split_to = NIL;
+		map->grow_info->split_entry = NIL;
+		map->grow_info->segments = NIL;
+		map->grow_info->segment_max = 0;
+		map->order->head = NIL;
+		map->order->level = 0;
+	}
+	p = (char *)(map->order + 1);
 	padding(p);
-	mem = (char *)p + INT_SIZE;
-	if(!m_init((char*)mem, mem_size, log, is_inited)){
-		shm_map_log(SHMMAP_LOG_ERROR, "[map_init]Memory pool init error");
+	mem = (char *)map->shm + layout.pool;
+	map->pool_offset = (char *)mem - (char *)map->shm;
+	map->pid = getpid();
+	map->pid_start = proc_start_time(map->pid);
+	// memfd、描述符不能按路径重新打开
+	if(fd == -1 && !(flags & SHM_MAP_MEMFD)){
+		map->path = strdup(dat_file_path);
+		map->capacity = capacity;
+		map->mem_size = mem_size;
+		map->open_flags = flags;
+	}
+	// 重启后第一次查找前先异步读入索引，查找不用逐页等待缺页
+	if(is_inited && !(flags & (SHM_MAP_POPULATE | SHM_MAP_PREFAULT)))
+		madvise(map->shm, (char *)mem - (char *)map->shm, MADV_WILLNEED);
+	pool_flags = 0;
+	if(map->flags & SHM_MAP_MULTI_WRITER)
+		pool_flags |= M_POOL_MULTI_WRITER;
+	if(map->flags & SHM_MAP_LOCKFREE_POOL)
+		pool_flags |= M_POOL_LOCKFREE;
+	if(map->flags & SHM_MAP_CACHE)
+		pool_flags |= M_POOL_QUIET_FULL;
+	map->pool = m_init((char*)mem, mem_size, log, is_inited, pool_flags);
+	if(map->pool == NULL){
+		map->log(SHMMAP_LOG_ERROR, "[map_init]Memory pool init error");
+		shm_map_close(map);
+		return NULL;
+	}
+	if(!is_inited && (map->flags & SHM_MAP_MULTI_WRITER)){
+		for(i=0; i<map->lock_stripe_len; i++){
+			if(!m_mutex_init(map->pool, &map->lock_stripes[i].mutex)){
+				shm_map_close(map);
+				return NULL;
+			}
+			map->lock_stripes[i].size = 0;
+		}
+		if(!m_mutex_init(map->pool, &map->grow_info->split_mutex)){
+			shm_map_close(map);
+			return NULL;
+		}
+	}
+	if(!is_inited){
+		map->change->log_head = map->change->log_reserve = 0;
+		map->change->log_offset = NIL;
+		map->change->log_size = 0;
+		if(map->flags & SHM_MAP_CHANGE_LOG){
+			p = m_alloc(map->pool, MAP_LOG_SIZE);
+			if(p == NULL){
+				map->log(SHMMAP_LOG_ERROR, "[map_init]Can't allocate %d bytes for the change log", MAP_LOG_SIZE);
+				shm_map_close(map);
+				return NULL;
+			}
+			map->change->log_offset = ptr_offset(map->pool, p);
+			map->change->log_size = MAP_LOG_SIZE;
+		}
+	}
+	if(!is_inited && (map->flags & SHM_MAP_GROWABLE) && !segments_init(map, mem_size)){
+		shm_map_close(map);
+		return NULL;
+	}
+	if(map->grow_info->segments != NIL)
+		map->segments = (m_off_t *)get_ptr(map->pool, map->grow_info->segments);
+	if(map->flags & SHM_MAP_ORDERED_INDEX){
+		map->order_rand = gen_seed() | 1;
+		if(!is_inited){
+			p = order_node_new(map, MAP_ORDER_MAX_LEVEL, NULL, 0);
+			if(p == NULL){
+				shm_map_close(map);
+				return NULL;
+			}
+			map->order->head = ptr_offset(map->pool, p);
+		}
+	}
+	if(!is_inited){
+		shm_store_release(&file_header->magic, MAP_MAGIC);
+		flock(map->fd, LOCK_UN);
+	}
+	if(is_inited && !map_recover(map)){
+		shm_map_close(map);
+		return NULL;
+	}
+	return map;
+}
+
+void
+shm_map_close(shm_map_t *map){
+	if(map == NULL)
+		return;
+	if(map->pool != NULL)
+		m_destroy(map->pool);
+	if(map->shm != NULL)
+		munmap(map->shm, map->shm_size);
+	if(map->fd != -1)
+		close(map->fd);
+	if(map == default_map)
+		default_map = NULL;
+	free(map->path);
+	free(map);
+}
+
+M_pool*
+shm_map_pool(shm_map_t *map){
+	return map->pool;
+}
+
+bool
+shm_map_send_fd(shm_map_t *map, int sock){
+	struct msghdr 	msg;
+	struct cmsghdr 	*cmsg;
+	struct iovec 	iov;
+	char 			byte = 0;
+	union {
+		char buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} ctrl;
+
+	// 至少发送一个字节的普通数据，描述符通过SCM_RIGHTS附带
+	memset(&msg, 0, sizeof(msg));
+	memset(&ctrl, 0, sizeof(ctrl));
+	iov.iov_base = &byte;
+	iov.iov_len = 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctrl.buf;
+	msg.msg_controllen = sizeof(ctrl.buf);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &map->fd, sizeof(int));
+	if(sendmsg(sock, &msg, MSG_NOSIGNAL) != 1){
+		map->log(SHMMAP_LOG_ERROR, "[shm_map_send_fd]Send fd error. msg: %s", strerror(errno));
 		return false;
 	}
 	return true;
 }
 
-char*
-map_put(const char *k, const char *v){
+int
+shm_map_recv_fd(int sock, shmmap_log log){
+	struct msghdr 	msg;
+	struct cmsghdr 	*cmsg;
+	struct iovec 	iov;
+	char 			byte;
+	int 			fd;
+	union {
+		char buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} ctrl;
+
+	if(log == NULL){
+		log = default_shmmap_log;
+	}
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = &byte;
+	iov.iov_len = 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctrl.buf;
+	msg.msg_controllen = sizeof(ctrl.buf);
+	if(recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != 1){
+		log(SHMMAP_LOG_ERROR, "[shm_map_recv_fd]Receive fd error. msg: %s", strerror(errno));
+		return -1;
+	}
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if(cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS
+			|| cmsg->cmsg_len != CMSG_LEN(sizeof(int))){
+		log(SHMMAP_LOG_ERROR, "[shm_map_recv_fd]No fd in the received message");
+		return -1;
+	}
+	memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+	return fd;
+}
+
+/* hash值h对应的桶所在的锁分段，swiss table只有一个分段 */
+static int
+stripe_index(shm_map_t *map, int h){
+	if(map->flags & SHM_MAP_SWISS_INDEX)
+		return 0;
+	return (h & (map->bulk_list_len - 1)) >> map->lock_stripe_shift;
+}
+
+/*
+ * 锁住hash值h对应的桶所在的锁分段
+ * 分段按照初始的桶划分，桶i分裂出的桶与i的低位相同，属于同一个分段，
+ * 所以持有分段锁时，h对应的桶不会被其他写者分裂到别的分段中。
+ */
+static H_lock_stripe*
+stripe_lock(shm_map_t *map, int h){
+	H_stripe_arg 	arg;
+
+	arg.map = map;
+	arg.stripe = &map->lock_stripes[stripe_index(map, h)];
+	m_mutex_lock(map->pool, &arg.stripe->mutex, stripe_recover, &arg);
+	return arg.stripe;
+}
+
+/*
+ * 读者等待seq变成偶数
+ * 写者在修改过程中退出时seq一直是奇数。多写者模式下读者尝试获取h所在分段的锁，
+ * 由m_mutex_trylock发现写者已经退出并修复分段；单写者模式下读者检查意图记录中的写者，
+ * 写者已经退出时和打开map时一样进行恢复。
+ */
+static unsigned int
+seq_read_begin(shm_map_t *map, const unsigned int *seq_p, int h){
+	H_stripe_arg 	arg;
+	unsigned int 	seq;
+	int 			spins = 0;
+
+	while((seq = shm_load_acquire(seq_p)) & 1){
+		if(++spins == MAP_SEQ_SPINS){
+			if(map->flags & SHM_MAP_MULTI_WRITER){
+				arg.map = map;
+				arg.stripe = &map->lock_stripes[stripe_index(map, h)];
+				if(m_mutex_trylock(map->pool, &arg.stripe->mutex, stripe_recover, &arg))
+					m_mutex_unlock(&arg.stripe->mutex);
+			}else if(shm_load_acquire(&map->change->intent) != MAP_INTENT_NONE
+					&& !writer_alive(map->change->intent_pid, map->change->intent_start)){
+				map_recover(map);
+			}
+			spins = 0;
+		}
+		shm_cpu_relax();
+	}
+	return seq;
+}
+
+/*
+ * 写者持有分段锁时退出，分段中的桶可能处于修改了一半的状态：
+ * seq为奇数，或者新的entry已经链入但tail、size还没有更新。
+ * 按照链表中实际的节点修复桶，并重新计算分段中key的个数。
+ */
+static void
+stripe_recover(void *arg){
+	shm_map_t 		*map = ((H_stripe_arg *)arg)->map;
+	H_lock_stripe 	*stripe = ((H_stripe_arg *)arg)->stripe;
+	H_bulk 			*hdr;
+	H_entry 		*t;
+	int 			i, j, total = 0;
+	m_off_t 		offset, prev_offset;
+	int64_t 		n, max_entries = m_pool_size(map->pool) / ENTRY_HEADER_SIZE;
+	int 			first = (stripe - map->lock_stripes) << map->lock_stripe_shift;
+	int 			bulk_count = map->grow_info->bulk_count;
+
+	// swiss table的slot在控制字节写入后才可见，只需要修复seq和key的个数
+	if(map->flags & SHM_MAP_SWISS_INDEX){
+		for(i=0; i<map->swiss_group_len; i++){
+			if(map->swiss_seq[i] & 1)
+				shm_seq_write_end(&map->swiss_seq[i]);
+		}
+		for(i=0; i<map->bulk_list_len; i++){
+			if(!(map->swiss_ctrl[i] & MAP_CTRL_EMPTY))
+				total++;
+		}
+		stripe->size = total;
+		return;
+	}
+	// 写者可能在发布新的桶个数之前退出，这时正在分裂出的新桶的seq已经是奇数
+	if(map->grow_info->split_to != NIL && map->grow_info->split_to >= bulk_count)
+		bulk_count = map->grow_info->split_to + 1;
+	// 分段包含初始的桶[first, first + 2^lock_stripe_shift)，以及从它们分裂出的桶
+	for(j=first; j<first+(1<<map->lock_stripe_shift); j++)
+	for(i=j; i<bulk_count; i+=map->bulk_list_len){
+		hdr = get_bulk(map, i);
+		n = 0;
+		prev_offset = NIL;
+		offset = hdr->header_offset;
+		while(offset != NIL && n < max_entries){
+			t = (H_entry *)try_get_ptr(map->pool, offset, ENTRY_HEADER_SIZE);
+			if(t == NULL){
+				if(prev_offset != NIL)
+					((H_entry *)get_ptr(map->pool, prev_offset))->next_offset = NIL;
+				break;
+			}
+			t->prev_offset = prev_offset;
+			prev_offset = offset;
+			offset = t->next_offset;
+			n++;
+		}
+		hdr->tail_offset = prev_offset;
+		if(n == 0)
+			hdr->header_offset = NIL;
+		shm_store_release(&hdr->size, n);
+		if(hdr->seq & 1)
+			shm_seq_write_end(&hdr->seq);
+	}
+	// 分裂的写者持有分段锁，它退出时分段中的分裂还没有完成，读者按照新的桶个数会找不到被分裂的key
+	if(map->grow_info->split_to != NIL && stripe_index(map, map->grow_info->split_to) == stripe - map->lock_stripes)
+		split_redo(map);
+	for(j=first; j<first+(1<<map->lock_stripe_shift); j++)
+	for(i=j; i<bulk_count; i+=map->bulk_list_len)
+		total += get_bulk(map, i)->size;
+	stripe->size = total;
+}
+
+/* 分配value的块，value之后补'\0' */
+static char*
+value_new(shm_map_t *map, const char *v, int v_len){
+	char *val_ptr = (char *)m_alloc(map->pool, v_len + 1);
+
+	if(val_ptr == NULL){
+		// 缓存模式下内存用完是正常的，由map_put_entry淘汰后重试
+		if(!(map->flags & SHM_MAP_CACHE))
+			map->log(SHMMAP_LOG_ERROR, "[value_new]Can't allocate memory for value");
+		return NULL;
+	}
+	memcpy(val_ptr, v, v_len);
+	val_ptr[v_len] = 0;
+	block_hdr(val_ptr)->data_len = v_len + 1;
+	return val_ptr;
+}
+
+/*
+ * 替换entry t的value
+ * seq_p: 保护t的顺序锁
+ * return: 旧的value，被延迟回收；分配内存失败时返回NULL
+ */
+static char*
+entry_set_value(shm_map_t *map, H_entry *t, const char *v, int v_len, unsigned int *seq_p){
+	char 	*val_ptr, *old_val;
+
+	old_val = (char *)get_ptr(map->pool, t->value_offset);
+	val_ptr = value_new(map, v, v_len);
+	if(val_ptr == NULL)
+		return NULL;
+	shm_seq_write_begin(seq_p);
+	shm_store_release(&t->value_offset, ptr_offset(map->pool, val_ptr));
+	if(map->flags & SHM_MAP_CACHE)
+		shm_store_relaxed(entry_expire(t), map->put_expire);
+	// 读者可能还在使用旧的value，延迟回收；entry块内的value随entry释放
+	if(!entry_value_inline(map, t, ptr_offset(map->pool, old_val)))
+		m_retire(map->pool, old_val);
+	shm_seq_write_end(seq_p);
+	return old_val;
+}
+
+
+/* value保存在entry的块中时返回true，这样的value随entry一起释放 */
+static inline bool
+entry_value_inline(shm_map_t *map, H_entry *t, m_off_t value_offset){
+	m_off_t offset = ptr_offset(map->pool, t);
+	return value_offset > offset && value_offset < offset + block_hdr(t)->data_len;
+}
+
+/*
+ * 创建新的entry，entry还没有链入索引
+ * key和短的value拷贝到entry之后，只需要分配一次内存，查找时也只访问一个块
+ */
+static H_entry*
+entry_new(shm_map_t *map, int h, const char *k, int k_len, const char *v, int v_len){
+	H_entry *entry = entry_alloc(map, k_len, v_len);
+
+	if(entry != NULL)
+		entry_fill(map, entry, h, k, k_len, v, v_len);
+	return entry;
+}
+
+/* 写入长度为k_len、v_len的key、value需要的entry块和value块的大小，value保存在entry的块中时value_len_p为0 */
+static void
+entry_lens(shm_map_t *map, int k_len, int v_len, int *entry_len_p, int *value_len_p){
+	bool inline_value = v_len + 1 <= MAP_INLINE_VALUE_MAX;
+
+	*entry_len_p = ENTRY_HEADER_SIZE + entry_meta_size(map) + k_len + 1 + (inline_value ? v_len + 1 : 0);
+	*value_len_p = inline_value ? 0 : v_len + 1;
+}
+
+/*
+ * 分配entry的块，以及长的value的块，value_offset指向value所在的位置
+ * 只有分配需要访问内存池，批量构建时由一个线程分配，多个线程并行地填写内容
+ */
+static H_entry*
+entry_alloc(shm_map_t *map, int k_len, int v_len){
+	H_entry *entry;
+	char 	*val_ptr;
+	int 	entry_len, value_len, key_pos = ENTRY_HEADER_SIZE + entry_meta_size(map);
+	bool 	inline_value;
+
+	entry_lens(map, k_len, v_len, &entry_len, &value_len);
+	inline_value = value_len == 0;
+	entry = (H_entry *)m_alloc(map->pool, entry_len);
+	if(entry == NULL){
+		if(!(map->flags & SHM_MAP_CACHE))
+			map->log(SHMMAP_LOG_ERROR, "[entry_alloc]Can't allocate memory for entry");
+		return NULL;
+	}
+	if(inline_value){
+		val_ptr = (char *)entry + key_pos + k_len + 1;
+	}else{
+		val_ptr = (char *)m_alloc(map->pool, v_len + 1);
+		if(val_ptr == NULL){
+			if(!(map->flags & SHM_MAP_CACHE))
+				map->log(SHMMAP_LOG_ERROR, "[entry_alloc]Can't allocate memory for value");
+			m_free(map->pool, entry);
+			return NULL;
+		}
+		block_hdr(val_ptr)->data_len = v_len + 1;
+	}
+	// data_len记录entry块中实际使用的长度，用来判断value是否在块内
+	block_hdr(entry)->data_len = entry_len;
+	entry->value_offset = ptr_offset(map->pool, val_ptr);
+	return entry;
+}
+
+/* 填写entry_alloc分配的entry，不访问内存池 */
+static void
+entry_fill(shm_map_t *map, H_entry *entry, int h, const char *k, int k_len, const char *v, int v_len){
+	char *key_ptr = (char *)entry + ENTRY_HEADER_SIZE + entry_meta_size(map);
+	char *val_ptr = (char *)get_ptr(map->pool, entry->value_offset);
+
+	memcpy(key_ptr, k, k_len);
+	key_ptr[k_len] = 0;
+	memcpy(val_ptr, v, v_len);
+	val_ptr[v_len] = 0;
+	entry->hash = h;
+	entry->key_offset = ptr_offset(map->pool, key_ptr);
+	entry->prev_offset = NIL;
+	entry->next_offset = NIL;
+	entry->key_len = k_len;
+	if(map->flags & SHM_MAP_CACHE)
+		*entry_expire(entry) = map->put_expire;
+}
+
+/*
+ * entry t的key是否等于k
+ * 读者遍历时t可能正在被写者修改，key通过try_get_ptr检查，不会越界
+ */
+static bool
+entry_key_equal(shm_map_t *map, H_entry *t, const char *k, int k_len){
+	char *key_ptr;
+
+	if(t->key_len != k_len)
+		return false;
+	key_ptr = (char *)try_get_ptr(map->pool, t->key_offset, k_len);
+	return key_ptr != NULL && memcmp(key_ptr, k, k_len) == 0;
+}
+
+/*
+ * 在桶hdr中添加或替换k
+ * size_p: 新增key时需要加1的计数器
+ * old_p: 返回被替换的value，新增key时为NULL
+ */
+static bool
+bulk_put(shm_map_t *map, H_bulk *hdr, int h, const char *k, int k_len, const char *v, int v_len, int *size_p, char **old_p){
 	H_entry *t, *entry;
-	char 	*key_ptr, *val_ptr, *old_val = NULL;
-	int 	k_len, v_len, entry_offset;
-	int 	h = hash(hash_code(k));
-	H_bulk 	*hdr = &map_bulk_list[index_for(h)];
+	m_off_t entry_offset;
 
+	*old_p = NULL;
 	// 先查找是否存在该key对应的entry节点
 	if(hdr->size != 0){
-		t = (H_entry *)get_ptr(hdr->header_offset);
+		t = (H_entry *)get_ptr(map->pool, hdr->header_offset);
 		while(t != NULL){
-			key_ptr = (char *)get_ptr(t->key_offset);
-			if(t->hash == h && strcmp(key_ptr, k) == 0)
+			if(t->hash == h && entry_key_equal(map, t, k, k_len))
 				break;
-			t = next_entry(t);
+			t = next_entry(map, t);
 		}
 		// 找到该key对应的节点，直接替换value
 		if(t != NULL){
-			old_val = (char *)get_ptr(t->value_offset);
-			v_len = strlen(v) + 1;
-			val_ptr = (char*)m_alloc(v_len);
-			set_mnode_data_by_data(val_ptr, (void *)v, v_len);
-			t->value_offset = ptr_offset(val_ptr);
-			m_free(old_val);
-			return old_val;
+			*old_p = entry_set_value(map, t, v, v_len, &hdr->seq);
+			if(*old_p != NULL){
+				hdr->access = 1;
+				order_set_entry(map, t);
+			}
+			return *old_p != NULL;
 		}
 	}
 	// 直接在tail处添加节点
-	entry = (H_entry *)m_alloc(ENTRY_HEADER_SIZE);
-	if(entry == NULL){
-		shm_map_log(SHMMAP_LOG_ERROR, "[map_put]Can't allocate memory for entry");
-		return NULL;
-	}
-	entry_offset = ptr_offset(entry);
-	// init entry node
-	entry->hash = h;
-	k_len = strlen(k) + 1;
-	v_len = strlen(v) + 1;
-	key_ptr = (char *)m_alloc(k_len);
-	val_ptr = (char *)m_alloc(v_len);
-	set_mnode_data_by_data((void *)key_ptr, (void *)k, k_len);
-	set_mnode_data_by_data((void *)val_ptr, (void *)v, v_len);
-	entry->key_offset = ptr_offset(key_ptr);
-	entry->value_offset = ptr_offset(val_ptr);
+	entry = entry_new(map, h, k, k_len, v, v_len);
+	if(entry == NULL)
+		return false;
+	entry_offset = ptr_offset(map->pool, entry);
+	// entry的内容全部写完后才链入桶中，读者看到entry时它一定是完整的
+	shm_seq_write_begin(&hdr->seq);
 	if(hdr->size == 0){
-		hdr->header_offset = hdr->tail_offset = entry_offset;
-		entry->prev_offset = NIL;
+		hdr->tail_offset = entry_offset;
+		shm_store_release(&hdr->header_offset, entry_offset);
 	}else{
-		t = (H_entry *)get_ptr(hdr->tail_offset);
+		t = (H_entry *)get_ptr(map->pool, hdr->tail_offset);
 		entry->prev_offset = hdr->tail_offset;
-		t->next_offset = entry_offset;
+		shm_store_release(&t->next_offset, entry_offset);
 		hdr->tail_offset = entry_offset;
 	}
-	entry->next_offset = NIL;
-	hdr->size++;
-	(*_map_size)++;
-	return old_val;
+	shm_store_release(&hdr->size, hdr->size + 1);
+	shm_seq_write_end(&hdr->seq);
+	// 新写入的key和被读到的一样，时钟指针第一次经过时不淘汰
+	hdr->access = 1;
+	order_set_entry(map, entry);
+	(*size_p)++;
+	return true;
 }
 
-static
-H_entry* map_get_entry(const char *k){
-	int 	h = hash(hash_code(k));
-	H_bulk 	*hdr = &map_bulk_list[index_for(h)];
-	char 	*key_ptr;
-	H_entry *t;
-
-	if(hdr->size == 0)
-		return NULL;
-	t = (H_entry *)get_ptr(hdr->header_offset);
+/*
+ * 把t从桶hdr的链表中摘除
+ * t的next_offset保持不变，正在访问t的读者仍然可以继续遍历后面的节点
+ */
+static void
+bulk_unlink(shm_map_t *map, H_bulk *hdr, H_entry *t){
+	m_off_t prev_offset = t->prev_offset, next_offset = t->next_offset;
 
-	while(t != NULL){
-		key_ptr = (char *)get_ptr(t->key_offset);
-		if(h == t->hash && strcmp(k, key_ptr) == 0)
-			return t;
-		t = next_entry(t);
-	}
-	return NULL;
+	if(prev_offset == NIL)
+		shm_store_release(&hdr->header_offset, next_offset);
+	else
+		shm_store_release(&((H_entry *)get_ptr(map->pool, prev_offset))->next_offset, next_offset);
+	if(next_offset == NIL)
+		hdr->tail_offset = prev_offset;
+	else
+		((H_entry *)get_ptr(map->pool, next_offset))->prev_offset = prev_offset;
+	shm_store_release(&hdr->size, hdr->size - 1);
 }
 
-int
-map_size(){
-	return *_map_size;
-}
+/*
+ * 回收被删除的entry，以及单独分配的value
+ * 读者可能还在访问它们，通过m_retire延迟到所有读者离开后再放回内存池
+ */
+static void
+entry_retire(shm_map_t *map, H_entry *t){
+	m_off_t value_offset = t->value_offset;
 
-char*
-map_get(const char *k){
-	H_entry *t = map_get_entry(k);
-	if(t == NULL)
-		return NULL;
-	return (char*)get_ptr(t->value_offset);
+	if(!entry_value_inline(map, t, value_offset))
+		m_retire(map->pool, get_ptr(map->pool, value_offset));
+	m_retire(map->pool, t);
 }
 
-bool
-map_contains(const char *k){
-	H_entry *t = map_get_entry(k);
-	return t != NULL;
+/* entry t的value是否等于v */
+static bool
+entry_value_equal(shm_map_t *map, H_entry *t, const char *v, int v_len){
+	char 	*val_ptr;
+	int 	len;
+
+	val_ptr = entry_value(map, t, &len);
+	return val_ptr != NULL && len - 1 == v_len && memcmp(val_ptr, v, v_len) == 0;
 }
 
-void
-map_iter(key_iter it){
+/*
+ * 从桶hdr中删除k
+ * v: 不为NULL时，只有k当前的value等于v才删除
+ * size_p: 删除后需要减1的计数器
+ */
+static bool
+bulk_remove(shm_map_t *map, H_bulk *hdr, int h, const char *k, int k_len, const char *v, int v_len, int *size_p){
+	H_entry *t;
+
+	if(hdr->size == 0)
+		return false;
+	t = (H_entry *)get_ptr(map->pool, hdr->header_offset);
+	while(t != NULL){
+		if(t->hash == h && entry_key_equal(map, t, k, k_len))
+			break;
+		t = next_entry(map, t);
+	}
+	if(t == NULL || (v != NULL && !entry_value_equal(map, t, v, v_len)))
+		return false;
+	shm_seq_write_begin(&hdr->seq);
+	bulk_unlink(map, hdr, t);
+	shm_seq_write_end(&hdr->seq);
+	(*size_p)--;
+	entry_retire(map, t);
+	return true;
+}
+
+static bool
+map_remove_entry(shm_map_t *map, const char *k, int k_len, const char *v, int v_len){
+	int 			h = key_hash(map, k, k_len);
+	H_lock_stripe 	*stripe;
+	H_bulk 			*hdr;
+	bool 			ret;
+
+	intent_begin(map, MAP_INTENT_BUCKET, h);
+	if(map->flags & SHM_MAP_SWISS_INDEX){
+		if(!(map->flags & SHM_MAP_MULTI_WRITER)){
+			ret = swiss_remove(map, h, k, k_len, v, v_len, map->size);
+		}else{
+			stripe = stripe_lock(map, 0);
+			ret = swiss_remove(map, h, k, k_len, v, v_len, &stripe->size);
+			m_mutex_unlock(&stripe->mutex);
+		}
+	}else if(!(map->flags & SHM_MAP_MULTI_WRITER)){
+		hdr = get_bulk(map, index_for(h, map->grow_info->bulk_count));
+		ret = bulk_remove(map, hdr, h, k, k_len, v, v_len, map->size);
+	}else{
+		stripe = stripe_lock(map, h);
+		hdr = get_bulk(map, index_for(h, shm_load_acquire(&map->grow_info->bulk_count)));
+		ret = bulk_remove(map, hdr, h, k, k_len, v, v_len, &stripe->size);
+		m_mutex_unlock(&stripe->mutex);
+	}
+	if(ret && (map->flags & SHM_MAP_ORDERED_INDEX))
+		order_remove(map, k, k_len);
+	intent_end(map);
+	if(ret){
+		if(map->flags & SHM_MAP_CHANGE_LOG)
+			log_append(map, MAP_LOG_REMOVE, k, k_len);
+		map_notify(map);
+	}
+	return ret;
+}
+
+bool
+shm_map_remove(shm_map_t *map, const char *k){
+	return map_remove_entry(map, k, strlen(k), NULL, 0);
+}
+
+bool
+shm_map_remove2(shm_map_t *map, const void *k, size_t k_len){
+	if(k_len >= INT_MAX)
+		return false;
+	return map_remove_entry(map, (const char *)k, k_len, NULL, 0);
+}
+
+bool
+shm_map_remove_if(shm_map_t *map, const void *k, size_t k_len, const void *v, size_t v_len){
+	if(k_len >= INT_MAX || v_len >= INT_MAX)
+		return false;
+	return map_remove_entry(map, (const char *)k, k_len, (const char *)v, v_len);
+}
+
+/*
+ * 写入k，缓存模式下写入失败时按CLOCK淘汰一些key后重试，成功后顺带回收几个桶中过期的key
+ */
+static bool
+map_put_entry(shm_map_t *map, int h, const char *k, int k_len, const char *v, int v_len, char **old_p){
+	int 	tries, entry_len, value_len;
+	bool 	ret;
+
+	ret = map_put_index(map, h, k, k_len, v, v_len, old_p);
+	if(map->flags & SHM_MAP_CACHE){
+		entry_lens(map, k_len, v_len, &entry_len, &value_len);
+		for(tries=0; !ret && tries<MAP_EVICT_TRIES; tries++){
+			cache_make_room(map, 1 << tries, entry_len, value_len);
+			ret = map_put_index(map, h, k, k_len, v, v_len, old_p);
+		}
+		if(!ret)
+			map->log(SHMMAP_LOG_ERROR, "[map_put]No room for a key of %d bytes and a value of %d bytes after eviction", k_len, v_len);
+		else
+			cache_sweep(map, MAP_CACHE_SWEEP, false, 0, 0);
+	}
+	if(ret){
+		if(map->flags & SHM_MAP_CHANGE_LOG)
+			log_append(map, MAP_LOG_PUT, k, k_len);
+		map_notify(map);
+	}
+	return ret;
+}
+
+/* 在记录的意图内写入hash索引和有序索引 */
+static bool
+map_put_index(shm_map_t *map, int h, const char *k, int k_len, const char *v, int v_len, char **old_p){
+	H_lock_stripe 	*stripe;
+	H_bulk 			*hdr;
+	int 			stripe_size, inserted = 0;
+	bool 			ret;
+
+	intent_begin(map, MAP_INTENT_BUCKET, h);
+	// 新的key先链入有序索引，写入失败时再摘除；写入hash索引时把entry记录在节点中
+	if(map->flags & SHM_MAP_ORDERED_INDEX){
+		inserted = order_insert(map, k, k_len, &map->put_node);
+		if(inserted < 0){
+			intent_end(map);
+			*old_p = NULL;
+			return false;
+		}
+	}
+	if(map->flags & SHM_MAP_SWISS_INDEX){
+		if(!(map->flags & SHM_MAP_MULTI_WRITER)){
+			ret = swiss_put(map, h, k, k_len, v, v_len, map->size, old_p);
+		}else{
+			stripe = stripe_lock(map, 0);
+			ret = swiss_put(map, h, k, k_len, v, v_len, &stripe->size, old_p);
+			m_mutex_unlock(&stripe->mutex);
+		}
+	}else if(!(map->flags & SHM_MAP_MULTI_WRITER)){
+		hdr = get_bulk(map, index_for(h, map->grow_info->bulk_count));
+		ret = bulk_put(map, hdr, h, k, k_len, v, v_len, map->size, old_p);
+		if(map->flags & SHM_MAP_GROWABLE)
+			map_grow(map, *map->size, 0);
+	}else{
+		// 不同分段中的桶可以并发写
+		stripe = stripe_lock(map, h);
+		hdr = get_bulk(map, index_for(h, shm_load_acquire(&map->grow_info->bulk_count)));
+		ret = bulk_put(map, hdr, h, k, k_len, v, v_len, &stripe->size, old_p);
+		stripe_size = stripe->size;
+		m_mutex_unlock(&stripe->mutex);
+		if(map->flags & SHM_MAP_GROWABLE)
+			map_grow(map, 0, stripe_size);
+	}
+	map->put_node = NULL;
+	if(!ret && inserted > 0)
+		order_remove(map, k, k_len);
+	intent_end(map);
+	return ret;
+}
+
+char*
+shm_map_put(shm_map_t *map, const char *k, const char *v){
+	char *old_val;
+
+	map_put_entry(map, key_hash(map, k, strlen(k)), k, strlen(k), v, strlen(v), &old_val);
+	return old_val;
+}
+
+bool
+shm_map_put2(shm_map_t *map, const void *k, size_t k_len, const void *v, size_t v_len){
+	char *old_val;
+
+	if(k_len >= INT_MAX || v_len >= INT_MAX){
+		map->log(SHMMAP_LOG_ERROR, "[map_put2]The key or value is too large");
+		return false;
+	}
+	return map_put_entry(map, key_hash(map, (const char *)k, k_len), (const char *)k, k_len, (const char *)v, v_len, &old_val);
+}
+
+/*
+ * 把桶old_hdr中hash值与mask后不等于idx的entry移到桶new_hdr中
+ * 读者可能正在遍历被移动的entry，通过桶的seq和桶的个数发现后重读
+ */
+static void
+bulk_split_move(shm_map_t *map, H_bulk *old_hdr, H_bulk *new_hdr, int idx, int mask){
+	H_entry *t, *tail;
+	m_off_t offset, next_offset;
+
+	offset = old_hdr->size == 0 ? NIL : old_hdr->header_offset;
+	while(offset != NIL){
+		t = (H_entry *)get_ptr(map->pool, offset);
+		next_offset = t->next_offset;
+		if((t->hash & mask) != idx){
+			// 从原来的桶中摘除，链入新桶之前先记下它，写者在这期间退出时由split_redo接回
+			shm_store_release(&map->grow_info->split_entry, offset);
+			bulk_unlink(map, old_hdr, t);
+
+			// 添加到新桶的tail
+			shm_store_release(&t->next_offset, NIL);
+			if(new_hdr->size == 0){
+				t->prev_offset = NIL;
+				shm_store_release(&new_hdr->header_offset, offset);
+			}else{
+				tail = (H_entry *)get_ptr(map->pool, new_hdr->tail_offset);
+				t->prev_offset = new_hdr->tail_offset;
+				shm_store_release(&tail->next_offset, offset);
+			}
+			new_hdr->tail_offset = offset;
+			shm_store_release(&new_hdr->size, new_hdr->size + 1);
+			shm_store_release(&map->grow_info->split_entry, NIL);
+		}
+		offset = next_offset;
+	}
+}
+
+/*
+ * 分配segment目录。segment从内存池中分配，目录的项数不超过内存池能容纳的segment个数，
+ * 不扩容的map不需要目录
+ */
+static bool
+segments_init(shm_map_t *map, size_t mem_size){
+	size_t 	n = mem_size / (sizeof(H_bulk) * MAP_SEGMENT_LEN) + 1;
+	m_off_t *dir;
+
+	if(n > MAP_MAX_SEGMENTS)
+		n = MAP_MAX_SEGMENTS;
+	dir = (m_off_t *)m_alloc(map->pool, sizeof(m_off_t) * n);
+	if(dir == NULL){
+		map->log(SHMMAP_LOG_ERROR, "[map_init]Can't allocate the directory of %d bulk segments", (int)n);
+		return false;
+	}
+	memset(dir, 0, sizeof(m_off_t) * n);
+	map->grow_info->segments = ptr_offset(map->pool, dir);
+	map->grow_info->segment_max = (int)n;
+	return true;
+}
+
+/*
+ * 分裂下一个桶，桶的个数加1
+ * 多写者模式下调用者持有split_mutex，这里再锁住被分裂的桶所在的分段
+ */
+static bool
+bulk_split(shm_map_t *map){
+	int 			bulk_count = map->grow_info->bulk_count;
+	int 			round = 1 << (31 - __builtin_clz(bulk_count));
+	int 			idx = bulk_count - round, new_idx = bulk_count;
+	int 			seg = (new_idx - map->bulk_list_len) / MAP_SEGMENT_LEN;
+	int 			i;
+	H_bulk 			*old_hdr, *new_hdr, *seg_ptr;
+	H_lock_stripe 	*stripe = NULL;
+
+	if(seg >= map->grow_info->segment_max || bulk_count >= MAX_CAPACITY)
+		return false;
+	// 新的segment中的第一个桶，先分配segment
+	if(map->segments[seg] == 0){
+		seg_ptr = (H_bulk *)m_alloc(map->pool, sizeof(H_bulk) * MAP_SEGMENT_LEN);
+		if(seg_ptr == NULL){
+			map->log(SHMMAP_LOG_ERROR, "[bulk_split]Can't allocate memory for bulk segment %d", seg);
+			return false;
+		}
+		for(i=0; i<MAP_SEGMENT_LEN; i++)
+			init_bulk(seg_ptr + i);
+		shm_store_release(&map->segments[seg], ptr_offset(map->pool, seg_ptr));
+	}
+
+	if(map->flags & SHM_MAP_MULTI_WRITER)
+		stripe = stripe_lock(map, idx);
+	old_hdr = get_bulk(map, idx);
+	new_hdr = get_bulk(map, new_idx);
+	map->grow_info->split_to = new_idx;
+	shm_seq_write_begin(&old_hdr->seq);
+	shm_seq_write_begin(&new_hdr->seq);
+	// 先发布新的桶个数，读者按照新的个数找到新桶时，新桶的seq为奇数，会等待移动完成
+	shm_store_release(&map->grow_info->bulk_count, bulk_count + 1);
+	bulk_split_move(map, old_hdr, new_hdr, idx, (round << 1) - 1);
+	shm_seq_write_end(&new_hdr->seq);
+	shm_seq_write_end(&old_hdr->seq);
+	map->grow_info->split_to = NIL;
+	if(stripe != NULL)
+		m_mutex_unlock(&stripe->mutex);
+	return true;
+}
+
+/*
+ * 负载过高时分裂桶，每次最多分裂MAP_SPLITS_PER_PUT个
+ * size: 			单写者模式下map中key的个数
+ * stripe_size:		多写者模式下刚写入的分段中key的个数，用它估算整个map的负载，避免每次遍历所有分段
+ */
+static void
+map_grow(shm_map_t *map, int size, int stripe_size){
 	int i;
+
+	if(!(map->flags & SHM_MAP_MULTI_WRITER)){
+		for(i=0; i<MAP_SPLITS_PER_PUT && size > map->grow_info->bulk_count * MAP_LOAD_FACTOR; i++){
+			if(!bulk_split(map))
+				break;
+		}
+		return;
+	}
+	if((long)stripe_size * map->lock_stripe_len <= (long)shm_load_relaxed(&map->grow_info->bulk_count) * MAP_LOAD_FACTOR)
+		return;
+	// 其他写者正在分裂时直接返回，由它完成扩容
+	if(!m_mutex_trylock(map->pool, &map->grow_info->split_mutex, split_recover, map))
+		return;
+	for(i=0; i<MAP_SPLITS_PER_PUT && shm_map_size(map) > map->grow_info->bulk_count * MAP_LOAD_FACTOR; i++){
+		if(!bulk_split(map))
+			break;
+	}
+	m_mutex_unlock(&map->grow_info->split_mutex);
+}
+
+/*
+ * 写者在分裂桶的过程中退出，锁住被分裂的桶所在的分段，由stripe_recover修复链表并完成分裂。
+ * 分段可能已经被其他写者或者读者恢复过，这时分裂也已经完成。
+ */
+static void
+split_recover(void *arg){
+	shm_map_t 		*map = (shm_map_t *)arg;
+	H_lock_stripe 	*stripe;
+
+	if(map->grow_info->split_to == NIL)
+		return;
+	// 新桶和被分裂的桶的低位相同，属于同一个分段。锁住分段时可能由stripe_recover完成了分裂
+	stripe = stripe_lock(map, map->grow_info->split_to);
+	if(map->grow_info->split_to != NIL)
+		split_redo(map);
+	m_mutex_unlock(&stripe->mutex);
+}
+
+/* 桶hdr的链表中是否有offset处的entry */
+static bool
+bulk_has_entry(shm_map_t *map, H_bulk *hdr, m_off_t offset){
+	m_off_t o;
+
+	for(o=hdr->header_offset; o!=NIL; o=((H_entry *)get_ptr(map->pool, o))->next_offset){
+		if(o == offset)
+			return true;
+	}
+	return false;
+}
+
+/*
+ * 重新移动被分裂的桶中的entry，调用者持有桶所在的分段锁，或者是唯一的写者
+ * 两个桶的链表已经由stripe_recover修复。写者退出时正在移动的entry已经从旧桶摘除、
+ * 还没有链入新桶，先把它接到旧桶的末尾，再和其他entry一起移动
+ */
+static void
+split_redo(shm_map_t *map){
+	int 			new_idx = map->grow_info->split_to;
+	int 			round = 1 << (31 - __builtin_clz(new_idx));
+	int 			idx = new_idx - round;
+	m_off_t 		offset = map->grow_info->split_entry;
+	H_bulk 			*old_hdr, *new_hdr;
+	H_entry 		*t;
+
+	old_hdr = get_bulk(map, idx);
+	new_hdr = get_bulk(map, new_idx);
+	shm_seq_write_begin(&old_hdr->seq);
+	shm_seq_write_begin(&new_hdr->seq);
+	if(offset != NIL && !bulk_has_entry(map, old_hdr, offset) && !bulk_has_entry(map, new_hdr, offset)){
+		t = (H_entry *)get_ptr(map->pool, offset);
+		t->next_offset = NIL;
+		t->prev_offset = old_hdr->tail_offset;
+		if(old_hdr->tail_offset == NIL)
+			shm_store_release(&old_hdr->header_offset, offset);
+		else
+			shm_store_release(&((H_entry *)get_ptr(map->pool, old_hdr->tail_offset))->next_offset, offset);
+		old_hdr->tail_offset = offset;
+		shm_store_release(&old_hdr->size, old_hdr->size + 1);
+	}
+	map->grow_info->split_entry = NIL;
+	if(map->grow_info->bulk_count <= new_idx)
+		shm_store_release(&map->grow_info->bulk_count, new_idx + 1);
+	bulk_split_move(map, old_hdr, new_hdr, idx, (round << 1) - 1);
+	shm_seq_write_end(&new_hdr->seq);
+	shm_seq_write_end(&old_hdr->seq);
+	map->grow_info->split_to = NIL;
+}
+
+/* 在桶hdr中查找k */
+static H_entry*
+bulk_get_entry(shm_map_t *map, H_bulk *hdr, int h, const char *k, int k_len){
+	H_entry *t;
+
+	if(shm_load_acquire(&hdr->size) == 0)
+		return NULL;
+	t = (H_entry *)get_ptr(map->pool, shm_load_acquire(&hdr->header_offset));
+
+	while(t != NULL){
+		if(h == t->hash && entry_key_equal(map, t, k, k_len))
+			return t;
+		t = next_entry(map, t);
+	}
+	return NULL;
+}
+
+/*
+ * 查找hash值为h的k对应的entry
+ * 没有找到时，如果期间桶被修改或者分裂了，k可能被移到了其他桶中，需要重新查找
+ */
+static H_entry*
+map_get_entry(shm_map_t *map, int h, const char *k, int k_len){
+	int 			bulk_count;
+	unsigned int 	seq;
+	H_bulk 			*hdr;
+	H_entry 		*t;
+
+	if(map->flags & SHM_MAP_SWISS_INDEX)
+		return swiss_get_entry(map, h, k, k_len);
+	do{
+		bulk_count = shm_load_acquire(&map->grow_info->bulk_count);
+		hdr = get_bulk(map, index_for(h, bulk_count));
+		seq = seq_read_begin(map, &hdr->seq, h);
+		t = bulk_get_entry(map, hdr, h, k, k_len);
+		if(t != NULL)
+			return cache_hit(map, t, &hdr->access) ? t : NULL;
+	}while(shm_seq_read_retry(&hdr->seq, seq) || shm_load_relaxed(&map->grow_info->bulk_count) != bulk_count);
+	return NULL;
+}
+
+bool
+shm_map_reader_enter(shm_map_t *map){
+	return m_reader_enter(map->pool);
+}
+
+void
+shm_map_reader_exit(shm_map_t *map){
+	m_reader_exit(map->pool);
+}
+
+int
+shm_map_size(shm_map_t *map){
+	int i, total = 0;
+
+	if(!(map->flags & SHM_MAP_MULTI_WRITER))
+		return *map->size;
+	for(i=0; i<map->lock_stripe_len; i++)
+		total += shm_load_relaxed(&map->lock_stripes[i].size);
+	return total;
+}
+
+char*
+shm_map_get(shm_map_t *map, const char *k){
+	H_entry *t = map_get_entry(map, key_hash(map, k, strlen(k)), k, strlen(k));
+	if(t == NULL)
+		return NULL;
+	return (char*)get_ptr(map->pool, shm_load_acquire(&t->value_offset));
+}
+
+/*
+ * entry t的value，v_len_p返回value的长度(包括结尾的'\0')
+ * t可能随时被写者修改，所有指针都通过try_get_ptr检查，读到非法偏移量时返回NULL，
+ * 由调用者根据seq决定是否重读。
+ */
+static char*
+entry_value(shm_map_t *map, H_entry *t, int *v_len_p){
+	M_block_hdr *blk;
+	char 		*val_ptr;
+	m_off_t 	entry_offset, value_offset;
+	int 		v_len;
+
+	value_offset = shm_load_acquire(&t->value_offset);
+	entry_offset = ptr_offset(map->pool, t);
+	blk = (M_block_hdr *)try_get_ptr(map->pool, entry_offset - BLOCK_HEADER_SIZE, BLOCK_HEADER_SIZE);
+	if(blk == NULL)
+		return NULL;
+	if(value_offset > entry_offset && value_offset < entry_offset + blk->data_len){
+		// value在entry的块中，到块的末尾结束
+		v_len = entry_offset + blk->data_len - value_offset;
+	}else{
+		blk = (M_block_hdr *)try_get_ptr(map->pool, value_offset - BLOCK_HEADER_SIZE, BLOCK_HEADER_SIZE);
+		if(blk == NULL)
+			return NULL;
+		v_len = blk->data_len;
+	}
+	val_ptr = (char *)try_get_ptr(map->pool, value_offset, v_len);
+	if(val_ptr == NULL || v_len <= 0)
+		return NULL;
+	*v_len_p = v_len;
+	return val_ptr;
+}
+
+/* 把entry t的value拷贝到buf中，t非法时返回-1 */
+static int
+entry_copy_value(shm_map_t *map, H_entry *t, char *buf, int buf_len){
+	char 	*val_ptr;
+	int 	n, v_len;
+
+	val_ptr = entry_value(map, t, &v_len);
+	if(val_ptr == NULL)
+		return -1;
+	if(buf_len > 0){
+		n = v_len < buf_len ? v_len : buf_len;
+		memcpy(buf, val_ptr, n);
+		buf[n - 1] = 0;
+	}
+	return v_len - 1;
+}
+
+bool
+shm_map_get2(shm_map_t *map, const void *k, size_t k_len, const void **v, size_t *v_len){
+	H_entry *t;
+	char 	*val_ptr;
+	int 	len;
+
+	if(k_len >= INT_MAX)
+		return false;
+	t = map_get_entry(map, key_hash(map, (const char *)k, k_len), (const char *)k, k_len);
+	if(t == NULL)
+		return false;
+	// value_offset只读一次，指向的块在读者离开临界区前不会被回收，长度与它一致
+	val_ptr = entry_value(map, t, &len);
+	if(val_ptr == NULL)
+		return false;
+	*v = val_ptr;
+	*v_len = len - 1;
+	return true;
+}
+
+/*
+ * 在桶hdr中查找k，并把value拷贝到buf中。
+ * 调用者持有桶的seq，桶中的偏移量可能随时被写者修改。
+ */
+static int
+bulk_copy_value(shm_map_t *map, H_bulk *hdr, int h, const char *k, int k_len, char *buf, int buf_len){
+	H_entry 	*t;
+	m_off_t 	offset;
+	int 		i, size;
+
+	size = shm_load_acquire(&hdr->size);
+	offset = shm_load_acquire(&hdr->header_offset);
+	// 最多遍历size个节点，避免读到被修改的next_offset后成环
+	for(i=0; i<size && offset!=NIL; i++){
+		t = (H_entry *)try_get_ptr(map->pool, offset, ENTRY_HEADER_SIZE);
+		if(t == NULL)
+			return -1;
+		// 先比较指纹，不相等时不需要访问key
+		if(t->hash == h && entry_key_equal(map, t, k, k_len))
+			return cache_hit(map, t, &hdr->access) ? entry_copy_value(map, t, buf, buf_len) : -1;
+		offset = shm_load_acquire(&t->next_offset);
+	}
+	return -1;
+}
+
+int
+shm_map_get_copy(shm_map_t *map, const char *k, char *buf, int buf_len){
+	int 			k_len = strlen(k);
+	int 			h = key_hash(map, k, k_len);
+	int 			bulk_count, ret;
+	H_bulk 			*hdr;
+	unsigned int 	seq;
+
+	if(map->flags & SHM_MAP_SWISS_INDEX)
+		return swiss_copy_value(map, h, k, k_len, buf, buf_len);
+	do{
+		bulk_count = shm_load_acquire(&map->grow_info->bulk_count);
+		hdr = get_bulk(map, index_for(h, bulk_count));
+		seq = seq_read_begin(map, &hdr->seq, h);
+		ret = bulk_copy_value(map, hdr, h, k, k_len, buf, buf_len);
+	}while(shm_seq_read_retry(&hdr->seq, seq) || shm_load_relaxed(&map->grow_info->bulk_count) != bulk_count);
+	return ret;
+}
+
+bool
+shm_map_contains(shm_map_t *map, const char *k){
+	H_entry *t = map_get_entry(map, key_hash(map, k, strlen(k)), k, strlen(k));
+	return t != NULL;
+}
+
+void
+shm_map_iter(shm_map_t *map, key_iter it){
+	int i, bulk_count;
 	H_bulk *hdr;
 	H_entry *t;
 	char *k, *v;
 
-	for(i=0; i<map_bulk_list_len; i++){
-		hdr = map_bulk_list + i;
+	if(map->flags & SHM_MAP_SWISS_INDEX){
+		for(i=0; i<map->bulk_list_len; i++){
+			if(shm_load_acquire(&map->swiss_ctrl[i]) & MAP_CTRL_EMPTY)
+				continue;
+			t = (H_entry *)get_ptr(map->pool, map->swiss_slots[i].entry_offset);
+			if(entry_expired(map, t))
+				continue;
+			k = (char *)get_ptr(map->pool, t->key_offset);
+			v = (char *)get_ptr(map->pool, shm_load_acquire(&t->value_offset));
+			it(k, v);
+		}
+		return;
+	}
+	bulk_count = shm_load_acquire(&map->grow_info->bulk_count);
+	for(i=0; i<bulk_count; i++){
+		hdr = get_bulk(map, i);
 		if(hdr->size != 0){
-			for(t=(H_entry *)get_ptr(hdr->header_offset); t!=NULL; t=next_entry(t)){
-				k = (char *)get_ptr(t->key_offset);
-				v = (char *)get_ptr(t->value_offset);
+			for(t=(H_entry *)get_ptr(map->pool, hdr->header_offset); t!=NULL; t=next_entry(map, t)){
+				if(entry_expired(map, t))
+					continue;
+				k = (char *)get_ptr(map->pool, t->key_offset);
+				v = (char *)get_ptr(map->pool, t->value_offset);
 				it(k, v);
 			}
 		}
 	}
 }
+
+//**********************游标扫描**********************//
+
+void
+shm_map_scan_init(shm_map_t *map, shm_map_cursor *cur, int part, int parts){
+	int64_t len = map->bulk_list_len;
+
+	memset(cur, 0, sizeof(shm_map_cursor));
+	if(parts <= 0 || part < 0 || part >= parts)
+		return;
+	cur->bulk = (int)(len * part / parts);
+	cur->end = (int)(len * (part + 1) / parts);
+}
+
+/* entry t的key、value，t可能随时被写者修改，读到非法偏移量时返回false，由调用者根据seq决定是否重读 */
+static bool
+entry_scan(shm_map_t *map, H_entry *t, shm_map_kv *kv){
+	char 	*val_ptr;
+	int 	k_len = t->key_len, v_len;
+
+	if(k_len < 0)
+		return false;
+	kv->k = try_get_ptr(map->pool, t->key_offset, k_len);
+	val_ptr = entry_value(map, t, &v_len);
+	if(kv->k == NULL || val_ptr == NULL)
+		return false;
+	kv->k_len = k_len;
+	kv->v = val_ptr;
+	kv->v_len = v_len - 1;
+	return true;
+}
+
+/*
+ * 在桶idx的seq保护下读出跳过前skip个之后的key，最多room个
+ * more_p: 桶中还有放不下的key
+ */
+static int
+bulk_scan(shm_map_t *map, int idx, int skip, shm_map_kv *kvs, int room, bool *more_p){
+	H_bulk 			*hdr = get_bulk(map, idx);
+	H_entry 		*t;
+	m_off_t 		offset;
+	unsigned int 	seq;
+	int 			i, n, size;
+
+	do{
+		seq = seq_read_begin(map, &hdr->seq, idx);
+		n = 0;
+		*more_p = false;
+		size = shm_load_acquire(&hdr->size);
+		offset = shm_load_acquire(&hdr->header_offset);
+		// 最多遍历size个节点，避免读到被修改的next_offset后成环
+		for(i=0; i<size && offset!=NIL; i++){
+			t = (H_entry *)try_get_ptr(map->pool, offset, ENTRY_HEADER_SIZE);
+			if(t == NULL)
+				break;
+			if(i >= skip && !entry_expired(map, t)){
+				if(n == room){
+					*more_p = true;
+					break;
+				}
+				if(!entry_scan(map, t, &kvs[n]))
+					break;
+				n++;
+			}
+			offset = shm_load_acquire(&t->next_offset);
+		}
+	}while(shm_seq_read_retry(&hdr->seq, seq));
+	return n;
+}
+
+/* 在组的seq保护下读出slot中的key，slot为空时返回false */
+static bool
+swiss_scan(shm_map_t *map, int slot_idx, shm_map_kv *kv){
+	unsigned int 	*seq_p = &map->swiss_seq[slot_idx / MAP_GROUP_SLOTS];
+	unsigned int 	seq;
+	H_entry 		*t;
+	bool 			found;
+
+	do{
+		seq = seq_read_begin(map, seq_p, 0);
+		found = false;
+		if(!(shm_load_acquire(&map->swiss_ctrl[slot_idx]) & MAP_CTRL_EMPTY)){
+			t = (H_entry *)try_get_ptr(map->pool, map->swiss_slots[slot_idx].entry_offset, ENTRY_HEADER_SIZE);
+			found = t != NULL && !entry_expired(map, t) && entry_scan(map, t, kv);
+		}
+	}while(shm_seq_read_retry(seq_p, seq));
+	return found;
+}
+
+/*
+ * 每个初始桶依次扫描它自己和从它分裂出的桶，下标递增，分裂出的桶在扫描时才读取bulk_count，
+ * 扫描期间分裂出的桶也会被扫描到。批次尽量在桶的边界结束，只有一个桶就放不下时才从桶的中间结束。
+ */
+int
+shm_map_scan(shm_map_t *map, shm_map_cursor *cur, shm_map_kv *kvs, int batch){
+	int 	n = 0, got, idx;
+	bool 	more;
+
+	if(map->flags & SHM_MAP_SWISS_INDEX){
+		for(; cur->bulk<cur->end && n<batch; cur->bulk++){
+			if(swiss_scan(map, cur->bulk, &kvs[n]))
+				n++;
+		}
+		return n;
+	}
+	while(cur->bulk < cur->end && n < batch){
+		idx = cur->bulk + cur->split * map->bulk_list_len;
+		if(idx >= shm_load_acquire(&map->grow_info->bulk_count)){
+			// 这个初始桶分裂出的桶都已经扫描
+			cur->bulk++;
+			cur->split = 0;
+			cur->skip = 0;
+			continue;
+		}
+		got = bulk_scan(map, idx, cur->skip, kvs + n, batch - n, &more);
+		if(more){
+			// 桶放不下时，下一批从桶的开头返回；本批还是空的才从桶的中间结束
+			if(n == 0){
+				cur->skip += got;
+				n = got;
+			}
+			break;
+		}
+		n += got;
+		cur->split++;
+		cur->skip = 0;
+	}
+	return n;
+}
+
+//**********************有序索引**********************//
+
+/* 按字节序比较两个key，前缀较短的key更小 */
+static int
+key_cmp(const char *a, int a_len, const char *b, int b_len){
+	int n = a_len < b_len ? a_len : b_len;
+	int c = n > 0 ? memcmp(a, b, n) : 0;
+
+	if(c != 0)
+		return c;
+	return a_len - b_len;
+}
+
+static H_order_node*
+order_node_new(shm_map_t *map, int level, const char *k, int k_len){
+	H_order_node 	*node;
+	char 			*key;
+	int 			i;
+
+	if(k_len > INT_MAX - (int)(sizeof(H_order_node) + sizeof(m_off_t) * MAP_ORDER_MAX_LEVEL) - 1){
+		map->log(SHMMAP_LOG_ERROR, "[order_node_new]The key is too large for the ordered index");
+		return NULL;
+	}
+	node = (H_order_node *)m_alloc(map->pool, sizeof(H_order_node) + sizeof(m_off_t) * level + k_len + 1);
+	if(node == NULL){
+		if(!(map->flags & SHM_MAP_CACHE))
+			map->log(SHMMAP_LOG_ERROR, "[order_node_new]Can't allocate the index node for a key of %d bytes", k_len);
+		return NULL;
+	}
+	node->key_len = k_len;
+	node->level = level;
+	node->entry = NIL;
+	for(i=0; i<level; i++)
+		node->next[i] = NIL;
+	key = order_key(node);
+	if(k_len > 0)
+		memcpy(key, k, k_len);
+	key[k_len] = 0;
+	return node;
+}
+
+/*
+ * 查找第一个不小于k的节点，after为true时查找第一个大于k的节点，没有时返回NULL
+ * update: 写者用来返回每一层上在它之前的节点，链入、摘除节点时修改它们的next；读者为NULL
+ */
+static H_order_node*
+order_seek(shm_map_t *map, const char *k, int k_len, bool after, H_order_node **update){
+	H_order_node 	*x, *next;
+	m_off_t 		offset;
+	int 			l, c;
+
+	l = update != NULL ? MAP_ORDER_MAX_LEVEL - 1 : shm_load_acquire(&map->order->level) - 1;
+	x = (H_order_node *)get_ptr(map->pool, shm_load_acquire(&map->order->head));
+	for(; l>=0; l--){
+		while((offset = shm_load_acquire(&x->next[l])) != NIL){
+			next = (H_order_node *)get_ptr(map->pool, offset);
+			c = key_cmp(order_key(next), next->key_len, k, k_len);
+			if(c > 0 || (c == 0 && !after))
+				break;
+			x = next;
+		}
+		if(update != NULL)
+			update[l] = x;
+	}
+	offset = shm_load_acquire(&x->next[0]);
+	return offset == NIL ? NULL : (H_order_node *)get_ptr(map->pool, offset);
+}
+
+/* 新节点的层数，第i层的概率为(1/4)^(i-1) */
+static int
+order_random_level(shm_map_t *map){
+	uint64_t 	r = map->order_rand;
+	int 		level = 1;
+
+	r ^= r << 13;
+	r ^= r >> 7;
+	r ^= r << 17;
+	map->order_rand = r;
+	while(level < MAP_ORDER_MAX_LEVEL && (r & 3) == 0){
+		level++;
+		r >>= 2;
+	}
+	return level;
+}
+
+/*
+ * 把k链入有序索引，node_p返回k的节点
+ * return: 1链入了新节点，0已经存在，-1分配内存失败
+ */
+static int
+order_insert(shm_map_t *map, const char *k, int k_len, H_order_node **node_p){
+	H_order_node 	*update[MAP_ORDER_MAX_LEVEL], *x, *node;
+	m_off_t 		offset;
+	int 			i, level;
+
+	x = order_seek(map, k, k_len, false, update);
+	if(x != NULL && key_cmp(order_key(x), x->key_len, k, k_len) == 0){
+		*node_p = x;
+		return 0;
+	}
+	level = order_random_level(map);
+	node = order_node_new(map, level, k, k_len);
+	*node_p = node;
+	if(node == NULL)
+		return -1;
+	for(i=0; i<level; i++)
+		node->next[i] = update[i]->next[i];
+	// 节点填好之后从下往上链入，读者在每一层看到的都是有序的链表
+	offset = ptr_offset(map->pool, node);
+	for(i=0; i<level; i++)
+		shm_store_release(&update[i]->next[i], offset);
+	if(level > map->order->level)
+		shm_store_release(&map->order->level, level);
+	return 1;
+}
+
+static void
+order_remove(shm_map_t *map, const char *k, int k_len){
+	H_order_node 	*update[MAP_ORDER_MAX_LEVEL], *x;
+	int 			i;
+
+	x = order_seek(map, k, k_len, false, update);
+	if(x == NULL || key_cmp(order_key(x), x->key_len, k, k_len) != 0)
+		return;
+	// 先清除entry，正停在节点上的读者不会再读已经删除的value
+	shm_store_release(&x->entry, NIL);
+	// 从上往下摘除，节点自己的next不变，正停在它上面的读者可以继续向后查找
+	for(i=x->level-1; i>=0; i--)
+		shm_store_release(&update[i]->next[i], x->next[i]);
+	m_retire(map->pool, x);
+}
+
+/* 写者把正在写入的key的entry t记录到它的节点中 */
+static void
+order_set_entry(shm_map_t *map, H_entry *t){
+	if(map->put_node != NULL)
+		shm_store_release(&map->put_node->entry, ptr_offset(map->pool, t));
+}
+
+/* 整理把entry搬到了新的块，key的节点指向新的entry */
+static void
+order_move(shm_map_t *map, H_entry *entry){
+	H_order_node 	*x;
+	const char 		*k;
+
+	if(!(map->flags & SHM_MAP_ORDERED_INDEX))
+		return;
+	k = (const char *)get_ptr(map->pool, entry->key_offset);
+	x = order_seek(map, k, entry->key_len, false, NULL);
+	if(x != NULL && key_cmp(order_key(x), x->key_len, k, entry->key_len) == 0)
+		shm_store_release(&x->entry, ptr_offset(map->pool, entry));
+}
+
+static int
+order_kv_cmp(const void *a, const void *b){
+	const shm_map_kv *x = (const shm_map_kv *)a, *y = (const shm_map_kv *)b;
+	return key_cmp((const char *)x->k, (int)x->k_len, (const char *)y->k, (int)y->k_len);
+}
+
+/*
+ * 用hash索引中的所有key建立新的跳表，建好之后一次替换头节点，旧的节点延迟回收
+ * 批量构建之后、以及崩溃恢复时两个索引可能不一致时调用。keys的v借用来保存key的entry
+ */
+static bool
+order_rebuild(shm_map_t *map){
+	H_order_node 	*last[MAP_ORDER_MAX_LEVEL], *head, *node;
+	shm_map_kv 		*keys;
+	H_bulk 			*hdr;
+	H_entry 		*t;
+	m_off_t 		offset, old_head;
+	int 			i, j, l, n = 0, size = shm_map_size(map), top = 0;
+
+	keys = (shm_map_kv *)malloc(sizeof(shm_map_kv) * (size > 0 ? size : 1));
+	head = order_node_new(map, MAP_ORDER_MAX_LEVEL, NULL, 0);
+	if(keys == NULL || head == NULL){
+		map->log(SHMMAP_LOG_ERROR, "[order_rebuild]Can't allocate memory for %d keys", size);
+		free(keys);
+		if(head != NULL)
+			m_free(map->pool, head);
+		return false;
+	}
+	if(map->flags & SHM_MAP_SWISS_INDEX){
+		for(i=0; i<map->bulk_list_len && n<size; i++){
+			if(map->swiss_ctrl[i] & MAP_CTRL_EMPTY)
+				continue;
+			t = (H_entry *)get_ptr(map->pool, map->swiss_slots[i].entry_offset);
+			keys[n].k = get_ptr(map->pool, t->key_offset);
+			keys[n].v = t;
+			keys[n++].k_len = t->key_len;
+		}
+	}else{
+		for(i=0; i<map->grow_info->bulk_count; i++){
+			hdr = get_bulk(map, i);
+			if(hdr->size == 0)
+				continue;
+			for(t=(H_entry *)get_ptr(map->pool, hdr->header_offset); t!=NULL && n<size; t=next_entry(map, t)){
+				keys[n].k = get_ptr(map->pool, t->key_offset);
+				keys[n].v = t;
+				keys[n++].k_len = t->key_len;
+			}
+		}
+	}
+	qsort(keys, n, sizeof(shm_map_kv), order_kv_cmp);
+	// 按顺序追加，每一层记住最后一个节点
+	for(l=0; l<MAP_ORDER_MAX_LEVEL; l++)
+		last[l] = head;
+	for(j=0; j<n; j++){
+		node = order_node_new(map, order_random_level(map), (const char *)keys[j].k, (int)keys[j].k_len);
+		if(node == NULL){
+			// 新的跳表还没有发布，直接释放
+			for(offset=head->next[0]; offset!=NIL; ){
+				node = (H_order_node *)get_ptr(map->pool, offset);
+				offset = node->next[0];
+				m_free(map->pool, node);
+			}
+			m_free(map->pool, head);
+			free(keys);
+			return false;
+		}
+		node->entry = ptr_offset(map->pool, (void *)keys[j].v);
+		for(l=0; l<node->level; l++){
+			last[l]->next[l] = ptr_offset(map->pool, node);
+			last[l] = node;
+		}
+		if(node->level > top)
+			top = node->level;
+	}
+	free(keys);
+	old_head = map->order->head;
+	shm_store_release(&map->order->head, ptr_offset(map->pool, head));
+	shm_store_release(&map->order->level, top);
+	for(offset=old_head; offset!=NIL; ){
+		node = (H_order_node *)get_ptr(map->pool, offset);
+		offset = node->next[0];
+		m_retire(map->pool, node);
+	}
+	return true;
+}
+
+/*
+ * 读出节点记录的entry的key、value，不再按key查找。在entry所在的桶(组)的seq保护下读，
+ * 桶被修改、扩容、或者整理把entry搬走时重读；节点还没有记录entry或者key已经删除时返回false
+ */
+static bool
+order_value(shm_map_t *map, H_order_node *node, shm_map_kv *kv){
+	unsigned int 	*seq_p, *access_p, seq;
+	H_entry 		*t;
+	H_bulk 			*hdr;
+	m_off_t 		offset;
+	int 			bulk_count = 0, slot_idx;
+	bool 			found;
+
+	for(;;){
+		offset = shm_load_acquire(&node->entry);
+		if(offset == NIL)
+			return false;
+		t = (H_entry *)try_get_ptr(map->pool, offset, ENTRY_HEADER_SIZE);
+		if(t == NULL)
+			return false;
+		if(map->flags & SHM_MAP_SWISS_INDEX){
+			slot_idx = swiss_entry_slot(map, t->hash, offset);
+			if(slot_idx == NIL){
+				// 整理在替换slot和节点中的entry之间
+				if(shm_load_acquire(&node->entry) != offset)
+					continue;
+				return false;
+			}
+			seq_p = &map->swiss_seq[slot_idx / MAP_GROUP_SLOTS];
+			access_p = &map->swiss_slots[slot_idx].access;
+		}else{
+			bulk_count = shm_load_acquire(&map->grow_info->bulk_count);
+			hdr = get_bulk(map, index_for(t->hash, bulk_count));
+			seq_p = &hdr->seq;
+			access_p = &hdr->access;
+		}
+		seq = seq_read_begin(map, seq_p, t->hash);
+		found = !entry_expired(map, t) && entry_scan(map, t, kv);
+		if(!shm_seq_read_retry(seq_p, seq) && shm_load_acquire(&node->entry) == offset
+				&& ((map->flags & SHM_MAP_SWISS_INDEX) || shm_load_relaxed(&map->grow_info->bulk_count) == bulk_count))
+			break;
+	}
+	return found && cache_hit(map, t, access_p);
+}
+
+/* 从node开始沿最底层收集key，到hi或者不再以前缀开头时停止，期间被删除的key跳过 */
+static int
+order_collect(shm_map_t *map, H_order_node *node, const char *hi, int hi_len, bool prefix, shm_map_kv *kvs, int n){
+	m_off_t 	offset;
+	char 		*key;
+	int 		cnt = 0;
+
+	while(node != NULL && cnt < n){
+		key = order_key(node);
+		if(prefix){
+			if(node->key_len < hi_len || (hi_len > 0 && memcmp(key, hi, hi_len) != 0))
+				break;
+		}else if(hi != NULL && key_cmp(key, node->key_len, hi, hi_len) >= 0){
+			break;
+		}
+		if(order_value(map, node, &kvs[cnt]))
+			cnt++;
+		offset = shm_load_acquire(&node->next[0]);
+		node = offset == NIL ? NULL : (H_order_node *)get_ptr(map->pool, offset);
+	}
+	return cnt;
+}
+
+int
+shm_map_range(shm_map_t *map, const void *lo, size_t lo_len, const void *hi, size_t hi_len, shm_map_kv *kvs, int n){
+	H_order_node *node;
+
+	if(!(map->flags & SHM_MAP_ORDERED_INDEX) || lo_len >= INT_MAX || hi_len >= INT_MAX)
+		return -1;
+	node = order_seek(map, (const char *)lo, lo == NULL ? 0 : (int)lo_len, false, NULL);
+	return order_collect(map, node, (const char *)hi, (int)hi_len, false, kvs, n);
+}
+
+int
+shm_map_prefix(shm_map_t *map, const void *p, size_t p_len, const void *after, size_t after_len, shm_map_kv *kvs, int n){
+	H_order_node *node;
+
+	if(!(map->flags & SHM_MAP_ORDERED_INDEX) || p_len >= INT_MAX || after_len >= INT_MAX)
+		return -1;
+	if(after != NULL && key_cmp((const char *)after, (int)after_len, (const char *)p, (int)p_len) >= 0)
+		node = order_seek(map, (const char *)after, (int)after_len, true, NULL);
+	else
+		node = order_seek(map, (const char *)p, (int)p_len, false, NULL);
+	return order_collect(map, node, (const char *)p, (int)p_len, true, kvs, n);
+}
+
+//**********************缓存模式**********************//
+
+/*
+ * 从时钟指针开始检查budget个桶(swiss table为slot)，删除其中过期的key
+ * evict为true时按CLOCK淘汰：访问位为1的清0，给它第二次机会；访问位为0的桶中的key全部淘汰。访问位记在桶上，负载因子不大时
+ * 一个桶中通常只有一两个key。entry_len不为0时只看能空出entry_len、value_len大小的块的key，其他的key既不淘汰也不清访问位，
+ * 需要的块很少见、指针转得很快时，不会让其他key提前过期
+ * return: 删除的key的个数
+ */
+static int
+cache_sweep(shm_map_t *map, int budget, bool evict, int entry_len, int value_len){
+	H_bulk 		*hdr;
+	H_entry 	*t;
+	m_off_t 	offset, next_offset;
+	unsigned int *access_p;
+	int 		idx, count, removed = 0;
+	bool 		victim, fit, fits;
+
+	for(; budget>0; budget--){
+		count = (map->flags & SHM_MAP_SWISS_INDEX) ? map->bulk_list_len : map->grow_info->bulk_count;
+		if(map->clock_hand >= count)
+			map->clock_hand = 0;
+		idx = map->clock_hand++;
+		if(map->flags & SHM_MAP_SWISS_INDEX){
+			if(map->swiss_ctrl[idx] & MAP_CTRL_EMPTY)
+				continue;
+			access_p = &map->swiss_slots[idx].access;
+			t = (H_entry *)get_ptr(map->pool, map->swiss_slots[idx].entry_offset);
+			fits = evict && cache_victim_fits(map, t, entry_len, value_len);
+			victim = fits && shm_load_relaxed(access_p) == 0;
+			if(fits)
+				shm_store_relaxed(access_p, 0);
+			if((victim || entry_expired(map, t)) && cache_evict(map, t))
+				removed++;
+			continue;
+		}
+		hdr = get_bulk(map, idx);
+		if(hdr->size == 0)
+			continue;
+		victim = evict && shm_load_relaxed(&hdr->access) == 0;
+		fits = false;
+		for(offset=hdr->header_offset; offset!=NIL; offset=next_offset){
+			t = (H_entry *)get_ptr(map->pool, offset);
+			// 删除t时它的块可能被立即回收，先记下下一个entry
+			next_offset = t->next_offset;
+			fit = evict && cache_victim_fits(map, t, entry_len, value_len);
+			fits = fits || fit;
+			if(((fit && victim) || entry_expired(map, t)) && cache_evict(map, t))
+				removed++;
+		}
+		if(fits)
+			shm_store_relaxed(&hdr->access, 0);
+	}
+	return removed;
+}
+
+/*
+ * 淘汰t是否能空出写入需要的块：块实际可用的大小不小于需要的大小就能用于分配
+ * 写入需要单独的value块时，t的value也要是单独分配的，entry块、value块分别比较
+ */
+static bool
+cache_victim_fits(shm_map_t *map, H_entry *t, int entry_len, int value_len){
+	if(m_usable_size(map->pool, t) < entry_len)
+		return false;
+	if(value_len == 0)
+		return true;
+	return !entry_value_inline(map, t, t->value_offset) && m_usable_size(map->pool, get_ptr(map->pool, t->value_offset)) >= value_len;
+}
+
+/*
+ * 按CLOCK淘汰n个key，每次检查MAP_EVICT_SCAN个桶(swiss table为slot)。内存用满之后空闲的块分散在各级中，
+ * 只有空出同样大小的块才能写入，先在MAP_EVICT_FIT_SCAN*n个桶中只淘汰能空出entry_len、value_len大小的块的key，
+ * 被淘汰的块在读者退出之后才回收，找到的不够n个也先重试写入。一个都没有时不限制大小淘汰，
+ * 转两圈后所有的访问位都被清0过，一定能找到可以淘汰的key
+ */
+static void
+cache_make_room(shm_map_t *map, int n, int entry_len, int value_len){
+	int64_t limit;
+	int 	count, scanned, removed = 0;
+
+	count = (map->flags & SHM_MAP_SWISS_INDEX) ? map->bulk_list_len : map->grow_info->bulk_count;
+	limit = (int64_t)MAP_EVICT_FIT_SCAN * n;
+	if(limit > 2 * (int64_t)count)
+		limit = 2 * (int64_t)count;
+	for(scanned=0; removed<n && scanned<limit; scanned+=MAP_EVICT_SCAN)
+		removed += cache_sweep(map, MAP_EVICT_SCAN, true, entry_len, value_len);
+	if(removed > 0)
+		return;
+	for(scanned=0; removed<n && scanned<2*count; scanned+=MAP_EVICT_SCAN)
+		removed += cache_sweep(map, MAP_EVICT_SCAN, true, 0, 0);
+}
+
+/*
+ * 删除entry t对应的key
+ * t被摘除后m_retire可能立即回收它的块，之后有序索引、修改日志还要用到key，先把key拷贝出来
+ */
+static bool
+cache_evict(shm_map_t *map, H_entry *t){
+	char 	buf[128], *k = buf;
+	int 	k_len = t->key_len;
+	bool 	ret;
+
+	if(k_len > (int)sizeof(buf)){
+		k = (char *)malloc(k_len);
+		if(k == NULL){
+			map->log(SHMMAP_LOG_ERROR, "[cache_evict]Can't allocate memory for a key of %d bytes", k_len);
+			return false;
+		}
+	}
+	memcpy(k, get_ptr(map->pool, t->key_offset), k_len);
+	ret = map_remove_entry(map, k, k_len, NULL, 0);
+	if(k != buf)
+		free(k);
+	return ret;
+}
+
+bool
+shm_map_put_ttl(shm_map_t *map, const void *k, size_t k_len, const void *v, size_t v_len, int ttl){
+	char *old_val;
+	bool ret;
+
+	if(!(map->flags & SHM_MAP_CACHE)){
+		map->log(SHMMAP_LOG_ERROR, "[map_put_ttl]Keys can expire only in a map with SHM_MAP_CACHE");
+		return false;
+	}
+	if(k_len >= INT_MAX || v_len >= INT_MAX){
+		map->log(SHMMAP_LOG_ERROR, "[map_put_ttl]The key or value is too large");
+		return false;
+	}
+	map->put_expire = ttl > 0 ? (unsigned int)time(NULL) + ttl : 0;
+	ret = map_put_entry(map, key_hash(map, (const char *)k, k_len), (const char *)k, k_len, (const char *)v, v_len, &old_val);
+	map->put_expire = 0;
+	return ret;
+}
+
+//**********************在线整理**********************//
+
+/*
+ * entry t单独分配的value位于limit之后时，拷贝到limit之前的块中，旧的value延迟回收
+ * 调用者持有t所在桶(组)的写锁，seq_p是保护t的顺序锁
+ */
+static void
+value_compact(shm_map_t *map, H_entry *t, m_off_t limit, unsigned int *seq_p){
+	m_off_t value_offset = t->value_offset;
+	char 	*old_val, *val_ptr;
+	int 	v_len;
+
+	if(value_offset < limit || entry_value_inline(map, t, value_offset))
+		return;
+	old_val = (char *)get_ptr(map->pool, value_offset);
+	v_len = block_hdr(old_val)->data_len;
+	val_ptr = (char *)m_alloc_below(map->pool, v_len, limit);
+	if(val_ptr == NULL)
+		return;
+	memcpy(val_ptr, old_val, v_len);
+	block_hdr(val_ptr)->data_len = v_len;
+	shm_seq_write_begin(seq_p);
+	shm_store_release(&t->value_offset, ptr_offset(map->pool, val_ptr));
+	shm_seq_write_end(seq_p);
+	m_retire(map->pool, old_val);
+}
+
+/*
+ * entry t位于limit之后时，把整个entry块(包括key和块内的value)拷贝到limit之前
+ * return: 还没有链入索引的新entry，不需要搬或者没有空间时返回NULL
+ */
+static H_entry*
+entry_compact(shm_map_t *map, H_entry *t, m_off_t limit){
+	m_off_t entry_offset = ptr_offset(map->pool, t), new_offset;
+	H_entry *entry;
+	int 	entry_len;
+
+	if(entry_offset < limit)
+		return NULL;
+	entry_len = block_hdr(t)->data_len;
+	entry = (H_entry *)m_alloc_below(map->pool, entry_len, limit);
+	if(entry == NULL)
+		return NULL;
+	memcpy(entry, t, entry_len);
+	block_hdr(entry)->data_len = entry_len;
+	new_offset = ptr_offset(map->pool, entry);
+	entry->key_offset = t->key_offset - entry_offset + new_offset;
+	if(entry_value_inline(map, t, t->value_offset))
+		entry->value_offset = t->value_offset - entry_offset + new_offset;
+	return entry;
+}
+
+/*
+ * 整理第idx个桶，新的entry替换旧的entry在链表中的位置，旧的块延迟回收。
+ * 正在遍历这个桶的读者通过桶的seq发现修改后重读
+ */
+static void
+bulk_compact(shm_map_t *map, int idx, m_off_t limit){
+	H_lock_stripe 	*stripe = NULL;
+	H_bulk 			*hdr;
+	H_entry 		*t, *entry;
+	m_off_t 		offset, next_offset, entry_offset;
+
+	if(map->flags & SHM_MAP_MULTI_WRITER)
+		stripe = stripe_lock(map, idx);
+	hdr = get_bulk(map, idx);
+	offset = hdr->size == 0 ? NIL : hdr->header_offset;
+	while(offset != NIL){
+		t = (H_entry *)get_ptr(map->pool, offset);
+		// t被m_retire后它的块可能被立即回收，又被下一个entry_compact分配出去，先记下下一个entry
+		next_offset = t->next_offset;
+		value_compact(map, t, limit, &hdr->seq);
+		entry = entry_compact(map, t, limit);
+		if(entry != NULL){
+			entry_offset = ptr_offset(map->pool, entry);
+			shm_seq_write_begin(&hdr->seq);
+			if(t->prev_offset == NIL)
+				shm_store_release(&hdr->header_offset, entry_offset);
+			else
+				shm_store_release(&((H_entry *)get_ptr(map->pool, t->prev_offset))->next_offset, entry_offset);
+			if(next_offset == NIL)
+				hdr->tail_offset = entry_offset;
+			else
+				((H_entry *)get_ptr(map->pool, next_offset))->prev_offset = entry_offset;
+			shm_seq_write_end(&hdr->seq);
+			order_move(map, entry);
+			m_retire(map->pool, t);
+		}
+		offset = next_offset;
+	}
+	if(stripe != NULL)
+		m_mutex_unlock(&stripe->mutex);
+}
+
+/* 整理swiss table的一个slot，slot指向新的entry */
+static void
+swiss_compact(shm_map_t *map, int slot_idx, m_off_t limit){
+	H_lock_stripe 	*stripe = NULL;
+	unsigned int 	*seq_p = &map->swiss_seq[slot_idx / MAP_GROUP_SLOTS];
+	H_entry 		*t, *entry;
+
+	if(map->flags & SHM_MAP_MULTI_WRITER)
+		stripe = stripe_lock(map, 0);
+	if(!(shm_load_relaxed(&map->swiss_ctrl[slot_idx]) & MAP_CTRL_EMPTY)){
+		t = (H_entry *)get_ptr(map->pool, map->swiss_slots[slot_idx].entry_offset);
+		value_compact(map, t, limit, seq_p);
+		entry = entry_compact(map, t, limit);
+		if(entry != NULL){
+			shm_seq_write_begin(seq_p);
+			shm_store_release(&map->swiss_slots[slot_idx].entry_offset, ptr_offset(map->pool, entry));
+			shm_seq_write_end(seq_p);
+			order_move(map, entry);
+			m_retire(map->pool, t);
+		}
+	}
+	if(stripe != NULL)
+		m_mutex_unlock(&stripe->mutex);
+}
+
+int64_t
+shm_map_compact(shm_map_t *map, int budget){
+	M_mem_info 	info;
+	int 		n, end;
+	int64_t 	released;
+
+	intent_begin(map, MAP_INTENT_ALL, 0);
+	if(map->compact_limit == 0){
+		// 先归还上一轮搬走的块，再按空闲块的多少确定本轮的整理区：堆尾部的一段，大小是空闲块的一半
+		m_reclaim(map->pool);
+		released = m_shrink(map->pool);
+		m_memory_info(map->pool, &info);
+		if(info.allocated_area_free_size < MAP_COMPACT_MIN_FREE){
+			intent_end(map);
+			return released;
+		}
+		map->compact_limit = info.allocated_area_size - info.allocated_area_free_size / 2;
+		map->compact_cursor = 0;
+	}
+	end = (map->flags & SHM_MAP_SWISS_INDEX) ? map->bulk_list_len : shm_load_acquire(&map->grow_info->bulk_count);
+	for(n=0; n<budget && map->compact_cursor<end; n++, map->compact_cursor++){
+		if(map->flags & SHM_MAP_SWISS_INDEX)
+			swiss_compact(map, map->compact_cursor, map->compact_limit);
+		else
+			bulk_compact(map, map->compact_cursor, map->compact_limit);
+	}
+	if(map->compact_cursor < end){
+		intent_end(map);
+		return 0;
+	}
+	// 一轮结束，搬走的块在读者离开后回到空闲块链，尾部的run变成空闲的，还给未分配区
+	map->compact_limit = 0;
+	m_reclaim(map->pool);
+	released = m_shrink(map->pool);
+	intent_end(map);
+	return released;
+}
+
+int64_t
+shm_map_trim(shm_map_t *map){
+	int64_t released;
+
+	intent_begin(map, MAP_INTENT_ALL, 0);
+	released = m_trim(map->pool);
+	intent_end(map);
+	return released;
+}
+
+//**********************swiss table索引**********************//
+
+/* 组内控制字节等于c的slot的位图 */
+static inline unsigned int
+group_match(const unsigned char *ctrl, unsigned char c){
+#ifdef __SSE2__
+	__m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+	return (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)c)));
+#else
+	unsigned int i, mask = 0;
+	for(i=0; i<MAP_GROUP_SLOTS; i++){
+		if(shm_load_relaxed(&ctrl[i]) == c)
+			mask |= 1u << i;
+	}
+	return mask;
+#endif
+}
+
+/* h对应的第一个组，hash值的低7位作为控制字节，剩下的位决定组 */
+static inline int
+swiss_group(shm_map_t *map, int h){
+	return ((unsigned int)h >> 7) & (map->swiss_group_len - 1);
+}
+
+static inline unsigned char
+swiss_tag(int h){
+	return (unsigned char)(h & 0x7f);
+}
+
+static void
+swiss_init(shm_map_t *map, void *p, bool is_inited){
+	map->swiss_group_len = map->bulk_list_len / MAP_GROUP_SLOTS;
+	map->swiss_ctrl = (unsigned char *)p;
+	map->swiss_seq = (unsigned int *)(map->swiss_ctrl + map->bulk_list_len);
+	map->swiss_slots = (H_slot *)(((uintptr_t)(map->swiss_seq + map->swiss_group_len) + 7) & ~(uintptr_t)7);
+	if(!is_inited){
+		memset(map->swiss_ctrl, MAP_CTRL_EMPTY, map->bulk_list_len);
+		memset(map->swiss_seq, 0, sizeof(int) * map->swiss_group_len);
+	}
+}
+
+/*
+ * 在swiss table中查找k，组之间按照三角数序列探测(1, 3, 6, 10...)，
+ * 组的个数是2的幂，可以遍历所有的组。遇到有空slot的组时说明k不存在。
+ * slot_p: 返回k所在的slot
+ */
+static H_entry*
+swiss_find(shm_map_t *map, int h, const char *k, int k_len, int *slot_p){
+	unsigned char 	tag = swiss_tag(h);
+	unsigned int 	match;
+	int 			g = swiss_group(map, h), step, slot_idx;
+	const unsigned char *ctrl;
+	H_entry 		*t;
+
+	for(step=0; step<map->swiss_group_len; step++){
+		ctrl = map->swiss_ctrl + g * MAP_GROUP_SLOTS;
+		match = group_match(ctrl, tag);
+		// 控制字节之后才能读slot
+		shm_smp_rmb();
+		while(match != 0){
+			slot_idx = g * MAP_GROUP_SLOTS + __builtin_ctz(match);
+			if(map->swiss_slots[slot_idx].hash == h){
+				t = (H_entry *)get_ptr(map->pool, map->swiss_slots[slot_idx].entry_offset);
+				if(entry_key_equal(map, t, k, k_len)){
+					if(slot_p != NULL)
+						*slot_p = slot_idx;
+					return t;
+				}
+			}
+			match &= match - 1;
+		}
+		if(group_match(ctrl, MAP_CTRL_EMPTY) != 0)
+			return NULL;
+		g = (g + step + 1) & (map->swiss_group_len - 1);
+	}
+	return NULL;
+}
+
+static H_entry*
+swiss_get_entry(shm_map_t *map, int h, const char *k, int k_len){
+	H_entry *t;
+	int 	slot_idx;
+
+	t = swiss_find(map, h, k, k_len, &slot_idx);
+	if(t != NULL && !cache_hit(map, t, &map->swiss_slots[slot_idx].access))
+		return NULL;
+	return t;
+}
+
+/* 沿h的探测序列找到指向offset处entry的slot，只比较slot中的偏移量，不比较key。没有时返回NIL */
+static int
+swiss_entry_slot(shm_map_t *map, int h, m_off_t offset){
+	unsigned char 	tag = swiss_tag(h);
+	unsigned int 	match;
+	int 			g = swiss_group(map, h), step, slot_idx;
+	const unsigned char *ctrl;
+
+	for(step=0; step<map->swiss_group_len; step++){
+		ctrl = map->swiss_ctrl + g * MAP_GROUP_SLOTS;
+		match = group_match(ctrl, tag);
+		shm_smp_rmb();
+		while(match != 0){
+			slot_idx = g * MAP_GROUP_SLOTS + __builtin_ctz(match);
+			if(shm_load_relaxed(&map->swiss_slots[slot_idx].entry_offset) == offset)
+				return slot_idx;
+			match &= match - 1;
+		}
+		if(group_match(ctrl, MAP_CTRL_EMPTY) != 0)
+			return NIL;
+		g = (g + step + 1) & (map->swiss_group_len - 1);
+	}
+	return NIL;
+}
+
+static bool
+swiss_put(shm_map_t *map, int h, const char *k, int k_len, const char *v, int v_len, int *size_p, char **old_p){
+	int 			free_slot;
+	H_entry 		*t;
+
+	*old_p = NULL;
+	t = swiss_find(map, h, k, k_len, &free_slot);
+	if(t != NULL){
+		*old_p = entry_set_value(map, t, v, v_len, &map->swiss_seq[free_slot / MAP_GROUP_SLOTS]);
+		if(*old_p != NULL){
+			map->swiss_slots[free_slot].access = 1;
+			order_set_entry(map, t);
+		}
+		return *old_p != NULL;
+	}
+
+	if(shm_map_size(map) >= MAP_SWISS_MAX_LOAD(map->bulk_list_len)){
+		if(!(map->flags & SHM_MAP_CACHE))
+			map->log(SHMMAP_LOG_ERROR, "[swiss_put]The swiss index is full, capacity is %d", MAP_SWISS_MAX_LOAD(map->bulk_list_len));
+		return false;
+	}
+	free_slot = swiss_free_slot(map, h);
+	if(free_slot == NIL){
+		map->log(SHMMAP_LOG_ERROR, "[swiss_put]No free slot in swiss index");
+		return false;
+	}
+
+	t = entry_new(map, h, k, k_len, v, v_len);
+	if(t == NULL)
+		return false;
+	swiss_set_slot(map, free_slot, h, t);
+	order_set_entry(map, t);
+	(*size_p)++;
+	return true;
+}
+
+/* 沿着探测序列找到第一个空的或者被删除的slot，没有时返回NIL */
+static int
+swiss_free_slot(shm_map_t *map, int h){
+	unsigned int 	match;
+	int 			g = swiss_group(map, h), step;
+	const unsigned char *ctrl;
+
+	for(step=0; step<map->swiss_group_len; step++){
+		ctrl = map->swiss_ctrl + g * MAP_GROUP_SLOTS;
+		match = group_match(ctrl, MAP_CTRL_EMPTY) | group_match(ctrl, MAP_CTRL_DELETED);
+		if(match != 0)
+			return g * MAP_GROUP_SLOTS + __builtin_ctz(match);
+		g = (g + step + 1) & (map->swiss_group_len - 1);
+	}
+	return NIL;
+}
+
+static void
+swiss_set_slot(shm_map_t *map, int slot_idx, int h, H_entry *t){
+	H_slot *slot = &map->swiss_slots[slot_idx];
+
+	slot->hash = h;
+	// 新写入的key和被读到的一样，时钟指针第一次经过时不淘汰
+	slot->access = 1;
+	slot->entry_offset = ptr_offset(map->pool, t);
+	// slot写完后才写控制字节，读者看到控制字节时slot一定是完整的
+	shm_store_release(&map->swiss_ctrl[slot_idx], swiss_tag(h));
+}
+
+/*
+ * 从swiss table中删除k
+ * 组内还有空的slot时，没有key的探测序列经过这个组，slot可以直接标记为空；
+ * 否则标记为删除，查找时继续探测，插入时可以重用。
+ */
+static bool
+swiss_remove(shm_map_t *map, int h, const char *k, int k_len, const char *v, int v_len, int *size_p){
+	H_entry 	*t;
+	int 		slot_idx, g;
+	unsigned char c;
+
+	t = swiss_find(map, h, k, k_len, &slot_idx);
+	if(t == NULL || (v != NULL && !entry_value_equal(map, t, v, v_len)))
+		return false;
+	g = slot_idx / MAP_GROUP_SLOTS;
+	c = group_match(map->swiss_ctrl + g * MAP_GROUP_SLOTS, MAP_CTRL_EMPTY) != 0 ? MAP_CTRL_EMPTY : MAP_CTRL_DELETED;
+	shm_seq_write_begin(&map->swiss_seq[g]);
+	shm_store_release(&map->swiss_ctrl[slot_idx], c);
+	shm_seq_write_end(&map->swiss_seq[g]);
+	(*size_p)--;
+	entry_retire(map, t);
+	// 多写者时其他写者可能正在沿着探测序列插入，只在单写者时清理
+	if(c == MAP_CTRL_DELETED && !(map->flags & SHM_MAP_MULTI_WRITER)
+			&& ++map->swiss_deleted > map->bulk_list_len / MAP_SWISS_PURGE_RATIO)
+		swiss_purge(map);
+	return true;
+}
+
+/*
+ * 删除和插入反复进行时，删除标记会占满所有的组，查找不存在的key要探测整个表。
+ * 每个key从它的起始组探测到所在的组，经过的组都要保留删除标记；
+ * 其他组里的删除标记可以直接改成空，读者在这些组里停止探测也不会漏掉key。
+ * 只有写者会插入，清理期间探测路径不会变化。
+ */
+static void
+swiss_purge(shm_map_t *map){
+	unsigned char 	*passed;
+	int 			i, g, step, target, h;
+
+	// 留下的删除标记不计数，否则它们接近阈值时每次删除都要清理一遍
+	map->swiss_deleted = 0;
+	passed = (unsigned char *)calloc(map->swiss_group_len, 1);
+	if(passed == NULL)
+		return;
+	for(i=0; i<map->bulk_list_len; i++){
+		if(map->swiss_ctrl[i] & MAP_CTRL_EMPTY)
+			continue;
+		h = map->swiss_slots[i].hash;
+		target = i / MAP_GROUP_SLOTS;
+		g = swiss_group(map, h);
+		for(step=0; g!=target && step<map->swiss_group_len; step++){
+			passed[g] = 1;
+			g = (g + step + 1) & (map->swiss_group_len - 1);
+		}
+	}
+	for(i=0; i<map->bulk_list_len; i++){
+		if(map->swiss_ctrl[i] == MAP_CTRL_DELETED && !passed[i / MAP_GROUP_SLOTS])
+			shm_store_release(&map->swiss_ctrl[i], MAP_CTRL_EMPTY);
+	}
+	free(passed);
+}
+
+/* 在swiss table中查找k，并把value拷贝到buf中，value被替换时按照组的seq重读 */
+static int
+swiss_copy_value(shm_map_t *map, int h, const char *k, int k_len, char *buf, int buf_len){
+	unsigned char 	tag = swiss_tag(h);
+	unsigned int 	match, seq;
+	int 			g = swiss_group(map, h), step, slot_idx, ret;
+	const unsigned char *ctrl;
+	H_entry 		*t;
+
+	for(step=0; step<map->swiss_group_len; step++){
+		ctrl = map->swiss_ctrl + g * MAP_GROUP_SLOTS;
+		match = group_match(ctrl, tag);
+		shm_smp_rmb();
+		while(match != 0){
+			slot_idx = g * MAP_GROUP_SLOTS + __builtin_ctz(match);
+			do{
+				seq = seq_read_begin(map, &map->swiss_seq[g], h);
+				ret = -1;
+				// 匹配控制字节在seq之外，key可能在这之后被删除，entry已经回收，slot中留下的是旧的偏移量
+				if(shm_load_acquire(&map->swiss_ctrl[slot_idx]) != tag)
+					continue;
+				t = (H_entry *)try_get_ptr(map->pool, map->swiss_slots[slot_idx].entry_offset, ENTRY_HEADER_SIZE);
+				if(t != NULL && map->swiss_slots[slot_idx].hash == h && entry_key_equal(map, t, k, k_len)
+						&& cache_hit(map, t, &map->swiss_slots[slot_idx].access))
+					ret = entry_copy_value(map, t, buf, buf_len);
+			}while(shm_seq_read_retry(&map->swiss_seq[g], seq));
+			if(ret >= 0)
+				return ret;
+			match &= match - 1;
+		}
+		if(group_match(ctrl, MAP_CTRL_EMPTY) != 0)
+			return -1;
+		g = (g + step + 1) & (map->swiss_group_len - 1);
+	}
+	return -1;
+}
+
+//**********************崩溃恢复、快照**********************//
+
+/*
+ * 单写者模式下记录写者的意图。进程只会在指令之间退出，只需要保证意图在修改之前写入、在修改之后清除
+ * 多写者模式下由健壮锁发现写者退出
+ */
+static void
+intent_begin(shm_map_t *map, int intent, int h){
+	H_change_info *change = map->change;
+
+	if(map->flags & SHM_MAP_MULTI_WRITER)
+		return;
+	change->intent_hash = h;
+	change->intent_pid = map->pid;
+	change->intent_start = map->pid_start;
+	change->intent = intent;
+	shm_smp_wmb();
+}
+
+/* 进程的启动时间(/proc/pid/stat的第22项)，读不到时返回0 */
+static uint64_t
+proc_start_time(int pid){
+	char 				path[64], buf[1024], *p;
+	unsigned long long 	start;
+	ssize_t 			n;
+	int 				fd, i;
+
+	snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+	fd = open(path, O_RDONLY);
+	if(fd == -1)
+		return 0;
+	n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if(n <= 0)
+		return 0;
+	buf[n] = 0;
+	// 进程名在括号中，可能包含空格，从最后一个')'之后开始数
+	p = strrchr(buf, ')');
+	if(p == NULL)
+		return 0;
+	for(i=2; i<22 && p!=NULL; i++)
+		p = strchr(p + 1, ' ');
+	if(p == NULL || sscanf(p + 1, "%llu", &start) != 1)
+		return 0;
+	return start;
+}
+
+/* 记录意图的写者是否还在运行，pid被其他进程重用时启动时间不同 */
+static bool
+writer_alive(int pid, uint64_t start){
+	uint64_t now_start;
+
+	if(pid == 0 || (kill(pid, 0) == -1 && errno == ESRCH))
+		return false;
+	now_start = proc_start_time(pid);
+	return start == 0 || now_start == 0 || now_start == start;
+}
+
+static void
+intent_end(shm_map_t *map){
+	if(map->flags & SHM_MAP_MULTI_WRITER)
+		return;
+	shm_smp_wmb();
+	map->change->intent = MAP_INTENT_NONE;
+}
+
+/*
+ * 打开已经存在的数据文件时检查意图记录
+ * 写者在修改过程中退出：修复内存池，以及意图记录的桶所在的分段，完成中断的分裂，重新计算key的个数
+ * 同时发现写者退出的进程在数据文件的flock上排队，只有第一个进行恢复，其他的等它恢复完才返回。
+ * 恢复的进程退出时flock自动释放，下一个进程重新恢复。
+ */
+static bool
+map_recover(shm_map_t *map){
+	H_change_info 	*change = map->change;
+	H_stripe_arg 	arg;
+	int 			intent, pid;
+	int 			i, total, split_to;
+
+	// 没有意图，或者写者还在修改
+	if(shm_load_acquire(&change->intent) == MAP_INTENT_NONE || writer_alive(change->intent_pid, change->intent_start))
+		return true;
+	if(flock(map->fd, LOCK_EX) != 0){
+		map->log(SHMMAP_LOG_ERROR, "[map_recover]Lock the data file error, msg: %s", strerror(errno));
+		return false;
+	}
+	// 等到锁时其他进程可能已经恢复完，新的写者也可能已经开始修改
+	intent = shm_load_acquire(&change->intent);
+	pid = change->intent_pid;
+	split_to = map->grow_info->split_to;
+	if(intent == MAP_INTENT_NONE || writer_alive(pid, change->intent_start)){
+		flock(map->fd, LOCK_UN);
+		return true;
+	}
+	map->log(SHMMAP_LOG_WARN, "[map_init]The writer(pid: %d) exited while modifying the map, recover it", pid);
+	m_recover(map->pool);
+	arg.map = map;
+	for(i=0; i<map->lock_stripe_len; i++){
+		if(intent == MAP_INTENT_ALL || i == stripe_index(map, change->intent_hash)
+				|| (split_to != NIL && i == stripe_index(map, split_to))){
+			arg.stripe = &map->lock_stripes[i];
+			stripe_recover(&arg);
+		}
+	}
+	// 分裂所在的分段已经在上面恢复，stripe_recover同时完成了分裂
+	if(map->grow_info->split_to != NIL)
+		split_redo(map);
+	if(map->flags & SHM_MAP_SWISS_INDEX){
+		*map->size = map->lock_stripes[0].size;
+	}else{
+		for(i=0, total=0; i<map->grow_info->bulk_count; i++)
+			total += get_bulk(map, i)->size;
+		*map->size = total;
+	}
+	// 写者可能在两个索引之间退出，有序索引按照hash索引重建
+	if((map->flags & SHM_MAP_ORDERED_INDEX) && !order_rebuild(map))
+		map->log(SHMMAP_LOG_ERROR, "[map_init]Rebuild the ordered index error, range queries may miss keys");
+	shm_store_release(&change->intent, MAP_INTENT_NONE);
+	flock(map->fd, LOCK_UN);
+	return true;
+}
+
+/* 缓存模式下key紧跟在过期时间之后，由扫描得到的key读出它的过期时间 */
+static inline unsigned int
+kv_expire(const shm_map_kv *kv){
+	return shm_load_relaxed((unsigned int *)((char *)kv->k - sizeof(unsigned int)));
+}
+
+/*
+ * 按桶的版本复制：用扫描游标逐个桶(组)在seq的保护下读出key、value，桶在读的过程中被修改就重新读，
+ * 再写入path.tmp上新建的map，最后和shm_map_build一样msync之后改名。不获取任何锁，写者和读者照常运行
+ */
+bool
+shm_map_snapshot(shm_map_t *map, const char *path){
+	shm_map_t 		*snap;
+	shm_map_cursor 	cur;
+	shm_map_kv 		kvs[MAP_SNAPSHOT_BATCH];
+	char 			*tmp_path;
+	int 			i, n, capacity;
+	bool 			ok = true;
+
+	tmp_path = (char *)malloc(strlen(path) + 5);
+	if(tmp_path == NULL){
+		map->log(SHMMAP_LOG_ERROR, "[shm_map_snapshot]Can't allocate memory for path");
+		return false;
+	}
+	sprintf(tmp_path, "%s.tmp", path);
+	unlink(tmp_path);
+	// 新文件的桶数、内存池大小和标志都与原map相同
+	capacity = (map->flags & SHM_MAP_SWISS_INDEX) ? MAP_SWISS_MAX_LOAD(map->bulk_list_len) : map->bulk_list_len;
+	snap = map_open(capacity, map->shm_size - map->pool_offset, tmp_path, -1, map->log, map->flags);
+	if(snap == NULL){
+		free(tmp_path);
+		return false;
+	}
+	shm_map_scan_init(map, &cur, 0, 1);
+	do{
+		if(!shm_map_reader_enter(map)){
+			ok = false;
+			break;
+		}
+		n = shm_map_scan(map, &cur, kvs, MAP_SNAPSHOT_BATCH);
+		for(i=0; i<n && ok; i++){
+			snap->put_expire = (map->flags & SHM_MAP_CACHE) ? kv_expire(&kvs[i]) : 0;
+			ok = shm_map_put2(snap, kvs[i].k, kvs[i].k_len, kvs[i].v, kvs[i].v_len);
+		}
+		shm_map_reader_exit(map);
+	}while(n > 0 && ok);
+	snap->put_expire = 0;
+	if(!ok)
+		map->log(SHMMAP_LOG_ERROR, "[shm_map_snapshot]Copy the keys to %s error", tmp_path);
+	// 文件写到磁盘之后再改名，path不会是不完整的快照
+	ok = ok && build_publish(snap, tmp_path, path);
+	if(!ok)
+		unlink(tmp_path);
+	shm_map_close(snap);
+	free(tmp_path);
+	return ok;
+}
+
+//**********************修改通知**********************//
+
+static long
+futex(unsigned int *addr, int op, unsigned int val, const struct timespec *timeout){
+	return syscall(SYS_futex, addr, op, val, timeout, NULL, 0);
+}
+
+/*
+ * 写者修改map之后增加版本号，有读者在等待时唤醒它们
+ * 版本号和waiters的读写都是seq_cst的：要么写者看到等待者，要么等待者看到新的版本号
+ */
+static void
+map_notify(shm_map_t *map){
+	__atomic_fetch_add(&map->change->version, 1, __ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&map->change->waiters, __ATOMIC_SEQ_CST) > 0)
+		futex(&map->change->version, FUTEX_WAKE, INT_MAX, NULL);
+}
+
+unsigned int
+shm_map_version(shm_map_t *map){
+	return shm_load_acquire(&map->change->version);
+}
+
+unsigned int
+shm_map_wait_change(shm_map_t *map, unsigned int last_version, int timeout_ms){
+	H_change_info 	*change = map->change;
+	struct timespec ts, deadline, *ts_p = NULL;
+	unsigned int 	version;
+
+	version = __atomic_load_n(&change->version, __ATOMIC_SEQ_CST);
+	if(version != last_version || timeout_ms == 0)
+		return version;
+	if(timeout_ms > 0){
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += timeout_ms / 1000;
+		deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+		if(deadline.tv_nsec >= 1000000000L){
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+		ts_p = &ts;
+	}
+	__atomic_fetch_add(&change->waiters, 1, __ATOMIC_SEQ_CST);
+	while((version = __atomic_load_n(&change->version, __ATOMIC_SEQ_CST)) == last_version){
+		if(ts_p != NULL){
+			// FUTEX_WAIT的超时是相对时间，被信号或者虚假唤醒打断后按剩余的时间继续等待
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			ts.tv_sec = deadline.tv_sec - ts.tv_sec;
+			ts.tv_nsec = deadline.tv_nsec - ts.tv_nsec;
+			if(ts.tv_nsec < 0){
+				ts.tv_sec--;
+				ts.tv_nsec += 1000000000L;
+			}
+			if(ts.tv_sec < 0)
+				break;
+		}
+		// 版本号已经不是last_version时内核直接返回EAGAIN
+		if(futex(&change->version, FUTEX_WAIT, last_version, ts_p) == -1 && errno == ETIMEDOUT)
+			break;
+	}
+	__atomic_fetch_sub(&change->waiters, 1, __ATOMIC_SEQ_CST);
+	return __atomic_load_n(&change->version, __ATOMIC_SEQ_CST);
+}
+
+//**********************修改日志**********************//
+
+/*
+ * 单写者、多读者的环形缓冲区。写者先把log_reserve推进到记录的结束位置，再写记录，最后推进log_head；
+ * 读者不修改共享内存，各自保存游标，复制完记录后检查log_reserve，判断复制期间记录是否被覆盖。
+ * 记录中保存key的内容而不是entry的偏移量：读者读到记录时，entry可能已经被删除并回收。
+ */
+static void
+log_append(shm_map_t *map, int op, const void *k, size_t k_len){
+	H_change_info 	*change = map->change;
+	char 			*ring = (char *)get_ptr(map->pool, change->log_offset);
+	H_log_record 	rec;
+	uint64_t 		head = change->log_head, len;
+
+	len = sizeof(H_log_record) + ((k_len + 7) & ~(size_t)7);
+	if(len > change->log_size / 2){
+		// 记录太大：跳过一圈多，所有读者都会发现溢出并重新同步
+		head += change->log_size + 8;
+		shm_store_relaxed(&change->log_reserve, head);
+		shm_store_release(&change->log_head, head);
+		return;
+	}
+	shm_store_relaxed(&change->log_reserve, head + len);
+	shm_smp_wmb();
+	rec.version = change->version + 1;
+	rec.op = op;
+	rec.key_len = (unsigned int)k_len;
+	rec.padding = 0;
+	log_copy_in(change, ring, head, &rec, sizeof(rec));
+	log_copy_in(change, ring, head + sizeof(rec), k, k_len);
+	shm_store_release(&change->log_head, head + len);
+}
+
+static void
+log_copy_in(H_change_info *change, char *ring, uint64_t pos, const void *src, size_t len){
+	size_t off = pos & (change->log_size - 1), first = change->log_size - off;
+
+	if(first > len)
+		first = len;
+	memcpy(ring + off, src, first);
+	memcpy(ring, (const char *)src + first, len - first);
+}
+
+static void
+log_copy_out(H_change_info *change, const char *ring, uint64_t pos, void *dst, size_t len){
+	size_t off = pos & (change->log_size - 1), first = change->log_size - off;
+
+	if(first > len)
+		first = len;
+	memcpy(dst, ring + off, first);
+	memcpy((char *)dst + first, ring, len - first);
+}
+
+bool
+shm_map_log_start(shm_map_t *map, shm_map_log_cursor *cur){
+	if(!(map->flags & SHM_MAP_CHANGE_LOG))
+		return false;
+	cur->pos = shm_load_acquire(&map->change->log_head);
+	return true;
+}
+
+int
+shm_map_log_next(shm_map_t *map, shm_map_log_cursor *cur, shm_map_log_rec *rec, void *k_buf, size_t buf_len){
+	H_change_info 	*change = map->change;
+	const char 		*ring;
+	H_log_record 	r;
+	uint64_t 		head, size = change->log_size;
+
+	if(!(map->flags & SHM_MAP_CHANGE_LOG)){
+		map->log(SHMMAP_LOG_ERROR, "[map_log_next]The map has no change log, open it with SHM_MAP_CHANGE_LOG");
+		return MAP_LOG_NO_LOG;
+	}
+	ring = (const char *)get_ptr(map->pool, change->log_offset);
+	head = shm_load_acquire(&change->log_head);
+	if(head == cur->pos)
+		return MAP_LOG_EMPTY;
+	if(head - cur->pos > size)
+		return MAP_LOG_OVERFLOW;
+	log_copy_out(change, ring, cur->pos, &r, sizeof(r));
+	// 写者可能同时在覆盖这条记录，确认没有被覆盖之后才能使用记录中的长度
+	shm_smp_rmb();
+	if(shm_load_relaxed(&change->log_reserve) - cur->pos > size)
+		return MAP_LOG_OVERFLOW;
+	rec->version = r.version;
+	rec->op = r.op;
+	rec->key_len = r.key_len;
+	if(r.key_len > buf_len)
+		return MAP_LOG_SMALL_BUF;
+	log_copy_out(change, ring, cur->pos + sizeof(r), k_buf, r.key_len);
+	shm_smp_rmb();
+	if(shm_load_relaxed(&change->log_reserve) - cur->pos > size)
+		return MAP_LOG_OVERFLOW;
+	cur->pos += sizeof(r) + ((r.key_len + 7) & ~(size_t)7);
+	return MAP_LOG_OK;
+}
+
+//**********************批量构建**********************//
+
+/* hash值为h的key所在的分区，分区按桶(swiss table按组)的下标连续划分 */
+static int
+build_part(H_build_ctx *ctx, int h){
+	shm_map_t 	*map = ctx->map;
+	int64_t 	idx, len;
+
+	if(map->flags & SHM_MAP_SWISS_INDEX){
+		idx = swiss_group(map, h);
+		len = map->swiss_group_len;
+	}else{
+		idx = index_for(h, map->grow_info->bulk_count);
+		len = map->grow_info->bulk_count;
+	}
+	return (int)(idx * ctx->threads / len);
+}
+
+/* 用ctx->threads个线程执行fn，创建线程失败时在当前线程中执行 */
+static bool
+build_run(H_build_ctx *ctx, void *(*fn)(void *)){
+	pthread_t 	*tids;
+	H_build_arg *args;
+	bool 		*started;
+	int 		i;
+
+	tids = (pthread_t *)malloc(sizeof(pthread_t) * ctx->threads);
+	args = (H_build_arg *)malloc(sizeof(H_build_arg) * ctx->threads);
+	started = (bool *)malloc(sizeof(bool) * ctx->threads);
+	if(tids == NULL || args == NULL || started == NULL){
+		ctx->map->log(SHMMAP_LOG_ERROR, "[shm_map_build]Can't allocate memory for threads");
+		free(tids);
+		free(args);
+		free(started);
+		return false;
+	}
+	for(i=0; i<ctx->threads; i++){
+		args[i].ctx = ctx;
+		args[i].id = i;
+		started[i] = pthread_create(&tids[i], NULL, fn, &args[i]) == 0;
+		if(!started[i])
+			fn(&args[i]);
+	}
+	for(i=0; i<ctx->threads; i++){
+		if(started[i])
+			pthread_join(tids[i], NULL);
+	}
+	free(tids);
+	free(args);
+	free(started);
+	return true;
+}
+
+/* 计算一段输入的hash值，统计它们在各个分区中的个数 */
+static void*
+build_hash(void *arg){
+	H_build_ctx *ctx = ((H_build_arg *)arg)->ctx;
+	int 		id = ((H_build_arg *)arg)->id;
+	int 		i, end = (int)((int64_t)ctx->n * (id + 1) / ctx->threads);
+	int 		*counts = ctx->counts + id * ctx->threads;
+
+	for(i=(int)((int64_t)ctx->n * id / ctx->threads); i<end; i++){
+		ctx->hashes[i] = key_hash(ctx->map, (const char *)ctx->kvs[i].k, (int)ctx->kvs[i].k_len);
+		counts[build_part(ctx, ctx->hashes[i])]++;
+	}
+	return NULL;
+}
+
+/* 把一段输入的下标写到各个分区中，分区内保持输入的顺序 */
+static void*
+build_scatter(void *arg){
+	H_build_ctx *ctx = ((H_build_arg *)arg)->ctx;
+	int 		id = ((H_build_arg *)arg)->id;
+	int 		i, end = (int)((int64_t)ctx->n * (id + 1) / ctx->threads);
+	int 		*pos = ctx->counts + id * ctx->threads;
+
+	for(i=(int)((int64_t)ctx->n * id / ctx->threads); i<end; i++)
+		ctx->order[pos[build_part(ctx, ctx->hashes[i])]++] = i;
+	return NULL;
+}
+
+/*
+ * 填写一个分区中的entry，链表索引时同时链入桶中
+ * 分区包含连续的桶，线程之间不会修改同一个桶；map还没有发布，不需要顺序锁
+ */
+static void*
+build_link(void *arg){
+	H_build_ctx 	*ctx = ((H_build_arg *)arg)->ctx;
+	shm_map_t 		*map = ctx->map;
+	int 			id = ((H_build_arg *)arg)->id;
+	int 			j, i, h, size = 0;
+	const shm_map_kv *kv;
+	H_entry 		*entry, *t;
+	H_bulk 			*hdr;
+	m_off_t 		entry_offset;
+
+	for(j=ctx->part_start[id]; j<ctx->part_start[id + 1]; j++){
+		i = ctx->order[j];
+		h = ctx->hashes[i];
+		kv = &ctx->kvs[i];
+		entry = ctx->entries[j];
+		entry_fill(map, entry, h, (const char *)kv->k, (int)kv->k_len, (const char *)kv->v, (int)kv->v_len);
+		if(map->flags & SHM_MAP_SWISS_INDEX)
+			continue;
+		ctx->entries[j] = NULL;
+		hdr = get_bulk(map, index_for(h, map->grow_info->bulk_count));
+		entry_offset = ptr_offset(map->pool, entry);
+		for(t=hdr->size ? (H_entry *)get_ptr(map->pool, hdr->header_offset) : NULL; t!=NULL; t=next_entry(map, t)){
+			if(t->hash == h && entry_key_equal(map, t, (const char *)kv->k, (int)kv->k_len))
+				break;
+		}
+		if(t != NULL){
+			// 后面的key替换前面的，新的entry占据旧entry在链表中的位置
+			entry->prev_offset = t->prev_offset;
+			entry->next_offset = t->next_offset;
+			if(t->prev_offset == NIL)
+				hdr->header_offset = entry_offset;
+			else
+				((H_entry *)get_ptr(map->pool, t->prev_offset))->next_offset = entry_offset;
+			if(t->next_offset == NIL)
+				hdr->tail_offset = entry_offset;
+			else
+				((H_entry *)get_ptr(map->pool, t->next_offset))->prev_offset = entry_offset;
+			ctx->entries[j] = t;
+			continue;
+		}
+		if(hdr->size == 0){
+			hdr->header_offset = entry_offset;
+		}else{
+			entry->prev_offset = hdr->tail_offset;
+			((H_entry *)get_ptr(map->pool, hdr->tail_offset))->next_offset = entry_offset;
+		}
+		hdr->tail_offset = entry_offset;
+		hdr->size++;
+		size++;
+	}
+	ctx->part_size[id] = size;
+	return NULL;
+}
+
+/* swiss table的探测序列跨越分区，entry填好之后由一个线程按顺序插入 */
+static bool
+build_swiss(H_build_ctx *ctx){
+	shm_map_t 		*map = ctx->map;
+	int 			j, i, h, slot_idx, size = 0;
+	const shm_map_kv *kv;
+	H_entry 		*entry, *t;
+
+	for(j=0; j<ctx->n; j++){
+		i = ctx->order[j];
+		h = ctx->hashes[i];
+		kv = &ctx->kvs[i];
+		entry = ctx->entries[j];
+		ctx->entries[j] = NULL;
+		t = swiss_find(map, h, (const char *)kv->k, (int)kv->k_len, &slot_idx);
+		if(t != NULL){
+			map->swiss_slots[slot_idx].entry_offset = ptr_offset(map->pool, entry);
+			ctx->entries[j] = t;
+			continue;
+		}
+		slot_idx = swiss_free_slot(map, h);
+		if(slot_idx == NIL || size >= MAP_SWISS_MAX_LOAD(map->bulk_list_len)){
+			map->log(SHMMAP_LOG_ERROR, "[shm_map_build]The swiss index is full, capacity is %d", MAP_SWISS_MAX_LOAD(map->bulk_list_len));
+			// 还没有插入的entry也由调用者释放
+			ctx->entries[j] = entry;
+			return false;
+		}
+		swiss_set_slot(map, slot_idx, h, entry);
+		size++;
+	}
+	for(i=0; i<ctx->threads; i++)
+		ctx->part_size[i] = 0;
+	ctx->part_size[0] = size;
+	return true;
+}
+
+/* 释放被替换的entry，以及出错时还没有链入的entry */
+static void
+build_free(H_build_ctx *ctx){
+	shm_map_t 	*map = ctx->map;
+	H_entry 	*t;
+	int 		j;
+
+	for(j=0; j<ctx->n; j++){
+		t = ctx->entries[j];
+		if(t == NULL)
+			continue;
+		if(!entry_value_inline(map, t, t->value_offset))
+			m_free(map->pool, get_ptr(map->pool, t->value_offset));
+		m_free(map->pool, t);
+		ctx->entries[j] = NULL;
+	}
+}
+
+/*
+ * 发布新文件：新文件的代数是旧文件的加1，msync之后改名替换旧文件，
+ * 再把旧文件标记为被替换，增加它的版本号，唤醒等待修改的读者
+ */
+static bool
+build_publish(shm_map_t *map, const char *build_path, const char *path){
+	H_file_header 	header;
+	H_map_layout 	layout;
+	H_change_info 	*old_change = NULL;
+	int 			fd, ints[4];
+	size_t 			offset, page = (size_t)sysconf(_SC_PAGESIZE), map_off = 0, map_len = 0;
+	char 			*p = NULL;
+
+	fd = open(path, O_RDWR);
+	if(fd != -1 && pread(fd, &header, sizeof(header), 0) == sizeof(header)
+			&& pread(fd, ints, sizeof(ints), sizeof(header)) == sizeof(ints)
+			&& header.magic == MAP_MAGIC && header.version == MAP_FORMAT_VERSION){
+		map_layout(ints[0], ints[1], &layout);
+		offset = layout.change;
+		map_off = offset & ~(page - 1);
+		map_len = offset + sizeof(H_change_info) - map_off;
+		p = (char *)mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, map_off);
+		if(p == MAP_FAILED){
+			map->log(SHMMAP_LOG_WARN, "[shm_map_build]Map the old data file error, path: %s, msg: %s", path, strerror(errno));
+			p = NULL;
+		}else{
+			old_change = (H_change_info *)(p + offset - map_off);
+			map->change->generation = old_change->generation + 1;
+		}
+	}else if(fd != -1){
+		map->log(SHMMAP_LOG_WARN, "[shm_map_build]The old data file is not a map of version %d, replace it anyway, path: %s",
+			MAP_FORMAT_VERSION, path);
+	}
+	if(msync(map->shm, map->shm_size, MS_SYNC) != 0 || rename(build_path, path) != 0){
+		map->log(SHMMAP_LOG_ERROR, "[shm_map_build]Publish %s error, msg: %s", build_path, strerror(errno));
+		if(p != NULL)
+			munmap(p, map_len);
+		if(fd != -1)
+			close(fd);
+		return false;
+	}
+	if(old_change != NULL){
+		shm_store_release(&old_change->superseded, 1);
+		__atomic_fetch_add(&old_change->version, 1, __ATOMIC_SEQ_CST);
+		futex(&old_change->version, FUTEX_WAKE, INT_MAX, NULL);
+		munmap(p, map_len);
+	}
+	if(fd != -1)
+		close(fd);
+	return true;
+}
+
+bool
+shm_map_build(int capacity, size_t mem_size, const char *dat_file_path, shmmap_log log, int flags,
+		const shm_map_kv *kvs, int n, int threads){
+	H_build_ctx 	ctx;
+	shm_map_t 		*map;
+	char 			*build_path;
+	int 			i, j, p, pos, size;
+	bool 			ok = false;
+
+	if(log == NULL){
+		log = default_shmmap_log;
+	}
+	if(flags & (SHM_MAP_MEMFD | SHM_MAP_POSIX_SHM)){
+		log(SHMMAP_LOG_ERROR, "[shm_map_build]Only data files can be built and replaced");
+		return false;
+	}
+	if(dat_file_path == NULL){
+		dat_file_path = DATA_FILE;
+	}
+	if(threads <= 0)
+		threads = 1;
+	if(n < 0)
+		n = 0;
+	build_path = (char *)malloc(strlen(dat_file_path) + 7);
+	if(build_path == NULL){
+		log(SHMMAP_LOG_ERROR, "[shm_map_build]Can't allocate memory for path");
+		return false;
+	}
+	sprintf(build_path, "%s.build", dat_file_path);
+	unlink(build_path);
+	map = map_open(capacity, mem_size, build_path, -1, log, flags);
+	if(map == NULL){
+		free(build_path);
+		return false;
+	}
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.map = map;
+	ctx.kvs = kvs;
+	ctx.n = n;
+	ctx.threads = threads;
+	ctx.hashes = (int *)malloc(sizeof(int) * (size_t)n + 1);
+	ctx.order = (int *)malloc(sizeof(int) * (size_t)n + 1);
+	ctx.entries = (H_entry **)calloc((size_t)n + 1, sizeof(H_entry *));
+	ctx.part_start = (int *)calloc(threads + 1, sizeof(int));
+	ctx.counts = (int *)calloc((size_t)threads * threads, sizeof(int));
+	ctx.part_size = (int *)calloc(threads, sizeof(int));
+	if(ctx.hashes == NULL || ctx.order == NULL || ctx.entries == NULL || ctx.part_start == NULL
+			|| ctx.counts == NULL || ctx.part_size == NULL){
+		log(SHMMAP_LOG_ERROR, "[shm_map_build]Can't allocate memory for %d keys", n);
+		goto out;
+	}
+
+	// 先分裂空的桶，让链表的长度和逐个put时相同，分区按最终的桶划分
+	if(map->flags & SHM_MAP_GROWABLE){
+		while(n > map->grow_info->bulk_count * MAP_LOAD_FACTOR && bulk_split(map));
+	}
+	// 并行地计算hash值，按分区计数排序
+	if(!build_run(&ctx, build_hash))
+		goto out;
+	for(p=0, pos=0; p<threads; p++){
+		ctx.part_start[p] = pos;
+		for(i=0; i<threads; i++){
+			size = ctx.counts[i * threads + p];
+			ctx.counts[i * threads + p] = pos;
+			pos += size;
+		}
+	}
+	ctx.part_start[threads] = pos;
+	if(!build_run(&ctx, build_scatter))
+		goto out;
+	// 按分区的顺序分配，同一个分区的entry在内存中是连续的
+	for(j=0; j<n; j++){
+		i = ctx.order[j];
+		ctx.entries[j] = entry_alloc(map, (int)kvs[i].k_len, (int)kvs[i].v_len);
+		if(ctx.entries[j] == NULL)
+			goto out;
+	}
+	if(!build_run(&ctx, build_link))
+		goto out;
+	if((map->flags & SHM_MAP_SWISS_INDEX) && !build_swiss(&ctx))
+		goto out;
+	for(p=0, size=0; p<threads; p++)
+		size += ctx.part_size[p];
+	if(map->flags & SHM_MAP_MULTI_WRITER){
+		if(map->flags & SHM_MAP_SWISS_INDEX){
+			map->lock_stripes[0].size = size;
+		}else{
+			for(i=0; i<map->grow_info->bulk_count; i++)
+				map->lock_stripes[stripe_index(map, i)].size += get_bulk(map, i)->size;
+		}
+	}else{
+		*map->size = size;
+	}
+	// 发布之后其他进程可能开始写新文件，被替换的entry要在发布之前释放
+	build_free(&ctx);
+	if((map->flags & SHM_MAP_ORDERED_INDEX) && !order_rebuild(map))
+		goto out;
+	ok = build_publish(map, build_path, dat_file_path);
+
+out:
+	if(ctx.entries != NULL)
+		build_free(&ctx);
+	if(!ok)
+		unlink(build_path);
+	shm_map_close(map);
+	free(ctx.hashes);
+	free(ctx.order);
+	free(ctx.entries);
+	free(ctx.part_start);
+	free(ctx.counts);
+	free(ctx.part_size);
+	free(build_path);
+	return ok;
+}
+
+unsigned int
+shm_map_generation(shm_map_t *map){
+	return shm_load_relaxed(&map->change->generation);
+}
+
+int
+shm_map_reload(shm_map_t *map){
+	shm_map_t *new_map, tmp;
+
+	if(!shm_load_acquire(&map->change->superseded) || map->path == NULL)
+		return 0;
+	new_map = map_open(map->capacity, map->mem_size, map->path, -1, map->log, map->open_flags);
+	if(new_map == NULL)
+		return -1;
+	// 交换两个句柄的内容，调用者的map指向新的映射，再关闭旧的映射
+	tmp = *map;
+	*map = *new_map;
+	*new_map = tmp;
+	shm_map_close(new_map);
+	return 1;
+}
+
+//**********************批量操作**********************//
+
+/*
+ * 预取hash值h的查找路径上第level层的内存，调用者按层依次预取一组key，
+ * 预取第level层时前一层已经在cache中，读偏移量不会再等待cache miss。
+ * 链表索引: 0为桶，1为桶中第一个entry和它之后的key，
+ * 		2为第一个entry的指纹不匹配时的下一个entry，匹配时为单独分配的value的块头
+ * swiss table: 0为第一组控制字节，1为第一个匹配的slot，2为slot指向的entry和key
+ * 读到的偏移量可能正在被写者修改，只用来预取，不解引用非法的地址
+ */
+static void
+batch_prefetch(shm_map_t *map, int h, int level){
+	unsigned int 	match;
+	int 			g, slot_idx;
+	H_bulk 			*hdr;
+	H_entry 		*t;
+	void 			*p;
+
+	if(map->flags & SHM_MAP_SWISS_INDEX){
+		g = swiss_group(map, h);
+		if(level == 0){
+			__builtin_prefetch(map->swiss_ctrl + g * MAP_GROUP_SLOTS);
+			return;
+		}
+		match = group_match(map->swiss_ctrl + g * MAP_GROUP_SLOTS, swiss_tag(h));
+		if(match == 0)
+			return;
+		slot_idx = g * MAP_GROUP_SLOTS + __builtin_ctz(match);
+		if(level == 1){
+			__builtin_prefetch(&map->swiss_slots[slot_idx]);
+			return;
+		}
+		p = try_get_ptr(map->pool, shm_load_relaxed(&map->swiss_slots[slot_idx].entry_offset), ENTRY_HEADER_SIZE);
+		if(p != NULL){
+			__builtin_prefetch(p);
+			__builtin_prefetch((char *)p + ENTRY_HEADER_SIZE);
+		}
+		return;
+	}
+	hdr = get_bulk(map, index_for(h, shm_load_relaxed(&map->grow_info->bulk_count)));
+	if(level == 0){
+		__builtin_prefetch(hdr);
+		return;
+	}
+	if(shm_load_relaxed(&hdr->size) == 0)
+		return;
+	t = (H_entry *)try_get_ptr(map->pool, shm_load_relaxed(&hdr->header_offset), ENTRY_HEADER_SIZE);
+	if(t == NULL)
+		return;
+	// entry和key相邻，但entry在块头之后，key通常落在下一个cache line
+	if(level == 1){
+		__builtin_prefetch(t);
+		__builtin_prefetch((char *)t + ENTRY_HEADER_SIZE);
+		return;
+	}
+	if(t->hash != h){
+		t = (H_entry *)try_get_ptr(map->pool, shm_load_relaxed(&t->next_offset), ENTRY_HEADER_SIZE);
+		if(t != NULL){
+			__builtin_prefetch(t);
+			__builtin_prefetch((char *)t + ENTRY_HEADER_SIZE);
+		}
+		return;
+	}
+	p = try_get_ptr(map->pool, shm_load_relaxed(&t->value_offset) - BLOCK_HEADER_SIZE, BLOCK_HEADER_SIZE);
+	if(p != NULL)
+		__builtin_prefetch(p);
+}
+
+int
+shm_map_get_many(shm_map_t *map, int n, const void * const *keys, const size_t *k_lens, const void **vals, size_t *v_lens){
+	int 	hs[MAP_BATCH_GROUP];
+	int 	i, j, m, level, len, found = 0;
+	H_entry *t;
+	char 	*val_ptr;
+
+	for(i=0; i<n; i+=MAP_BATCH_GROUP){
+		m = n - i < MAP_BATCH_GROUP ? n - i : MAP_BATCH_GROUP;
+		// 一组key先全部算出hash值，再逐层预取，同一层的cache miss同时进行
+		for(j=0; j<m; j++)
+			hs[j] = k_lens[i+j] < INT_MAX ? key_hash(map, (const char *)keys[i+j], k_lens[i+j]) : 0;
+		for(level=0; level<MAP_BATCH_LEVELS; level++){
+			for(j=0; j<m; j++)
+				batch_prefetch(map, hs[j], level);
+		}
+		for(j=0; j<m; j++){
+			vals[i+j] = NULL;
+			v_lens[i+j] = 0;
+			if(k_lens[i+j] >= INT_MAX)
+				continue;
+			t = map_get_entry(map, hs[j], (const char *)keys[i+j], k_lens[i+j]);
+			if(t == NULL || (val_ptr = entry_value(map, t, &len)) == NULL)
+				continue;
+			vals[i+j] = val_ptr;
+			v_lens[i+j] = len - 1;
+			found++;
+		}
+	}
+	return found;
+}
+
+int
+shm_map_put_many(shm_map_t *map, int n, const void * const *keys, const size_t *k_lens, const void * const *vals, const size_t *v_lens){
+	int 	hs[MAP_BATCH_GROUP];
+	int 	i, j, m, level, done = 0;
+	char 	*old_val;
+
+	for(i=0; i<n; i+=MAP_BATCH_GROUP){
+		m = n - i < MAP_BATCH_GROUP ? n - i : MAP_BATCH_GROUP;
+		for(j=0; j<m; j++)
+			hs[j] = k_lens[i+j] < INT_MAX ? key_hash(map, (const char *)keys[i+j], k_lens[i+j]) : 0;
+		// 写入只需要桶和已有的entry，不预取value
+		for(level=0; level<MAP_BATCH_LEVELS-1; level++){
+			for(j=0; j<m; j++)
+				batch_prefetch(map, hs[j], level);
+		}
+		for(j=0; j<m; j++){
+			if(k_lens[i+j] >= INT_MAX || v_lens[i+j] >= INT_MAX){
+				map->log(SHMMAP_LOG_ERROR, "[shm_map_put_many]The key or value is too large");
+				continue;
+			}
+			if(map_put_entry(map, hs[j], (const char *)keys[i+j], k_lens[i+j], (const char *)vals[i+j], v_lens[i+j], &old_val))
+				done++;
+		}
+	}
+	return done;
+}
+
+//**********************旧的接口，操作map_init打开的map**********************//
+
+bool
+map_init(int capacity, size_t mem_size, const char *dat_file_path, shmmap_log log){
+	return map_init_opt(capacity, mem_size, dat_file_path, log, 0);
+}
+
+bool
+map_init_opt(int capacity, size_t mem_size, const char *dat_file_path, shmmap_log log, int flags){
+	shm_map_close(default_map);
+	default_map = shm_map_open(capacity, mem_size, dat_file_path, log, flags);
+	return default_map != NULL;
+}
+
+shm_map_t*
+map_default(){
+	return default_map;
+}
+
+char*
+map_put(const char *k, const char *v){
+	return shm_map_put(default_map, k, v);
+}
+
+char*
+map_get(const char *k){
+	return shm_map_get(default_map, k);
+}
+
+int
+map_get_copy(const char *k, char *buf, int buf_len){
+	return shm_map_get_copy(default_map, k, buf, buf_len);
+}
+
+bool
+map_put2(const void *k, size_t k_len, const void *v, size_t v_len){
+	return shm_map_put2(default_map, k, k_len, v, v_len);
+}
+
+bool
+map_put_ttl(const void *k, size_t k_len, const void *v, size_t v_len, int ttl){
+	return shm_map_put_ttl(default_map, k, k_len, v, v_len, ttl);
+}
+
+bool
+map_get2(const void *k, size_t k_len, const void **v, size_t *v_len){
+	return shm_map_get2(default_map, k, k_len, v, v_len);
+}
+
+int
+map_get_many(int n, const void * const *keys, const size_t *k_lens, const void **vals, size_t *v_lens){
+	return shm_map_get_many(default_map, n, keys, k_lens, vals, v_lens);
+}
+
+int
+map_put_many(int n, const void * const *keys, const size_t *k_lens, const void * const *vals, const size_t *v_lens){
+	return shm_map_put_many(default_map, n, keys, k_lens, vals, v_lens);
+}
+
+bool
+map_remove(const char *k){
+	return shm_map_remove(default_map, k);
+}
+
+bool
+map_remove2(const void *k, size_t k_len){
+	return shm_map_remove2(default_map, k, k_len);
+}
+
+bool
+map_remove_if(const void *k, size_t k_len, const void *v, size_t v_len){
+	return shm_map_remove_if(default_map, k, k_len, v, v_len);
+}
+
+bool
+map_reader_enter(){
+	return shm_map_reader_enter(default_map);
+}
+
+void
+map_reader_exit(){
+	shm_map_reader_exit(default_map);
+}
+
+unsigned int
+map_generation(){
+	return shm_map_generation(default_map);
+}
+
+int
+map_reload(){
+	return shm_map_reload(default_map);
+}
+
+bool
+map_snapshot(const char *path){
+	return shm_map_snapshot(default_map, path);
+}
+
+unsigned int
+map_version(){
+	return shm_map_version(default_map);
+}
+
+unsigned int
+map_wait_change(unsigned int last_version, int timeout_ms){
+	return shm_map_wait_change(default_map, last_version, timeout_ms);
+}
+
+bool
+map_log_start(shm_map_log_cursor *cur){
+	return shm_map_log_start(default_map, cur);
+}
+
+int
+map_log_next(shm_map_log_cursor *cur, shm_map_log_rec *rec, void *k_buf, size_t buf_len){
+	return shm_map_log_next(default_map, cur, rec, k_buf, buf_len);
+}
+
+int
+map_size(){
+	return shm_map_size(default_map);
+}
+
+bool
+map_contains(const char *k){
+	return shm_map_contains(default_map, k);
+}
+
+void
+map_iter(key_iter it){
+	shm_map_iter(default_map, it);
+}
+
+void
+map_scan_init(shm_map_cursor *cur, int part, int parts){
+	shm_map_scan_init(default_map, cur, part, parts);
+}
+
+int
+map_scan(shm_map_cursor *cur, shm_map_kv *kvs, int batch){
+	return shm_map_scan(default_map, cur, kvs, batch);
+}
+
+int
+map_range(const void *lo, size_t lo_len, const void *hi, size_t hi_len, shm_map_kv *kvs, int n){
+	return shm_map_range(default_map, lo, lo_len, hi, hi_len, kvs, n);
+}
+
+int
+map_prefix(const void *p, size_t p_len, const void *after, size_t after_len, shm_map_kv *kvs, int n){
+	return shm_map_prefix(default_map, p, p_len, after, after_len, kvs, n);
+}
@@ -12,58 +12,560 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/vfs.h>
+#include <sys/socket.h>
+#include <sys/file.h>
 #include <assert.h>
 #include <errno.h>
+#include <stddef.h>
+#include <limits.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 #include "m_pool.h"
+#include "shm_atomic.h"
 
 #define FILE_MODE   (S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)
 #define DATA_FILE "shm_map.dat"
+/* 多写者模式下锁的分段数，每个分段保护一段连续的桶 */
+#define MAP_LOCK_STRIPES 256
+/* 多写者模式下，读者等待奇数的seq超过该次数时，检查持有锁的写者是否已经退出 */
+#define MAP_SEQ_SPINS 100000
+/* 扩容时新增的桶按segment从内存池中分配，每个segment包含的桶数 */
+#define MAP_SEGMENT_LEN 4096
+/* 扩容最多新增的segment个数，实际的上限还受内存池大小限制 */
+#define MAP_MAX_SEGMENTS 16384
+/* 平均每个桶中的key超过该值时开始扩容 */
+#define MAP_LOAD_FACTOR 1
+/* 每次map_put最多分裂的桶数，扩容的代价被分摊到map_put中 */
+#define MAP_SPLITS_PER_PUT 2
+
+/* 数据文件头部的魔数，没有该魔数的是最早的格式(版本0) */
+#define MAP_MAGIC 0x4d485353
+/* 打开其他进程正在创建的数据文件时，等待它写入魔数的最多次数，每次1ms */
+#define MAP_INIT_WAITS 1000
+/*
+ * 数据文件的格式版本
+ * 0: 最早的格式，没有文件头，偏移量是32位的，key的hash为31*h+c，可以用shmmap_convert转换成当前的格式
+ * 1-8: 开发过程中的中间格式，互不兼容，不能打开也不能转换，需要从原始数据重建
+ * 9: 当前的格式，文件头之后是桶(或swiss table)、锁、修改信息、扩容、有序索引的头部，然后是内存池
+ */
+#define MAP_FORMAT_VERSION 9
+
+/* value不超过该长度(包括结尾的0)时和key一起保存在entry的块中，否则单独分配 */
+#define MAP_INLINE_VALUE_MAX 64
+
+/* map_init_opt的flags，创建数据文件时写入文件，之后打开时以文件中的为准 */
+#define SHM_MAP_MULTI_WRITER	0x1		// 允许多个进程同时写
+#define SHM_MAP_LOCKFREE_POOL	0x2		// 内存池使用无锁的空闲块栈和线程私有的magazine，多写者时分配内存不加锁
+#define SHM_MAP_GROWABLE		0x4		// key的个数超过容量后，在线逐个分裂桶进行扩容
+#define SHM_MAP_SWISS_INDEX		0x8		// 使用开放地址的swiss table作为索引，不支持扩容，多写者时写操作共用一把锁
+#define SHM_MAP_CHANGE_LOG		0x10	// 在内存池中分配修改日志的环形缓冲区，记录每次put、remove的key，只支持单写者
+#define SHM_MAP_ORDERED_INDEX	0x20	// 按key的字节序维护一个跳表作为有序索引，支持范围、前缀查询，只支持单写者
+#define SHM_MAP_CACHE			0x40	// 缓存模式：key可以设置过期时间，内存或swiss table用完时按CLOCK淘汰，只支持单写者
+/* 以上的flags保存在数据文件中 */
+#define SHM_MAP_FILE_FLAGS		0xff
+/*
+ * 以下的flags只影响当前进程的映射方式，不写入文件，每次打开时可以不同
+ * SHM_MAP_HUGE_PAGES: 数据文件在hugetlbfs上时映射大小按大页对齐；否则用madvise(MADV_HUGEPAGE)请求透明大页，
+ * 		普通文件系统不支持时只记录日志。大页减少了随机查找时的TLB miss。
+ * SHM_MAP_POPULATE: 用MAP_POPULATE映射，mmap返回时所有页都已经读入
+ * SHM_MAP_PREFAULT: mmap之后用多个线程并行地读入所有页，比MAP_POPULATE更快
+ */
+#define SHM_MAP_HUGE_PAGES		0x100
+#define SHM_MAP_POPULATE		0x200
+#define SHM_MAP_PREFAULT		0x400
+/*
+ * 共享内存的后端，默认是dat_file_path指定的普通文件，脏页会被内核回写到磁盘
+ * SHM_MAP_POSIX_SHM: dat_file_path是shm_open的名字(如"/shmmap")，对象在tmpfs上，不回写磁盘，重启后消失
+ * SHM_MAP_MEMFD: 创建匿名的memfd，dat_file_path只作为名字。其他进程通过unix socket接收描述符，
+ * 		用shm_map_open_fd打开；所有描述符都关闭后数据消失
+ */
+#define SHM_MAP_POSIX_SHM		0x800
+#define SHM_MAP_MEMFD			0x1000
+
+/* SHM_MAP_PREFAULT最多使用的线程数，以及每个线程至少负责的字节数 */
+#define MAP_PREFAULT_THREADS 16
+#define MAP_PREFAULT_MIN_CHUNK (64 << 20)
+/* hugetlbfs的f_type */
+#define MAP_HUGETLBFS_MAGIC 0x958458f6
+
+/* 空闲块少于该值时不整理，整理最多能还给未分配区的也只有这么多 */
+#define MAP_COMPACT_MIN_FREE (M_RUN_PAGES * M_PAGE_SIZE)
+
+/* 批量操作每组同时预取的key数，以及查找路径上预取的层数(桶、entry、value) */
+#define MAP_BATCH_GROUP 16
+#define MAP_BATCH_LEVELS 3
+
+/* shm_map_snapshot每批复制的key数，每批在一次shm_map_reader_enter之内 */
+#define MAP_SNAPSHOT_BATCH 256
+
+/* 修改日志环形缓冲区的字节数，必须是2的幂 */
+#define MAP_LOG_SIZE (1 << 20)
+/* 修改日志记录的操作 */
+#define MAP_LOG_PUT		1
+#define MAP_LOG_REMOVE	2
+/* shm_map_log_next的返回值 */
+#define MAP_LOG_OK			1
+#define MAP_LOG_EMPTY		0
+#define MAP_LOG_OVERFLOW	-1
+#define MAP_LOG_SMALL_BUF	-2
+#define MAP_LOG_NO_LOG		-3
+
+/*
+ * 缓存模式下每次map_put顺带检查MAP_CACHE_SWEEP个桶(swiss table为slot)，回收过期的key；
+ * 写入失败时按CLOCK淘汰key后重试，最多MAP_EVICT_TRIES轮，每次检查MAP_EVICT_SCAN个桶。
+ * 第i轮先在MAP_EVICT_FIT_SCAN*2^i个桶中淘汰至多2^i个能空出同样大小的块的key，一个都没有时再淘汰2^i个任意的key
+ */
+#define MAP_CACHE_SWEEP 2
+#define MAP_EVICT_SCAN 64
+#define MAP_EVICT_TRIES 16
+#define MAP_EVICT_FIT_SCAN 1024
+
+/* 有序索引跳表的最大层数，每层的节点数约为下一层的1/4 */
+#define MAP_ORDER_MAX_LEVEL 24
+
+/*
+ * 写者的意图记录。单写者模式下写者在修改前记录要修改的范围，修改完成后清除；
+ * 打开map时发现记录还在而写者进程已经退出，只修复记录的范围。多写者模式下由健壮锁发现写者退出
+ */
+#define MAP_INTENT_NONE		0
+#define MAP_INTENT_BUCKET	1	// 修改intent_hash所在的桶，以及可能的扩容
+#define MAP_INTENT_ALL		2	// 整理等会修改所有桶的操作
+
+/* swiss table每组slot的个数，一组的控制字节正好可以用一条SSE2指令比较 */
+#define MAP_GROUP_SLOTS 16
+/* swiss table的slot数最多占满7/8 */
+#define MAP_SWISS_MAX_LOAD(n) ((n) - ((n) >> 3))
+/* 控制字节：空的slot、被删除的slot，其他值为hash值的低7位 */
+#define MAP_CTRL_EMPTY		0x80
+#define MAP_CTRL_DELETED	0xFE
+/* 单写者时被删除的slot超过总数的1/MAP_SWISS_PURGE_RATIO，把不在任何key探测路径上的删除标记清空 */
+#define MAP_SWISS_PURGE_RATIO 8
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/*
+ * 数据文件头部
+ * seed: 创建文件时随机生成的hash种子
+ */
+typedef struct file_header {
+	int magic;
+	int version;
+	uint64_t seed;
+} H_file_header;
+
 /*
  * hash链表的节点
+ * hash: 64位hash值折叠成的32位，同时作为指纹，比较key之前先比较它
+ * entry、key和短的value分配在同一个块中：| H_entry | key | value |
+ * 长的value、以及被替换后的value单独分配，value_offset指向它
+ * 缓存模式下entry之后是4字节的过期时间：| H_entry | expire | key | value |
+ * key和value之后都有一个'\0'，可以直接作为字符串使用
  */
 typedef struct entry {
-	int prev_offset;
-	int next_offset;
+	m_off_t prev_offset;
+	m_off_t next_offset;
+	m_off_t key_offset;
+	m_off_t value_offset;
 	int hash;
-	int key_offset;
-	int value_offset;
+	int key_len;		// key的长度(不含结尾的'\0')
 } H_entry;
 
 /*
  * hash的桶
+ * seq: 顺序锁，写者修改桶内的链表或entry的value时，前后各加1
+ * access: CLOCK的访问位，缓存模式下读者命中桶中的key、写者写入桶中的key时置1，写者淘汰时清0。
+ * 		桶和桶的数组不会被回收，读者不在临界区中也可以写
  */
 typedef struct bulk {
-	int header_offset;
-	int tail_offset;
+	m_off_t header_offset;
+	m_off_t tail_offset;
 	int size;
+	unsigned int seq;
+	unsigned int access;
+	int padding;
 } H_bulk;
 
+/*
+ * swiss table的slot
+ * 控制字节、slot、每组的seq分别保存在三个连续的数组中：
+ * 查找时先比较一组控制字节，不存在的key通常只访问一个cache line；
+ * 存在的key再访问slot中的hash值和entry的偏移量。
+ */
+typedef struct slot {
+	int hash;
+	unsigned int access;	// CLOCK的访问位，同H_bulk
+	m_off_t entry_offset;
+} H_slot;
+
+/*
+ * 多写者模式下的锁分段
+ * size: 分段内的桶中key的个数，各个分段分别计数，避免写者竞争同一个计数器
+ */
+typedef struct lock_stripe {
+	pthread_mutex_t mutex;
+	int size;
+} __attribute__((aligned(CACHE_LINE_SIZE))) H_lock_stripe;
+
+/*
+ * 修改通知和修改日志，独占cache line
+ * version: 	每次成功的put、remove之后加1，读者在它上面用futex等待
+ * waiters: 	正在等待的读者数，为0时写者不需要调用futex唤醒。等待中的进程被杀死时不会减1，只是多了唤醒的系统调用
+ * log_head: 	修改日志已经写完的位置，单调增加，对log_size取模得到在环形缓冲区中的位置
+ * log_reserve:	正在写的记录的结束位置。读者读完记录后检查它，超过读的位置一圈说明记录已经被覆盖
+ * log_offset:	环形缓冲区在内存池中的偏移量，没有SHM_MAP_CHANGE_LOG时为NIL
+ * intent:		写者正在进行的修改，MAP_INTENT_*
+ * intent_hash:	MAP_INTENT_BUCKET时被修改的key的hash值
+ * intent_pid:	记录意图的写者进程
+ * intent_start:	写者进程的启动时间，pid被新的进程重用时和它不同，说明写者已经退出
+ * generation:	数据文件的代数，shm_map_build发布的新文件比它替换的文件大1
+ * superseded:	数据文件已经被shm_map_build发布的新文件替换，读者应该调用shm_map_reload
+ */
+typedef struct change_info {
+	unsigned int version;
+	int waiters;
+	uint64_t log_head;
+	uint64_t log_reserve;
+	m_off_t log_offset;
+	uint64_t log_size;
+	int intent;
+	int intent_hash;
+	int intent_pid;
+	unsigned int generation;
+	uint64_t intent_start;
+	int superseded;
+} __attribute__((aligned(CACHE_LINE_SIZE))) H_change_info;
+
+/*
+ * 有序索引，按key的字节序排列的跳表，节点从内存池中分配，之间用偏移量链接
+ * head:	头节点的偏移量，头节点有MAP_ORDER_MAX_LEVEL层，没有key。没有SHM_MAP_ORDERED_INDEX时为NIL
+ * level:	当前使用的最高层数，读者从这一层开始查找
+ */
+typedef struct order_info {
+	m_off_t head;
+	int level;
+	int padding;
+} H_order_info;
+
+/*
+ * 有序索引的节点：| H_order_node | next[level] | key | '\0' |
+ * 节点中保存key的副本，以及key在hash索引中的entry，范围查询直接读entry的value，不再按key查找。
+ * entry在key写入hash索引后才记录，删除、整理搬动entry时由写者更新，为NIL时key不可见。
+ * 写者先填好节点再从下往上逐层链入，删除时从上往下逐层摘除，读者不加锁，只会看到有序的链表
+ */
+typedef struct order_node {
+	int key_len;
+	int level;
+	m_off_t entry;
+	m_off_t next[];
+} H_order_node;
+
+/*
+ * 修改日志中的一条记录，之后是key，按8字节对齐
+ * version: 修改之后map的版本号，和shm_map_version的返回值对应
+ */
+typedef struct log_record {
+	unsigned int version;
+	int op;
+	unsigned int key_len;
+	int padding;
+} H_log_record;
+
+/* 修改日志的读者各自的游标，只保存在读者进程中 */
+typedef struct shm_map_log_cursor {
+	uint64_t pos;
+} shm_map_log_cursor;
+
+/* shm_map_build的输入，shm_map_scan的输出 */
+typedef struct shm_map_kv {
+	const void *k;
+	size_t k_len;
+	const void *v;
+	size_t v_len;
+} shm_map_kv;
+
+/*
+ * 可以恢复的扫描游标，只保存在调用者的进程中
+ * bulk:	当前的初始桶，swiss table为slot
+ * split:	当前是从初始桶分裂出的第几个桶，0是初始桶自己
+ * skip:	当前桶中已经返回的key的个数
+ * end:		扫描范围的结束位置，不包含
+ */
+typedef struct shm_map_cursor {
+	int bulk;
+	int split;
+	int skip;
+	int end;
+} shm_map_cursor;
+
+/* shm_map_log_next读出的记录 */
+typedef struct shm_map_log_rec {
+	unsigned int version;
+	int op;
+	size_t key_len;
+} shm_map_log_rec;
+
+/*
+ * 线性哈希扩容的状态
+ * 初始的bulk_list_len个桶在文件头部，之后分裂出的桶在从内存池分配的segment中。
+ * 桶的个数n在[2^i*bulk_list_len, 2^(i+1)*bulk_list_len)之间时，第n-2^i*bulk_list_len个桶
+ * 是下一个要分裂的桶，它的一部分key被移到新的第n个桶中。
+ * bulk_count: 	当前桶的个数
+ * split_to:	正在分裂出的新桶的下标，NIL表示没有在分裂
+ * split_mutex:	多写者模式下同一时间只有一个写者分裂桶
+ * segments:	segment目录在内存池中的偏移量，目录的第i项是第i个segment的偏移量，没有分配时为0。
+ * 			只有SHM_MAP_GROWABLE的map在创建时分配目录，否则为NIL
+ * segment_max:	目录的项数，按内存池最多能容纳的segment个数计算
+ * split_entry:	分裂时正在从旧桶移到新桶的entry，恢复时它不在任何一个桶中就接回旧桶
+ */
+typedef struct grow_info {
+	int bulk_count;
+	int split_to;
+	pthread_mutex_t split_mutex;
+	m_off_t segments;
+	int segment_max;
+	int padding;
+	m_off_t split_entry;
+} H_grow_info;
+
 typedef void (*key_iter)(const char *k, const char *v);
 
+/* 打开的map的句柄，一个进程可以同时打开多个map */
+typedef struct shm_map shm_map_t;
+
 /*
- * 初始化map
+ * 打开map，数据文件不存在时创建
  * capacity: map的容量
  * mem_size: map占用的内存大小，就是共享内存的大小
  * dat_file_path: 数据文件存储的位置
  * log: 日志handler
+ * flags: SHM_MAP_MULTI_WRITER等选项的组合
+ * return: map的句柄，出错时返回NULL
  */
-bool map_init(int capacity, int mem_size, const char *dat_file_path, shmmap_log log);
+shm_map_t* shm_map_open(int capacity, size_t mem_size, const char *dat_file_path, shmmap_log log, int flags);
+/* 关闭map，释放当前进程中的状态并解除映射，数据文件保持不变 */
+void shm_map_close(shm_map_t *map);
+/* map的内存池，用来查看内存使用状况 */
+M_pool* shm_map_pool(shm_map_t *map);
+
+/*
+ * 映射其他进程发送来的描述符，通常是SHM_MAP_MEMFD创建的memfd
+ * fd: 由返回的map持有，shm_map_close时关闭；出错时也被关闭
+ * capacity、mem_size: 必须与创建时相同
+ */
+shm_map_t* shm_map_open_fd(int fd, int capacity, size_t mem_size, shmmap_log log, int flags);
+/* 通过unix socket把map的描述符发送给其他进程 */
+bool shm_map_send_fd(shm_map_t *map, int sock);
+/* 从unix socket接收shm_map_send_fd发送的描述符，出错时返回-1 */
+int shm_map_recv_fd(int sock, shmmap_log log);
+
+char* shm_map_put(shm_map_t *map, const char *k, const char *v);
+char* shm_map_get(shm_map_t *map, const char *k);
+/*
+ * 把k对应的value拷贝到buf中，读取期间写者修改了对应的桶时会重读，
+ * 保证拿到的是完整的value，而不是被写者释放、重用的内存。
+ * buf_len: buf的大小，value超过buf_len-1时被截断
+ * return: value的长度(不含'\0')，大于等于buf_len表示被截断；k不存在返回-1
+ */
+int shm_map_get_copy(shm_map_t *map, const char *k, char *buf, int buf_len);
+
+/*
+ * 二进制安全的put，key、value按长度处理，可以包含'\0'
+ * return: 分配内存失败等错误时返回false
+ */
+bool shm_map_put2(shm_map_t *map, const void *k, size_t k_len, const void *v, size_t v_len);
+/*
+ * 二进制安全的get，v、v_len返回value在共享内存中的位置和长度，不拷贝
+ * 与shm_map_get一样，需要在shm_map_reader_enter、shm_map_reader_exit之间使用v
+ * return: k不存在时返回false
+ */
+bool shm_map_get2(shm_map_t *map, const void *k, size_t k_len, const void **v, size_t *v_len);
+
+/*
+ * 批量的get2，一组key先全部算出hash值，再逐层预取桶、entry、value，
+ * 多个key的cache miss互相重叠，key多、map远大于cache时比逐个get2快
+ * keys、k_lens: n个key
+ * vals、v_lens: 返回每个key的value在共享内存中的位置和长度，key不存在时为NULL和0
+ * return: 找到的key的个数
+ */
+int shm_map_get_many(shm_map_t *map, int n, const void * const *keys, const size_t *k_lens, const void **vals, size_t *v_lens);
+/*
+ * 批量的put2，先预取一组key所在的桶和entry，再逐个写入
+ * return: 成功写入的个数，某个key写入失败时继续写后面的key
+ */
+int shm_map_put_many(shm_map_t *map, int n, const void * const *keys, const size_t *k_lens, const void * const *vals, const size_t *v_lens);
+
+/*
+ * 缓存模式下带过期时间的put2，ttl秒之后key对读者不可见，之后由写者回收。再次put时过期时间被替换
+ * ttl: 小于等于0时不过期
+ * return: map不是SHM_MAP_CACHE，或者淘汰之后仍然写入失败时返回false
+ */
+bool shm_map_put_ttl(shm_map_t *map, const void *k, size_t k_len, const void *v, size_t v_len, int ttl);
+
+/*
+ * 删除k，entry、key、value的内存在读者都离开后放回内存池
+ * return: k不存在时返回false
+ */
+bool shm_map_remove(shm_map_t *map, const char *k);
+bool shm_map_remove2(shm_map_t *map, const void *k, size_t k_len);
+/*
+ * compare-and-delete: 只有k当前的value等于v时才删除
+ * return: k不存在或者value不相等时返回false
+ */
+bool shm_map_remove_if(shm_map_t *map, const void *k, size_t k_len, const void *v, size_t v_len);
+
+/*
+ * 读者进入、离开临界区。两者之间通过shm_map_get、shm_map_iter拿到的指针不会被写者回收，
+ * 可以直接使用而不需要拷贝。
+ */
+bool shm_map_reader_enter(shm_map_t *map);
+void shm_map_reader_exit(shm_map_t *map);
+
+int shm_map_size(shm_map_t *map);
+bool shm_map_contains(shm_map_t *map, const char *k);
+void shm_map_iter(shm_map_t *map, key_iter it);
+
+/*
+ * 把游标设置到第part份(共parts份)的开头，parts为1时扫描整个map。
+ * 按照初始的桶划分，各份之间没有重复的桶，可以由多个线程并行扫描。
+ */
+void shm_map_scan_init(shm_map_t *map, shm_map_cursor *cur, int part, int parts);
+/*
+ * 从游标处继续扫描，最多把batch个key、value写到kvs中，游标前进。可以随时暂停，之后用同一个游标继续。
+ * 扩容时key只会移到同一个初始桶分裂出的、下标更大的桶中，所以扫描期间一直存在的key至少被返回一次，
+ * 被移动的key可能返回两次，扫描期间增删的key可能返回也可能不返回。
+ * 一个桶中的key多于batch时才会从桶的中间暂停，此时删除这个桶中的key可能使后面的key被跳过。
+ * kvs中的指针指向共享内存，与shm_map_get2一样在shm_map_reader_enter、shm_map_reader_exit之间使用
+ * return: 写到kvs中的个数，0表示游标所在的范围已经扫描完
+ */
+int shm_map_scan(shm_map_t *map, shm_map_cursor *cur, shm_map_kv *kvs, int batch);
+
+/*
+ * 按key的字节序返回[lo, hi)中最多n个key、value，复杂度为O(log n + 返回的个数)
+ * lo为NULL时从最小的key开始，hi为NULL时到最大的key为止。翻页时把上一批最后一个key后面加一个'\0'作为lo
+ * kvs中的指针指向共享内存，在shm_map_reader_enter、shm_map_reader_exit之间使用
+ * return: 写到kvs中的个数，map没有SHM_MAP_ORDERED_INDEX时返回-1
+ */
+int shm_map_range(shm_map_t *map, const void *lo, size_t lo_len, const void *hi, size_t hi_len, shm_map_kv *kvs, int n);
+/*
+ * 按key的字节序返回以p为前缀的最多n个key、value
+ * after: 只返回大于after的key，翻页时传入上一批最后一个key；NULL时从第一个key开始
+ * return: 同shm_map_range
+ */
+int shm_map_prefix(shm_map_t *map, const void *p, size_t p_len, const void *after, size_t after_len, shm_map_kv *kvs, int n);
+
+/*
+ * 把map的副本写到path：在path.tmp上新建一个桶数、内存池大小和标志都相同的map，逐个桶复制，msync之后改名，
+ * path总是一个完整的数据文件，之后可以直接用shm_map_open打开，原来在path的文件被标记为被替换。
+ * 每个桶(组)在seq的保护下复制，复制的是它在某一时刻的内容；不获取任何锁，复制期间写者和读者照常运行。
+ * 整个副本不是同一时刻的：复制期间没有被修改的key一定在副本中，复制期间增删改的key可能是修改前或修改后的状态。
+ * 任何打开map的进程都可以调用，单写者模式下写者线程自己调用时，复制期间它不能写。缓存模式下保留key的过期时间，不保留访问位
+ */
+bool shm_map_snapshot(shm_map_t *map, const char *path);
+
+/*
+ * 离线批量构建：用kvs中的n个key建立一个新的数据文件，然后原子地替换dat_file_path。
+ * 输入按桶分区后，由threads个线程并行地计算hash、填写entry、链入各自分区的桶；只有内存的分配是串行的。
+ * 相同的key以后面的为准。新文件先写在dat_file_path.build，msync之后改名，
+ * 然后把被替换的文件标记为superseded，并唤醒在shm_map_wait_change中等待的读者。
+ * 其他参数和shm_map_open相同，打开新文件的进程需要使用相同的capacity和mem_size。
+ * 只支持普通文件，构建期间旧文件的写者应该停止写入，它之后的修改不会出现在新文件中。
+ */
+bool shm_map_build(int capacity, size_t mem_size, const char *dat_file_path, shmmap_log log, int flags,
+	const shm_map_kv *kvs, int n, int threads);
+/* 数据文件的代数，每次shm_map_build发布新文件时加1 */
+unsigned int shm_map_generation(shm_map_t *map);
+/*
+ * 数据文件已经被shm_map_build替换时，重新打开路径上的新文件，map指向新的映射。
+ * 旧的映射被解除，调用时进程中不能有线程在使用旧映射中的指针
+ * return: 1重新打开了新文件，0没有被替换，-1打开新文件失败，map仍然指向旧的映射
+ */
+int shm_map_reload(shm_map_t *map);
+
+/* map当前的版本号，每次成功的put、remove之后加1，可能回绕 */
+unsigned int shm_map_version(shm_map_t *map);
+/*
+ * 等待map被修改，读者不需要定时轮询。版本号在共享内存中，写者修改后通过futex唤醒所有进程中的等待者
+ * last_version: 读者上次看到的版本号，版本号已经不同时立即返回
+ * timeout_ms: 最多等待的毫秒数，小于0时一直等待，0时不等待
+ * return: 当前的版本号，等于last_version表示超时
+ */
+unsigned int shm_map_wait_change(shm_map_t *map, unsigned int last_version, int timeout_ms);
+/*
+ * 把游标设置到修改日志的当前位置，map没有SHM_MAP_CHANGE_LOG时返回false
+ * 全量同步时先调用它，再用shm_map_iter遍历map，然后从游标开始读日志。遍历期间的修改会在日志中再出现一次
+ */
+bool shm_map_log_start(shm_map_t *map, shm_map_log_cursor *cur);
+/*
+ * 读出游标处的一条记录，把key复制到k_buf，游标前进到下一条
+ * return: MAP_LOG_OK；MAP_LOG_EMPTY没有新的记录；
+ * 		MAP_LOG_OVERFLOW游标处的记录已经被写者覆盖，需要用shm_map_log_start重新全量同步；
+ * 		MAP_LOG_SMALL_BUF k_buf放不下key，rec->key_len是key的长度，游标不变；
+ * 		MAP_LOG_NO_LOG map没有SHM_MAP_CHANGE_LOG，重新同步也不会有记录
+ */
+int shm_map_log_next(shm_map_t *map, shm_map_log_cursor *cur, shm_map_log_rec *rec, void *k_buf, size_t buf_len);
+
+/*
+ * 增量整理内存池，由写者周期性地调用，每次只做一小步，读者不需要停止。
+ * 一轮整理把堆尾部的entry、key、value拷贝到前面的空闲块中，替换索引中的偏移量，旧的块延迟回收；
+ * 一轮结束后，尾部变成空闲的run和大块被还给未分配区，未分配区可以再用shm_map_trim释放。
+ * 无锁内存池的空闲小块不能从栈中摘除，只有大块会被搬走。
+ * budget: 本次最多整理的桶数(swiss table为slot数)
+ * return: 还给未分配区的字节数，一轮还没有结束时返回0
+ */
+int64_t shm_map_compact(shm_map_t *map, int budget);
+/*
+ * 释放未分配区和空闲大块占用的物理内存，数据文件的这部分空间被打洞
+ * return: 释放的字节数，文件系统不支持时返回-1
+ */
+int64_t shm_map_trim(shm_map_t *map);
+
+//**********************旧的接口，操作map_init打开的map**********************//
+/*
+ * 初始化map，同shm_map_open，打开的map作为之后map_*接口的默认map
+ * 再次调用时先关闭之前的默认map
+ */
+bool map_init(int capacity, size_t mem_size, const char *dat_file_path, shmmap_log log);
+bool map_init_opt(int capacity, size_t mem_size, const char *dat_file_path, shmmap_log log, int flags);
+/* map_init打开的map */
+shm_map_t* map_default();
 char* map_put(const char *k, const char *v);
 char* map_get(const char *k);
-
+int map_get_copy(const char *k, char *buf, int buf_len);
+bool map_put2(const void *k, size_t k_len, const void *v, size_t v_len);
+bool map_get2(const void *k, size_t k_len, const void **v, size_t *v_len);
+int map_get_many(int n, const void * const *keys, const size_t *k_lens, const void **vals, size_t *v_lens);
+int map_put_many(int n, const void * const *keys, const size_t *k_lens, const void * const *vals, const size_t *v_lens);
+bool map_put_ttl(const void *k, size_t k_len, const void *v, size_t v_len, int ttl);
+bool map_remove(const char *k);
+bool map_remove2(const void *k, size_t k_len);
+bool map_remove_if(const void *k, size_t k_len, const void *v, size_t v_len);
+bool map_reader_enter();
+void map_reader_exit();
+bool map_snapshot(const char *path);
+unsigned int map_generation();
+int map_reload();
+unsigned int map_version();
+unsigned int map_wait_change(unsigned int last_version, int timeout_ms);
+bool map_log_start(shm_map_log_cursor *cur);
+int map_log_next(shm_map_log_cursor *cur, shm_map_log_rec *rec, void *k_buf, size_t buf_len);
 int map_size();
 bool map_contains(const char *k);
 void map_iter(key_iter);
+void map_scan_init(shm_map_cursor *cur, int part, int parts);
+int map_scan(shm_map_cursor *cur, shm_map_kv *kvs, int batch);
+int map_range(const void *lo, size_t lo_len, const void *hi, size_t hi_len, shm_map_kv *kvs, int n);
+int map_prefix(const void *p, size_t p_len, const void *after, size_t after_len, shm_map_kv *kvs, int n);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,183 @@
+/**
+ *
+ * 分片的map
+ *
+ * @file shm_shard.c
+ * @author chosen0ne
+ * @date 2026-10-17
+ */
+
+#include <stdlib.h>
+
+#include "shm_shard.h"
+#include "shm_hash.h"
+
+struct shm_shard {
+	int count;
+	shmmap_log log;
+	shm_map_t *maps[];
+};
+
+static shm_map_t* shard_for(shm_shard_t *shard, const void *k, size_t k_len);
+
+shm_shard_t*
+shm_shard_open(int shard_count, int capacity, size_t mem_size, const char *dat_file_path, shmmap_log log, int flags){
+	shm_shard_t *shard;
+	char 		*path;
+	size_t 		path_len;
+	int 		i;
+
+	if(log == NULL){
+		log = default_shmmap_log;
+	}
+	if(shard_count <= 0 || shard_count > SHM_SHARD_MAX){
+		log(SHMMAP_LOG_ERROR, "[shm_shard_open]The shard count %d must be in [1, %d]", shard_count, SHM_SHARD_MAX);
+		return NULL;
+	}
+	if(dat_file_path == NULL){
+		dat_file_path = DATA_FILE;
+	}
+	path_len = strlen(dat_file_path) + 16;
+	shard = (shm_shard_t *)calloc(1, sizeof(shm_shard_t) + sizeof(shm_map_t *) * shard_count);
+	path = (char *)malloc(path_len);
+	if(shard == NULL || path == NULL){
+		log(SHMMAP_LOG_ERROR, "[shm_shard_open]Can't allocate memory for shards");
+		free(shard);
+		free(path);
+		return NULL;
+	}
+	shard->log = log;
+	shard->count = shard_count;
+	for(i=0; i<shard_count; i++){
+		snprintf(path, path_len, "%s.%d", dat_file_path, i);
+		shard->maps[i] = shm_map_open(capacity, mem_size, path, log, flags);
+		if(shard->maps[i] == NULL){
+			log(SHMMAP_LOG_ERROR, "[shm_shard_open]Open shard %d error, path: %s", i, path);
+			free(path);
+			shm_shard_close(shard);
+			return NULL;
+		}
+	}
+	free(path);
+	return shard;
+}
+
+void
+shm_shard_close(shm_shard_t *shard){
+	int i;
+
+	if(shard == NULL)
+		return;
+	for(i=0; i<shard->count; i++)
+		shm_map_close(shard->maps[i]);
+	free(shard);
+}
+
+int
+shm_shard_count(shm_shard_t *shard){
+	return shard->count;
+}
+
+/* 用hash值的高32位乘以分片个数选择分片，分片个数不需要是2的幂 */
+int
+shm_shard_index(shm_shard_t *shard, const void *k, size_t k_len){
+	uint64_t h = shm_hash64(k, k_len, SHM_SHARD_SEED);
+	return (int)(((h >> 32) * (uint64_t)shard->count) >> 32);
+}
+
+shm_map_t*
+shm_shard_map(shm_shard_t *shard, int i){
+	if(i < 0 || i >= shard->count)
+		return NULL;
+	return shard->maps[i];
+}
+
+static shm_map_t*
+shard_for(shm_shard_t *shard, const void *k, size_t k_len){
+	return shard->maps[shm_shard_index(shard, k, k_len)];
+}
+
+char*
+shm_shard_put(shm_shard_t *shard, const char *k, const char *v){
+	return shm_map_put(shard_for(shard, k, strlen(k)), k, v);
+}
+
+char*
+shm_shard_get(shm_shard_t *shard, const char *k){
+	return shm_map_get(shard_for(shard, k, strlen(k)), k);
+}
+
+int
+shm_shard_get_copy(shm_shard_t *shard, const char *k, char *buf, int buf_len){
+	return shm_map_get_copy(shard_for(shard, k, strlen(k)), k, buf, buf_len);
+}
+
+bool
+shm_shard_put2(shm_shard_t *shard, const void *k, size_t k_len, const void *v, size_t v_len){
+	return shm_map_put2(shard_for(shard, k, k_len), k, k_len, v, v_len);
+}
+
+bool
+shm_shard_get2(shm_shard_t *shard, const void *k, size_t k_len, const void **v, size_t *v_len){
+	return shm_map_get2(shard_for(shard, k, k_len), k, k_len, v, v_len);
+}
+
+bool
+shm_shard_remove(shm_shard_t *shard, const char *k){
+	return shm_map_remove(shard_for(shard, k, strlen(k)), k);
+}
+
+bool
+shm_shard_remove2(shm_shard_t *shard, const void *k, size_t k_len){
+	return shm_map_remove2(shard_for(shard, k, k_len), k, k_len);
+}
+
+bool
+shm_shard_remove_if(shm_shard_t *shard, const void *k, size_t k_len, const void *v, size_t v_len){
+	return shm_map_remove_if(shard_for(shard, k, k_len), k, k_len, v, v_len);
+}
+
+bool
+shm_shard_contains(shm_shard_t *shard, const char *k){
+	return shm_map_contains(shard_for(shard, k, strlen(k)), k);
+}
+
+bool
+shm_shard_reader_enter(shm_shard_t *shard){
+	int i;
+
+	for(i=0; i<shard->count; i++){
+		if(!shm_map_reader_enter(shard->maps[i])){
+			// 离开已经进入的分片
+			while(--i >= 0)
+				shm_map_reader_exit(shard->maps[i]);
+			return false;
+		}
+	}
+	return true;
+}
+
+void
+shm_shard_reader_exit(shm_shard_t *shard){
+	int i;
+
+	for(i=0; i<shard->count; i++)
+		shm_map_reader_exit(shard->maps[i]);
+}
+
+int
+shm_shard_size(shm_shard_t *shard){
+	int i, total = 0;
+
+	for(i=0; i<shard->count; i++)
+		total += shm_map_size(shard->maps[i]);
+	return total;
+}
+
+void
+shm_shard_iter(shm_shard_t *shard, key_iter it){
+	int i;
+
+	for(i=0; i<shard->count; i++)
+		shm_map_iter(shard->maps[i], it);
+}
@@ -0,0 +1,68 @@
+/**
+ *
+ * 分片的map：key按hash分散到多个数据文件，每个分片是一个独立的shm_map_t。
+ * 每个分片可以有自己的写者进程(线程)，写操作可以在多个核上并行；读者看到的是一个map。
+ * 所有进程打开时的分片个数必须相同，否则同一个key会被分到不同的分片。
+ *
+ * @file shm_shard.h
+ * @author chosen0ne
+ * @date 2026-10-17
+ */
+
+#ifndef SHMMAP_SHM_SHARD_H
+#define SHMMAP_SHM_SHARD_H
+
+#include "shm_map.h"
+
+/* 分片个数的上限 */
+#define SHM_SHARD_MAX 1024
+/* 选择分片的hash种子，固定的种子保证所有进程把同一个key分到同一个分片 */
+#define SHM_SHARD_SEED 0x5348415244534d53ull
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct shm_shard shm_shard_t;
+
+/*
+ * 打开分片的map，第i个分片的数据文件为"dat_file_path.i"
+ * shard_count: 分片个数
+ * capacity、mem_size: 每个分片的容量和共享内存大小
+ * flags: 每个分片的选项，同shm_map_open
+ * return: 出错时返回NULL，已经打开的分片被关闭
+ */
+shm_shard_t* shm_shard_open(int shard_count, int capacity, size_t mem_size, const char *dat_file_path, shmmap_log log, int flags);
+void shm_shard_close(shm_shard_t *shard);
+
+int shm_shard_count(shm_shard_t *shard);
+/* key所在的分片，写者只写自己负责的分片时用来过滤key */
+int shm_shard_index(shm_shard_t *shard, const void *k, size_t k_len);
+/* 第i个分片的map */
+shm_map_t* shm_shard_map(shm_shard_t *shard, int i);
+
+/* 以下操作按key路由到对应的分片，语义与shm_map_*相同 */
+char* shm_shard_put(shm_shard_t *shard, const char *k, const char *v);
+char* shm_shard_get(shm_shard_t *shard, const char *k);
+int shm_shard_get_copy(shm_shard_t *shard, const char *k, char *buf, int buf_len);
+bool shm_shard_put2(shm_shard_t *shard, const void *k, size_t k_len, const void *v, size_t v_len);
+bool shm_shard_get2(shm_shard_t *shard, const void *k, size_t k_len, const void **v, size_t *v_len);
+bool shm_shard_remove(shm_shard_t *shard, const char *k);
+bool shm_shard_remove2(shm_shard_t *shard, const void *k, size_t k_len);
+bool shm_shard_remove_if(shm_shard_t *shard, const void *k, size_t k_len, const void *v, size_t v_len);
+bool shm_shard_contains(shm_shard_t *shard, const char *k);
+
+/* 读者进入、离开所有分片的临界区 */
+bool shm_shard_reader_enter(shm_shard_t *shard);
+void shm_shard_reader_exit(shm_shard_t *shard);
+
+/* 所有分片中key的个数之和 */
+int shm_shard_size(shm_shard_t *shard);
+/* 依次遍历每个分片 */
+void shm_shard_iter(shm_shard_t *shard, key_iter it);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
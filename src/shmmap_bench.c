@@ -0,0 +1,128 @@
+/**
+ *
+ * 对比链式桶索引和swiss table索引的查找性能，以及逐个get2和批量get_many的性能
+ * 用法: shmmap_bench [key个数] [查找次数]
+ *
+ * @file shmmap_bench.c
+ * @author chosen0ne
+ * @date 2026-10-17
+ */
+
+#include"shm_map.h"
+#include<stdio.h>
+#include<stdlib.h>
+#include<unistd.h>
+#include<time.h>
+
+#define BENCH_FILE "shmmap_bench.dat"
+/* 批量查找时一批的key数 */
+#define BENCH_BATCH 256
+
+static double
+now_sec(){
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* 生成一批随机的、存在的key */
+static void
+bench_keys(int n, char bufs[][32], const void **keys, size_t *k_lens){
+	int j;
+
+	for(j=0; j<BENCH_BATCH; j++){
+		k_lens[j] = snprintf(bufs[j], 32, "key-%d", rand() % n);
+		keys[j] = bufs[j];
+	}
+}
+
+/* 分别用逐个get2和get_many查找随机的key，返回两者每个key的耗时 */
+static void
+bench_batch(shm_map_t *map, int n, int lookups, double *single_ns, double *batch_ns){
+	static char 	bufs[BENCH_BATCH][32];
+	const void 		*keys[BENCH_BATCH], *vals[BENCH_BATCH];
+	size_t 			k_lens[BENCH_BATCH], v_lens[BENCH_BATCH];
+	double 			single = 0, batch = 0, start;
+	int 			i, j, hit = 0;
+
+	for(i=0; i<lookups; i+=BENCH_BATCH){
+		// 两种方式各用一批新的key，避免后者查找前者已经读进cache的桶
+		bench_keys(n, bufs, keys, k_lens);
+		start = now_sec();
+		for(j=0; j<BENCH_BATCH; j++)
+			hit += shm_map_get2(map, keys[j], k_lens[j], &vals[j], &v_lens[j]);
+		single += now_sec() - start;
+		bench_keys(n, bufs, keys, k_lens);
+		start = now_sec();
+		hit += shm_map_get_many(map, BENCH_BATCH, keys, k_lens, vals, v_lens);
+		batch += now_sec() - start;
+	}
+	if(hit != 2 * ((lookups + BENCH_BATCH - 1) / BENCH_BATCH) * BENCH_BATCH)
+		fprintf(stderr, "batch lookups missed some keys\n");
+	*single_ns = single * 1e9 / lookups;
+	*batch_ns = batch * 1e9 / lookups;
+}
+
+static void
+bench(const char *name, int flags, int n, int lookups){
+	shm_map_t 	*map;
+	char 		k[32], v[32];
+	int 		i, hit = 0;
+	double 		start, put_time, get_time, miss_time, single_ns, batch_ns;
+
+	unlink(BENCH_FILE);
+	map = shm_map_open(n, (size_t)n * 128, BENCH_FILE, NULL, flags);
+	if(map == NULL){
+		fprintf(stderr, "%s: map_init_opt failed\n", name);
+		exit(1);
+	}
+
+	start = now_sec();
+	for(i=0; i<n; i++){
+		snprintf(k, sizeof(k), "key-%d", i);
+		snprintf(v, sizeof(v), "val-%d", i);
+		shm_map_put(map, k, v);
+	}
+	put_time = now_sec() - start;
+
+	srand(1);
+	shm_map_reader_enter(map);
+	start = now_sec();
+	for(i=0; i<lookups; i++){
+		snprintf(k, sizeof(k), "key-%d", rand() % n);
+		if(shm_map_get(map, k) != NULL)
+			hit++;
+	}
+	get_time = now_sec() - start;
+
+	start = now_sec();
+	for(i=0; i<lookups; i++){
+		snprintf(k, sizeof(k), "miss-%d", rand() % n);
+		if(shm_map_get(map, k) != NULL)
+			hit++;
+	}
+	miss_time = now_sec() - start;
+	bench_batch(map, n, lookups, &single_ns, &batch_ns);
+	shm_map_reader_exit(map);
+
+	printf("%-8s put %7.1f ns/op, get hit %7.1f ns/op, get miss %7.1f ns/op, hit %d/%d\n",
+		name, put_time * 1e9 / n, get_time * 1e9 / lookups, miss_time * 1e9 / lookups, hit, lookups);
+	printf("%-8s get2 %7.1f ns/op, get_many(%d) %7.1f ns/op\n", name, single_ns, BENCH_BATCH, batch_ns);
+	shm_map_close(map);
+	unlink(BENCH_FILE);
+}
+
+int
+main(int argc, char **argv){
+	int n = argc > 1 ? atoi(argv[1]) : 1000000;
+	int lookups = argc > 2 ? atoi(argv[2]) : 2000000;
+
+	if(n <= 0 || lookups <= 0){
+		fprintf(stderr, "usage: %s [keys] [lookups]\n", argv[0]);
+		return 1;
+	}
+	bench("chained", 0, n, lookups);
+	bench("swiss", SHM_MAP_SWISS_INDEX, n, lookups);
+	return 0;
+}
@@ -0,0 +1,92 @@
+/**
+ *
+ * 离线批量构建数据文件，替换正在使用的文件，已经打开旧文件的读者通过shm_map_reload切换到新文件
+ * 用法: shmmap_build 输入文件 数据文件 容量 内存池字节数 [线程数] [flags]
+ * 输入文件每行是一个key和value，用'\t'分隔
+ *
+ * @file shmmap_build.c
+ * @author chosen0ne
+ * @date 2026-10-17
+ */
+
+#include"shm_map.h"
+#include<stdio.h>
+#include<stdlib.h>
+#include<unistd.h>
+#include<time.h>
+
+static double
+now_sec(){
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* 把映射的输入按行切分成key、value，直接指向映射中的数据，返回key的个数 */
+static int
+parse_input(const char *p, size_t len, shm_map_kv *kvs){
+	const char 	*end = p + len, *line_end, *tab;
+	int 		n = 0;
+
+	while(p < end){
+		line_end = (const char *)memchr(p, '\n', end - p);
+		if(line_end == NULL)
+			line_end = end;
+		tab = (const char *)memchr(p, '\t', line_end - p);
+		if(tab != NULL){
+			if(kvs != NULL){
+				kvs[n].k = p;
+				kvs[n].k_len = tab - p;
+				kvs[n].v = tab + 1;
+				kvs[n].v_len = line_end - tab - 1;
+			}
+			n++;
+		}
+		p = line_end + 1;
+	}
+	return n;
+}
+
+int
+main(int argc, char **argv){
+	shm_map_kv 	*kvs;
+	struct stat st;
+	char 		*p;
+	int 		fd, n, threads, flags;
+	double 		start;
+
+	if(argc < 5){
+		fprintf(stderr, "usage: %s input dat_file capacity mem_size [threads] [flags]\n", argv[0]);
+		return 1;
+	}
+	threads = argc > 5 ? atoi(argv[5]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+	flags = argc > 6 ? (int)strtol(argv[6], NULL, 0) : 0;
+	fd = open(argv[1], O_RDONLY);
+	if(fd == -1 || fstat(fd, &st) == -1){
+		fprintf(stderr, "Open input error, path: %s, msg: %s\n", argv[1], strerror(errno));
+		return 1;
+	}
+	p = st.st_size > 0 ? (char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+	if(p == MAP_FAILED){
+		fprintf(stderr, "Map input error, path: %s, msg: %s\n", argv[1], strerror(errno));
+		return 1;
+	}
+	n = p != NULL ? parse_input(p, st.st_size, NULL) : 0;
+	kvs = (shm_map_kv *)malloc(sizeof(shm_map_kv) * (n + 1));
+	if(kvs == NULL){
+		fprintf(stderr, "Can't allocate memory for %d keys\n", n);
+		return 1;
+	}
+	if(p != NULL)
+		parse_input(p, st.st_size, kvs);
+
+	start = now_sec();
+	if(!shm_map_build(atoi(argv[3]), (size_t)strtoull(argv[4], NULL, 0), argv[2], NULL, flags, kvs, n, threads)){
+		fprintf(stderr, "Build %s error\n", argv[2]);
+		return 1;
+	}
+	printf("built %d keys into %s with %d threads in %.3f s\n", n, argv[2], threads, now_sec() - start);
+	free(kvs);
+	return 0;
+}
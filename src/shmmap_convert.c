@@ -0,0 +1,151 @@
+/**
+ *
+ * 把版本0(没有文件头)的数据文件转换成当前的格式，读出所有的key、value，用shm_map_build写入新文件。
+ * 新旧文件可以是同一个路径，转换完成后替换旧文件；转换期间不能有写者写旧文件
+ * 用法: shmmap_convert 旧数据文件 新数据文件 容量 内存池字节数 [线程数] [flags]
+ *
+ * 版本0的文件：
+ * Bulk list len 	(4bytes)
+ * padding			(4bytes)
+ * Map size			(4bytes)
+ * padding			(4bytes)
+ * Bulk list		({header_offset, tail_offset, size}，12bytes * bulk_list_len)
+ * padding			(4bytes)
+ * 内存池			(偏移量都是相对内存池起始地址的32位int，NIL为-1)
+ * entry是{prev_offset, next_offset, hash, key_offset, value_offset}，key、value是以'\0'结尾的字符串
+ *
+ * @file shmmap_convert.c
+ * @author chosen0ne
+ * @date 2026-10-17
+ */
+
+#include"shm_map.h"
+#include<stdio.h>
+#include<stdlib.h>
+#include<unistd.h>
+
+#define OLD_HEADER_INTS 4
+#define OLD_BULK_INTS 3
+#define OLD_ENTRY_INTS 5
+#define OLD_NIL -1
+
+typedef struct {
+	const char 	*pool;		// 内存池的起始地址
+	size_t 		pool_len;	// 文件中内存池的字节数
+} old_file;
+
+/* 偏移量处有len个字节时返回它的地址，否则返回NULL */
+static const char*
+old_ptr(const old_file *f, int offset, size_t len){
+	if(offset < 0 || (size_t)offset > f->pool_len || f->pool_len - offset < len)
+		return NULL;
+	return f->pool + offset;
+}
+
+/* 偏移量处以'\0'结尾的字符串，越界时返回NULL */
+static const char*
+old_str(const old_file *f, int offset, size_t *len){
+	const char *p = old_ptr(f, offset, 1), *end;
+
+	if(p == NULL)
+		return NULL;
+	end = (const char *)memchr(p, 0, f->pool + f->pool_len - p);
+	if(end == NULL)
+		return NULL;
+	*len = end - p;
+	return p;
+}
+
+/*
+ * 遍历所有桶的链表，kvs不为NULL时填充key、value，返回key的个数，文件损坏时返回-1
+ * 每个桶最多走size个entry，防止损坏的文件中链表有环
+ */
+static int
+read_entries(const old_file *f, const int *bulks, int bulk_len, shm_map_kv *kvs){
+	const int 	*entry;
+	int 		i, j, n = 0, offset;
+
+	for(i=0; i<bulk_len; i++){
+		offset = bulks[i * OLD_BULK_INTS];
+		for(j=0; j<bulks[i * OLD_BULK_INTS + 2] && offset != OLD_NIL; j++){
+			entry = (const int *)old_ptr(f, offset, sizeof(int) * OLD_ENTRY_INTS);
+			if(entry == NULL)
+				return -1;
+			if(kvs != NULL){
+				kvs[n].k = old_str(f, entry[3], &kvs[n].k_len);
+				kvs[n].v = old_str(f, entry[4], &kvs[n].v_len);
+				if(kvs[n].k == NULL || kvs[n].v == NULL)
+					return -1;
+			}
+			n++;
+			offset = entry[1];
+		}
+	}
+	return n;
+}
+
+int
+main(int argc, char **argv){
+	shm_map_kv 	*kvs;
+	struct stat st;
+	old_file 	f;
+	const int 	*ints;
+	char 		*p;
+	size_t 		header_len;
+	int 		fd, n, size, bulk_len, threads, flags;
+
+	if(argc < 5){
+		fprintf(stderr, "usage: %s old_dat_file dat_file capacity mem_size [threads] [flags]\n", argv[0]);
+		return 1;
+	}
+	threads = argc > 5 ? atoi(argv[5]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+	flags = argc > 6 ? (int)strtol(argv[6], NULL, 0) : 0;
+	fd = open(argv[1], O_RDONLY);
+	if(fd == -1 || fstat(fd, &st) == -1){
+		fprintf(stderr, "Open old data file error, path: %s, msg: %s\n", argv[1], strerror(errno));
+		return 1;
+	}
+	if((size_t)st.st_size < sizeof(int) * OLD_HEADER_INTS){
+		fprintf(stderr, "%s is too small to be a data file\n", argv[1]);
+		return 1;
+	}
+	p = (char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(p == MAP_FAILED){
+		fprintf(stderr, "Map old data file error, path: %s, msg: %s\n", argv[1], strerror(errno));
+		return 1;
+	}
+	ints = (const int *)p;
+	if(ints[0] == MAP_MAGIC){
+		fprintf(stderr, "%s is already a data file of version %d, not version 0\n", argv[1], ints[1]);
+		return 1;
+	}
+	// 版本0的桶数是2的幂
+	bulk_len = ints[0];
+	size = ints[2];
+	header_len = sizeof(int) * OLD_HEADER_INTS + sizeof(int) * OLD_BULK_INTS * (size_t)bulk_len + sizeof(int);
+	if(bulk_len <= 0 || (bulk_len & (bulk_len - 1)) != 0 || header_len > (size_t)st.st_size){
+		fprintf(stderr, "%s is not a data file of version 0, bulk list len: %d\n", argv[1], bulk_len);
+		return 1;
+	}
+	f.pool = p + header_len;
+	f.pool_len = st.st_size - header_len;
+
+	n = read_entries(&f, ints + OLD_HEADER_INTS, bulk_len, NULL);
+	kvs = n >= 0 ? (shm_map_kv *)malloc(sizeof(shm_map_kv) * (n + 1)) : NULL;
+	if(n < 0 || kvs == NULL || read_entries(&f, ints + OLD_HEADER_INTS, bulk_len, kvs) != n){
+		fprintf(stderr, "%s is corrupted, an entry points outside of the file\n", argv[1]);
+		return 1;
+	}
+	if(n != size)
+		fprintf(stderr, "The map size of %s is %d, but %d keys are found, convert the found keys\n", argv[1], size, n);
+
+	if(!shm_map_build(atoi(argv[3]), (size_t)strtoull(argv[4], NULL, 0), argv[2], NULL, flags, kvs, n, threads)){
+		fprintf(stderr, "Build %s error\n", argv[2]);
+		return 1;
+	}
+	printf("converted %d keys from %s into %s\n", n, argv[1], argv[2]);
+	free(kvs);
+	munmap(p, st.st_size);
+	return 0;
+}
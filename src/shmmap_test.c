@@ -32,10 +32,10 @@ main(){
 				map_iter(print_iter);
 				break;
 			case 4:
-				m_free_list_info();
+				m_free_list_info(shm_map_pool(map_default()));
 				break;
 			case 5:
-				printf("free size: %d\n", m_free_size());
+				printf("free size: %lld\n", (long long)m_free_size(shm_map_pool(map_default())));
 				break;
 
 		}